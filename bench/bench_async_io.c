@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "async_io.h"
+
+#define BENCH_FILE      "bench_async_io.db"
+#define BENCH_PAGE_SIZE 4096
+#define DEFAULT_PAGES   16384 // 64 MB
+
+static double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// reads every page once in a random order, keeping up to `queue_depth` reads in flight.
+static double random_read_pass(int fd, AsyncBackend backend, int queue_depth, const int *order, int pages,
+                               uint8_t *buffers)
+{
+    AsyncIO *aio = async_io_open(fd, BENCH_PAGE_SIZE, queue_depth, backend);
+    if (aio == nullptr)
+    {
+        return -1;
+    }
+
+    PageRequest *requests = malloc(sizeof(PageRequest) * queue_depth);
+    int *free_slots = malloc(sizeof(int) * queue_depth);
+    for (int i = 0; i < queue_depth; i++)
+    {
+        free_slots[i] = i;
+    }
+    int free_count = queue_depth;
+
+    double start = now_seconds();
+    int next = 0, completed = 0;
+    while (completed < pages)
+    {
+        while (free_count > 0 && next < pages)
+        {
+            int slot = free_slots[--free_count];
+            requests[slot] = (PageRequest){
+                .page_number = order[next++],
+                .buffer = buffers + (size_t)slot * BENCH_PAGE_SIZE,
+                .write = false,
+                .result = 1,
+            };
+            async_io_submit(aio, &requests[slot], 1);
+        }
+
+        int reaped = async_io_reap(aio, 1);
+        completed += reaped;
+        // slots whose result changed are free again.
+        for (int i = 0; i < queue_depth && reaped > 0; i++)
+        {
+            if (requests[i].result != 1)
+            {
+                requests[i].result = 1;
+                free_slots[free_count++] = i;
+                reaped--;
+            }
+        }
+    }
+    double elapsed = now_seconds() - start;
+
+    free(free_slots);
+    free(requests);
+    async_io_close(aio);
+    return elapsed;
+}
+
+int main(int argc, char **argv)
+{
+    int pages = argc > 1 ? atoi(argv[1]) : DEFAULT_PAGES;
+
+    int fd = open(BENCH_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        perror("open");
+        return EXIT_FAILURE;
+    }
+    uint8_t page[BENCH_PAGE_SIZE];
+    for (int i = 0; i < pages; i++)
+    {
+        memset(page, i & 0xFF, BENCH_PAGE_SIZE);
+        if (pwrite(fd, page, BENCH_PAGE_SIZE, (off_t)i * BENCH_PAGE_SIZE) != BENCH_PAGE_SIZE)
+        {
+            perror("pwrite");
+            return EXIT_FAILURE;
+        }
+    }
+    fsync(fd);
+    close(fd);
+
+    // O_DIRECT keeps the OS page cache out of the measurement, it isn't supported everywhere (tmpfs).
+    bool direct = true;
+    fd = open(BENCH_FILE, O_RDONLY | O_DIRECT);
+    if (fd < 0)
+    {
+        direct = false;
+        fd = open(BENCH_FILE, O_RDONLY);
+    }
+
+    int *order = malloc(sizeof(int) * pages);
+    for (int i = 0; i < pages; i++)
+    {
+        order[i] = i;
+    }
+    srand(42);
+    for (int i = pages - 1; i > 0; i--)
+    {
+        int j = rand() % (i + 1);
+        int tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    uint8_t *buffers = aligned_alloc(BENCH_PAGE_SIZE, (size_t)32 * BENCH_PAGE_SIZE);
+
+    printf("random 4 KB reads over %d pages (%s)\n", pages, direct ? "O_DIRECT" : "buffered");
+    const AsyncBackend backends[] = {ASYNC_BACKEND_SYNC, ASYNC_BACKEND_IO_URING};
+    const char *names[] = {"sync", "io_uring"};
+    const int depths[] = {1, 32};
+    for (int b = 0; b < 2; b++)
+    {
+        for (int d = 0; d < 2; d++)
+        {
+            double elapsed = random_read_pass(fd, backends[b], depths[d], order, pages, buffers);
+            if (elapsed < 0)
+            {
+                printf("%-9s qd=%-3d unavailable\n", names[b], depths[d]);
+                continue;
+            }
+            printf("%-9s qd=%-3d %8.3f s %10.0f IOPS\n", names[b], depths[d], elapsed, pages / elapsed);
+        }
+    }
+
+    free(buffers);
+    free(order);
+    close(fd);
+    unlink(BENCH_FILE);
+    return EXIT_SUCCESS;
+}
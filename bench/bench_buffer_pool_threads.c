@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "storage_engine.h"
+
+#define BENCH_PATH      "bench_buffer_pool_threads.db"
+#define CACHE_FRAMES    8192
+#define WORKING_PAGES   4096 // fits in the pool: every read is a hit once the pool is warm
+#define READS           200000
+#define DEFAULT_THREADS 16
+
+typedef struct Reader
+{
+    Pager *pager;
+    int first;
+    unsigned seed;
+} Reader;
+
+static double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void *read_random_pages(void *argument)
+{
+    Reader *reader = argument;
+    Page page;
+    for (int i = 0; i < READS; i++)
+    {
+        int page_number = reader->first + (int)(rand_r(&reader->seed) % WORKING_PAGES);
+        if (read_page_with_cache(reader->pager, page_number, &page) != 0)
+        {
+            return (void *)1;
+        }
+    }
+    return nullptr;
+}
+
+// returns the reads per second of `threads` readers sharing the pool, or -1 on error.
+static double read_throughput(Pager *pager, int first, int threads)
+{
+    pthread_t ids[threads];
+    Reader readers[threads];
+    double start = now_seconds();
+    for (int i = 0; i < threads; i++)
+    {
+        readers[i] = (Reader){pager, first, (unsigned)i + 1};
+        if (pthread_create(&ids[i], nullptr, read_random_pages, &readers[i]) != 0)
+        {
+            return -1;
+        }
+    }
+    bool failed = false;
+    for (int i = 0; i < threads; i++)
+    {
+        void *result;
+        pthread_join(ids[i], &result);
+        failed = failed || result != nullptr;
+    }
+    double elapsed = now_seconds() - start;
+    return failed ? -1 : (double)threads * READS / elapsed;
+}
+
+int main(int argc, char **argv)
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : DEFAULT_THREADS;
+
+    remove(BENCH_PATH);
+    Pager *pager = open_database(BENCH_PATH, nullptr);
+    if (pager == nullptr)
+    {
+        perror("open_database");
+        return EXIT_FAILURE;
+    }
+    int first = allocate_pages(pager, WORKING_PAGES);
+    close_database(pager);
+
+    printf("random reads of %d cached pages, %d reads per thread\n", WORKING_PAGES, READS);
+    printf("%7s %18s %18s\n", "threads", "1 shard (reads/s)", "sharded (reads/s)");
+    int huge_frames = 0;
+    for (int threads = 1; threads <= max_threads; threads *= 2)
+    {
+        double throughput[2];
+        const int shards[] = {1, DEFAULT_CACHE_SHARDS};
+        for (int s = 0; s < 2; s++)
+        {
+            DatabaseOptions options = {.cache_size = CACHE_FRAMES, .cache_shards = shards[s]};
+            pager = open_database(BENCH_PATH, &options);
+            if (pager == nullptr)
+            {
+                perror("open_database");
+                return EXIT_FAILURE;
+            }
+            Page page;
+            for (int i = 0; i < WORKING_PAGES; i++)
+            {
+                read_page_with_cache(pager, first + i, &page);
+            }
+            throughput[s] = read_throughput(pager, first, threads);
+            huge_frames = huge_page_frames(pager);
+            close_database(pager);
+        }
+        printf("%7d %18.0f %18.0f\n", threads, throughput[0], throughput[1]);
+    }
+
+    printf("%d of %d frames backed by huge pages\n", huge_frames, CACHE_FRAMES);
+
+    remove(BENCH_PATH);
+    return EXIT_SUCCESS;
+}
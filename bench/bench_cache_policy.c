@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "storage_engine.h"
+
+#define BENCH_PATH    "bench_cache_policy.db"
+#define DEFAULT_PAGES 8192 // 32 MB
+#define CACHE_FRAMES  512
+#define HOT_PAGES     256  // the pages of the index that point lookups keep coming back to
+#define LOOKUPS       100000
+#define SCAN_STEP     4    // pages read by the scan between two lookups
+
+static double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// nine lookups out of ten go to the hot pages, the others anywhere in the datafile.
+static int lookup_page(int first, int pages)
+{
+    if (rand() % 10 != 0)
+    {
+        return first + rand() % HOT_PAGES;
+    }
+    return first + rand() % pages;
+}
+
+// runs `LOOKUPS` point lookups, with a full scan going on in between when `scan` is set.
+// returns the fraction of the lookups served by the buffer pool.
+static double lookup_hit_rate(Pager *pager, int first, int pages, bool scan)
+{
+    Page page;
+    uint64_t hits = 0;
+    int scanned = 0;
+    for (int i = 0; i < LOOKUPS; i++)
+    {
+        uint64_t before = cache_stats(pager).hits;
+        read_page_with_cache(pager, lookup_page(first, pages), &page);
+        hits += cache_stats(pager).hits - before;
+
+        for (int j = 0; scan && j < SCAN_STEP; j++)
+        {
+            read_page_with_cache(pager, first + scanned, &page);
+            scanned = (scanned + 1) % pages;
+        }
+    }
+    return (double)hits / LOOKUPS;
+}
+
+int main(int argc, char **argv)
+{
+    int pages = argc > 1 ? atoi(argv[1]) : DEFAULT_PAGES;
+
+    remove(BENCH_PATH);
+    Pager *pager = open_database(BENCH_PATH, nullptr);
+    if (pager == nullptr)
+    {
+        perror("open_database");
+        return EXIT_FAILURE;
+    }
+    int first = -1;
+    for (int allocated = 0; allocated < pages; allocated += 1024)
+    {
+        int run = allocate_pages(pager, pages - allocated < 1024 ? pages - allocated : 1024);
+        first = first == -1 ? run : first;
+    }
+    close_database(pager);
+
+    printf("point lookups on %d hot pages of %d, pool of %d frames, %d scanned pages per lookup\n", HOT_PAGES,
+           pages, CACHE_FRAMES, SCAN_STEP);
+    const CachePolicyKind policies[] = {CACHE_POLICY_LRU, CACHE_POLICY_2Q, CACHE_POLICY_ARC};
+    const char *names[] = {"LRU", "2Q", "ARC"};
+    for (int p = 0; p < 3; p++)
+    {
+        // without readahead the pages the scan brings in, and so the hit rates, only depend on the policy.
+        DatabaseOptions options = {.cache_size = CACHE_FRAMES, .cache_policy = policies[p], .readahead_pages = -1};
+        pager = open_database(BENCH_PATH, &options);
+        if (pager == nullptr)
+        {
+            perror("open_database");
+            return EXIT_FAILURE;
+        }
+
+        srand(42);
+        lookup_hit_rate(pager, first, pages, false); // warm up
+        double alone = lookup_hit_rate(pager, first, pages, false);
+        double start = now_seconds();
+        double during_scan = lookup_hit_rate(pager, first, pages, true);
+        double elapsed = now_seconds() - start;
+        printf("%-4s lookup hit rate %5.1f%% alone, %5.1f%% during the scan (%.3f s)\n", names[p], alone * 100,
+               during_scan * 100, elapsed);
+        close_database(pager);
+    }
+
+    remove(BENCH_PATH);
+    return EXIT_SUCCESS;
+}
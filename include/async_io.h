@@ -0,0 +1,52 @@
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include <stdbool.h>
+
+#define DEFAULT_IO_QUEUE_DEPTH 32
+
+// AsyncBackend is the mechanism used to run the page requests.
+typedef enum AsyncBackend
+{
+    ASYNC_BACKEND_AUTO,     // io_uring when the kernel allows it, synchronous I/O otherwise.
+    ASYNC_BACKEND_SYNC,     // every request is served with pread/pwrite while it is submitted.
+    ASYNC_BACKEND_IO_URING, // requests are queued on an io_uring and completed by the kernel.
+} AsyncBackend;
+
+// PageRequest describes one page to read into or write from `buffer`.
+// `result` is set once the request completes: 0 on success, -1 on error.
+// the request and its buffer must stay valid until the request has been reaped.
+typedef struct PageRequest
+{
+    int page_number;
+    void *buffer;
+    bool write;
+    int result;
+} PageRequest;
+
+typedef struct AsyncIO AsyncIO;
+
+// creates a queue of at most `queue_depth` requests in flight on the file `fd`, which is made of `page_size` pages.
+// io_uring is set up through raw system calls, `ASYNC_BACKEND_AUTO` falls back to the synchronous backend
+// when it is unavailable. returns nullptr if the requested backend can't be used.
+AsyncIO *async_io_open(int fd, int page_size, int queue_depth, AsyncBackend backend);
+
+// releases the queue. requests still in flight are waited for first.
+void async_io_close(AsyncIO *aio);
+
+// returns the backend chosen when the queue was opened.
+AsyncBackend async_io_backend(const AsyncIO *aio);
+
+// queues up to `count` requests without waiting for them to complete.
+// returns the number of queued requests, which is less than `count` once the queue is full or when the kernel
+// took only part of them, the requests after those weren't queued. returns -1 if none could be queued.
+int async_io_submit(AsyncIO *aio, PageRequest *requests, int count);
+
+// waits until at least `min_complete` requests (bounded by the requests in flight) have completed.
+// returns the number of requests completed by this call, or -1 on error.
+int async_io_reap(AsyncIO *aio, int min_complete);
+
+// returns the number of submitted requests that haven't been reaped yet.
+int async_io_in_flight(const AsyncIO *aio);
+
+#endif // ASYNC_IO_H
@@ -0,0 +1,47 @@
+#ifndef BPLUS_TREE_H
+#define BPLUS_TREE_H
+
+#include <stdint.h>
+
+#include "storage_engine.h"
+
+#define BPLUS_MAX_HEIGHT 16 // levels of a tree, far more than a datafile can fill with page-sized nodes
+
+// BPlusTree is an index from integer keys to byte string values kept in the pages of a database.
+// every node is a page read and written through the buffer pool of the pager, children are referenced by
+// their page number, so a tree grows past the size of the memory and survives the pager being closed.
+// internal nodes hold keys and child pages, the values live in the leaves, which are chained in key order.
+// the root stays on the page it was created on: the tree is found again from that page number alone.
+// a tree is used by one thread at a time.
+typedef struct BPlusTree BPlusTree;
+
+// creates an empty tree in the database and returns the page of its root, or -1 if it couldn't be allocated.
+int bplus_create(Pager *pager);
+
+// opens the tree whose root is `root_page`. returns nullptr if the page isn't the root of a tree.
+BPlusTree *bplus_open(Pager *pager, int root_page);
+
+// releases the tree, its pages stay in the database.
+void bplus_close(BPlusTree *tree);
+
+// returns the largest value `bplus_put` accepts, a quarter of a leaf.
+int bplus_max_value(const BPlusTree *tree);
+
+// stores `length` bytes of `value` under `key`, replacing the value it had.
+// a full node is split in two and its parent receives the first key of the new node.
+// returns -1 if the value is longer than `bplus_max_value` or a page couldn't be read or allocated.
+// the tree is left as it was then, the value `key` had included.
+int bplus_put(BPlusTree *tree, int64_t key, const void *value, int length);
+
+// copies at most `capacity` bytes of the value of `key` into `value` and returns the length of the value.
+// returns -1 with errno set to ENOENT if the key isn't in the tree, or on error.
+int bplus_get(BPlusTree *tree, int64_t key, void *value, int capacity);
+
+// removes `key` from the tree. nodes aren't merged, the space of the value is reused by the next insertions
+// into its leaf. returns -1 with errno set to ENOENT if the key isn't in the tree, or on error.
+int bplus_delete(BPlusTree *tree, int64_t key);
+
+// returns the number of levels of the tree, 1 for a tree that is a single leaf, or -1 on error.
+int bplus_height(BPlusTree *tree);
+
+#endif
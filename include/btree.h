@@ -2,7 +2,9 @@
 #define BTREE_H
 #include <stdbool.h>
 
-#define BTREE_ORDER 4
+#define BTREE_NODE_SIZE 4096 // a node fills a page of memory
+// the children a node can have: each pair takes a key, a value, its type and a child pointer.
+#define BTREE_ORDER ((BTREE_NODE_SIZE - 32) / 28)
 #define MAX_PAIRS (BTREE_ORDER - 1)
 
 typedef struct Pair Pair;
@@ -41,11 +43,17 @@ bool key_greater_than(PairType type, Key key, Key than);
 bool key_less_than(PairType type, Key key, Key than);
 bool key_equal_to(PairType type, Key key, Key to);
 
+// the keys of a node are kept apart from the values, so that a search within a node bisects a contiguous array.
+// internal nodes only use `keys` and `children`: child `i` holds the keys below key `i` and not below key `i - 1`.
+// leaves are chained in key order through `next` and `prev`, a scan moves from leaf to leaf without the root.
 struct BTreeNode
 {
-    Pair pairs[MAX_PAIRS];
+    Key keys[MAX_PAIRS];
+    Value values[MAX_PAIRS];
+    PairType value_types[MAX_PAIRS];
     BTreeNode *children[BTREE_ORDER];
     BTreeNode *next;
+    BTreeNode *prev;
     int num_pairs;
     bool is_leaf;
 };
@@ -57,6 +65,7 @@ BTreeNode *new_node(int num_pairs, bool is_leaf);
 void free_node(BTreeNode *node);
 
 // Split the child of the given node once it reaches the maximum number of pairs.
+// the upper half of the pairs moves to a new node and the key between both halves goes up into `node`.
 void btree_split_child(BTreeNode *node, int index);
 
 // insert to a node that didn't reach the maximum number of pairs yet.
@@ -64,7 +73,46 @@ void btree_insert_nonfull(BTreeNode *node, Pair pair);
 
 void btree_insert(BTreeNode **root, Pair pair);
 
+// builds a tree from the `count` `pairs`, which are sorted by key, and returns its root.
+// leaves are filled left to right to `fill_factor` of their capacity, then every level of internal nodes is built
+// above the one below it, so that no pair is inserted from the root and no node is split. a fill factor below 1
+// leaves room for later insertions. returns nullptr if the pairs aren't sorted or `fill_factor` isn't in (0, 1].
+BTreeNode *btree_bulk_load(const Pair *pairs, int count, double fill_factor);
+
 // searches for the given `key` and return whether it exsits in the list or not.
 bool btree_search(BTreeNode *root, Pair *pair);
 
+// BTreeCursor is a position on a pair of a leaf. a cursor that moved past either end of the tree is on no pair,
+// its `leaf` is nullptr. inserting into the tree invalidates its cursors.
+typedef struct BTreeCursor
+{
+    BTreeNode *leaf;
+    int index;
+} BTreeCursor;
+
+// returns a cursor on the first pair whose key isn't below `key`, a cursor on no pair if every key is below it.
+BTreeCursor btree_seek(BTreeNode *root, PairType type, Key key);
+
+// returns a cursor on the pair with the lowest key of the tree.
+BTreeCursor btree_first(BTreeNode *root);
+
+// returns a cursor on the pair with the highest key of the tree.
+BTreeCursor btree_last(BTreeNode *root);
+
+// returns whether the cursor is on a pair.
+bool cursor_valid(const BTreeCursor *cursor);
+
+// moves the cursor to the pair that follows, into the next leaf after the last pair of its leaf.
+// returns whether the cursor is on a pair.
+bool cursor_next(BTreeCursor *cursor);
+
+// moves the cursor to the pair that precedes, into the previous leaf before the first pair of its leaf.
+// returns whether the cursor is on a pair.
+bool cursor_prev(BTreeCursor *cursor);
+
+// the key, value and type of value of the pair the cursor is on, which must be valid.
+Key cursor_key(const BTreeCursor *cursor);
+Value cursor_value(const BTreeCursor *cursor);
+PairType cursor_value_type(const BTreeCursor *cursor);
+
 #endif
@@ -0,0 +1,43 @@
+#ifndef CACHE_POLICY_H
+#define CACHE_POLICY_H
+
+#include <stdbool.h>
+
+// CachePolicyKind is the replacement policy that picks the frames evicted from the buffer pool.
+typedef enum CachePolicyKind
+{
+    CACHE_POLICY_LRU, // evicts the least recently used page.
+    CACHE_POLICY_2Q,  // pages seen once wait in a small FIFO, only pages used again reach the main LRU.
+    CACHE_POLICY_ARC, // balances recency and frequency lists, adapting their sizes to the ghost hits.
+} CachePolicyKind;
+
+typedef struct CachePolicy CachePolicy;
+
+// tells whether a resident frame may be evicted, `context` is the one given to `cache_policy_victim`.
+typedef bool (*FrameFilter)(int frame, void *context);
+
+// creates a policy tracking the frames `0` to `capacity - 1` of a pool. returns nullptr if memory is exhausted.
+// 2Q and ARC also remember the page numbers of up to `capacity` evicted pages.
+CachePolicy *cache_policy_create(CachePolicyKind kind, int capacity);
+
+// releases the policy.
+void cache_policy_destroy(CachePolicy *policy);
+
+// returns the kind the policy was created with.
+CachePolicyKind cache_policy_kind(const CachePolicy *policy);
+
+// records a request for the page held by the resident `frame`.
+void cache_policy_touch(CachePolicy *policy, int frame);
+
+// records that `frame` now holds `page_number`, freshly loaded after a miss.
+// the frame must not be tracked already.
+void cache_policy_insert(CachePolicy *policy, int frame, int page_number);
+
+// returns the frame that should make room for `page_number`, among the frames accepted by `evictable`,
+// or -1 if there is none. the frame stays tracked until `cache_policy_evict` is called.
+int cache_policy_victim(CachePolicy *policy, int page_number, FrameFilter evictable, void *context);
+
+// stops tracking `frame` whose page leaves the pool. policies with a history remember its page number.
+void cache_policy_evict(CachePolicy *policy, int frame);
+
+#endif // CACHE_POLICY_H
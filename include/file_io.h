@@ -0,0 +1,25 @@
+#ifndef FILE_IO_H
+#define FILE_IO_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// reads `count` bytes at `offset`, retrying interrupted and short reads.
+// returns the number of bytes read, which is less than `count` only at the end of the file, or -1 on error.
+ssize_t pread_full(int fd, void *buf, size_t count, off_t offset);
+
+// reads into the buffers of `iov` back to back starting at `offset`, resuming after short reads.
+// `iov` is consumed by the call. returns the number of bytes read, which is less than the total
+// only at the end of the file, or -1 on error.
+ssize_t preadv_full(int fd, struct iovec *iov, int iovcnt, off_t offset);
+
+// writes `count` bytes at `offset`, retrying until the whole buffer reached the file.
+// returns 0, or -1 with `errno` set.
+int pwrite_full(int fd, const void *buf, size_t count, off_t offset);
+
+// writes the buffers of `iov` back to back starting at `offset`, resuming after short writes.
+// `iov` is consumed by the call. returns 0, or -1 with `errno` set.
+int pwritev_full(int fd, struct iovec *iov, int iovcnt, off_t offset);
+
+#endif // FILE_IO_H
@@ -0,0 +1,46 @@
+#ifndef IO_STATS_H
+#define IO_STATS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define LATENCY_BUCKETS 32 // the last bucket starts at about 2 seconds
+
+// LatencyHistogram counts timed calls by duration on a log scale: bucket `i` holds the calls that took
+// from 2^i to 2^(i+1) - 1 nanoseconds, bucket 0 also the ones under a nanosecond, the last bucket every longer call.
+typedef struct LatencyHistogram
+{
+    uint64_t buckets[LATENCY_BUCKETS];
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+} LatencyHistogram;
+
+// LatencyRecorder is the histogram that timed calls record into, from any thread without a lock.
+typedef struct LatencyRecorder
+{
+    atomic_uint_fast64_t buckets[LATENCY_BUCKETS];
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t total_ns;
+    atomic_uint_fast64_t max_ns;
+} LatencyRecorder;
+
+// returns the current time of the monotonic clock in nanoseconds.
+uint64_t monotonic_ns();
+
+// counts a call that took `ns` nanoseconds.
+void latency_record(LatencyRecorder *recorder, uint64_t ns);
+
+// returns a copy of the histogram. calls recorded meanwhile may be partly counted.
+LatencyHistogram latency_snapshot(LatencyRecorder *recorder);
+
+// returns an upper bound of the latency under which `fraction` of the calls completed, 0.99 for the 99th
+// percentile, from the bucket it falls in. returns 0 for an empty histogram.
+uint64_t latency_percentile(const LatencyHistogram *histogram, double fraction);
+
+// writes the count, mean, median, 99th percentile and maximum of the histogram on one line after `name`,
+// then one line per bucket that isn't empty. returns -1 if the output failed.
+int latency_dump(const LatencyHistogram *histogram, const char *name, FILE *output);
+
+#endif
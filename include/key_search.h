@@ -0,0 +1,31 @@
+#ifndef KEY_SEARCH_H
+#define KEY_SEARCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define KEY_SEARCH_WINDOW 32 // keys left to compare once bisection narrowed the range, in a single vector pass
+
+// KeySearchKind is an implementation of `int64_rank`, the vector ones depend on the instructions of the CPU.
+typedef enum KeySearchKind
+{
+    KEY_SEARCH_SCALAR, // bisection down to the last key
+    KEY_SEARCH_SSE42,  // bisection, then 2 keys per compare: SSE2 has no 64-bit compare, it came with SSE4.2
+    KEY_SEARCH_AVX2,   // bisection, then 4 keys per compare
+} KeySearchKind;
+
+// returns true if the CPU running the process can use `kind`.
+bool key_search_supported(KeySearchKind kind);
+
+// returns the fastest implementation the CPU supports, the one `int64_rank` uses. it is picked on the first call.
+KeySearchKind key_search_kind();
+
+// returns the number of the `count` ascending `keys` below `key`, or not above `key` when `inclusive` is set:
+// the position of the first key not below `key`, or above it. the range is bisected down to `KEY_SEARCH_WINDOW`
+// keys, which are counted with vector compares and a mask instead of a branch per key.
+int int64_rank(const int64_t *keys, int count, int64_t key, bool inclusive);
+
+// `int64_rank` with the implementation `kind`, which the CPU must support.
+int int64_rank_using(KeySearchKind kind, const int64_t *keys, int count, int64_t key, bool inclusive);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef PAGE_CODEC_H
+#define PAGE_CODEC_H
+
+#include <stdint.h>
+
+#define SLOT_UNIT           256 // slots are a whole number of units long and start on a unit boundary
+#define SLOT_HEADER_SIZE    32
+
+// PageCodecStats counts the pages of a compressed datafile and the space their slots take.
+typedef struct PageCodecStats
+{
+    uint64_t pages;             // pages stored in a slot
+    uint64_t slot_bytes;        // bytes of the slots holding those pages, headers included
+    uint64_t free_bytes;        // bytes of the slots left behind by pages that moved, reused by writes after a sync
+    uint64_t compressed_writes; // pages written compressed since the codec was opened
+    uint64_t raw_writes;        // pages written as they are because they didn't compress
+    uint64_t relocations;       // pages that outgrew their slot and moved to another one
+    uint64_t bytes_read;        // read from the file by `page_codec_read`
+    uint64_t bytes_written;     // written into the file by `page_codec_write`
+} PageCodecStats;
+
+// PageCodec stores the pages of a datafile compressed, each in a slot just large enough for it.
+// the slots follow each other after the first `data_offset` bytes of the file, every slot starts with a header
+// telling its page, its length and a sequence number. the page -> slot map is rebuilt when the codec is opened
+// by walking the slot headers, the newest valid slot of a page wins.
+// a page is rewritten in place when it still fits its slot, otherwise it moves to a free slot of the right size
+// or to the end of the file. the slot it leaves is only reused after `page_codec_sync`: until the new slot is on
+// disk, a crash finds the page in the old one. every function may be called from several threads, for different pages.
+typedef struct PageCodec PageCodec;
+
+// compresses `size` bytes of `source` into `destination`, which holds `capacity` bytes, with a byte-oriented
+// LZ77 codec in the spirit of LZ4. returns the compressed length, or -1 if it doesn't fit in `capacity`.
+int lz_compress(const uint8_t *source, int size, uint8_t *destination, int capacity);
+
+// decompresses `size` bytes of `source` into `destination`, which holds `capacity` bytes.
+// returns the decompressed length, or -1 if `source` is corrupt or decompresses to more than `capacity`.
+int lz_decompress(const uint8_t *source, int size, uint8_t *destination, int capacity);
+
+// opens the codec of the datafile `fd` made of `page_size` pages, whose slots start at `data_offset`.
+// returns nullptr if the slots couldn't be read or memory is exhausted.
+PageCodec *page_codec_open(int fd, int page_size, int64_t data_offset);
+
+// releases the codec, the file stays open.
+void page_codec_close(PageCodec *codec);
+
+// reads `page_number` into `page`. a page that was never written reads as zeros.
+// returns -1 with `errno` set to EIO when the slot of the page is damaged.
+int page_codec_read(PageCodec *codec, int page_number, uint8_t *page);
+
+// compresses `page` and writes it into the slot of `page_number`, or into a new slot when it doesn't fit.
+// pages that don't compress are stored as they are. returns 0, or -1 with `errno` set.
+int page_codec_write(PageCodec *codec, int page_number, const uint8_t *page);
+
+// syncs the file, then lets the slots pages moved out of before the sync be reused. returns -1 if the sync failed,
+// the slots are then kept for the next one.
+int page_codec_sync(PageCodec *codec);
+
+// returns the counters of the codec.
+PageCodecStats page_codec_stats(PageCodec *codec);
+
+#endif // PAGE_CODEC_H
@@ -2,58 +2,264 @@
 #define STORAGE_ENGINE_H
 
 #include<stdint.h>
+#include<stdbool.h>
+#include<stdatomic.h>
 
-#define PAGE_SIZE   4096
-#define FILENAME    "database.db"
-#define MAX_PAGES   1000
-#define MAX_CACHE   10
+#include "async_io.h"
+#include "cache_policy.h"
+#include "io_stats.h"
+#include "page_codec.h"
+#include "wal.h"
+
+#define MIN_PAGE_SIZE       4096
+#define MAX_PAGE_SIZE       65536
+#define DEFAULT_PAGE_SIZE   4096
+#define DATABASE_MAGIC      "MASQLITE"
+#define DATABASE_VERSION    1
+#define HEADER_PAGE         0
+#define MEMORY_DATABASE     ":memory:"
+#define DATABASE_COMPRESSED 1u // flag of a datafile whose pages are stored compressed by a `PageCodec`
+#define EXTENT_PAGES        64
+#define DEFAULT_CACHE_SIZE  256
+#define DEFAULT_CACHE_SHARDS 16
+#define MAX_CACHE_SHARDS    64
+#define READAHEAD_MIN_PAGES 4
+#define DEFAULT_READAHEAD_PAGES 64
 
 // Page is the representative format of the stored data inside the the datafile.
+// it can hold the largest page, only the first `page_size` bytes of the open database are read or written.
+// the pages handed out by `pin_page` and `view_page` are only `page_size` bytes long.
 typedef struct Page
 {
-    uint8_t data[PAGE_SIZE];
+    uint8_t data[MAX_PAGE_SIZE];
 } Page;
 
-// FeeList is where we keep track of the available pages in the datafile.
-typedef struct FreeList
+// DatabaseHeader is stored at the start of page 0 and describes the datafile, the page size is chosen
+// when the datafile is created. the free pages are tracked by bitmap pages: with `bits = page_size * 8`,
+// the bitmap at page `1 + k * bits` holds one bit per page for the `bits` pages starting with itself,
+// a set bit marks a page in use.
+typedef struct DatabaseHeader
 {
-    int list[MAX_PAGES];
-    int count;
-} FreeList;
+    char magic[8];       // `DATABASE_MAGIC`, without the terminating zero
+    uint32_t version;    // `DATABASE_VERSION` of the layout of the datafile
+    uint32_t page_size;  // a power of two between `MIN_PAGE_SIZE` and `MAX_PAGE_SIZE`
+    uint32_t page_count; // pages in use or free, including the header and the bitmaps
+    uint32_t free_count; // free pages below `page_count`
+    uint32_t free_hint;  // there is no free page below it
+    uint32_t flags;      // `DATABASE_COMPRESSED`
+} DatabaseHeader;
 
+// CacheEntry is a frame of the buffer pool. Frames are chained into the hash table through `hash_next`,
+// their order of eviction is kept by the replacement policy of the pool.
+// a frame with a positive `pin_count` is in use by a caller and is never evicted. pins are taken under the lock
+// of the shard holding the frame and may be dropped without it.
+// a `dirty` frame holds changes that haven't reached the datafile yet.
+// a `prefetched` frame was loaded by readahead and hasn't been requested since.
+// a `loading` frame is pinned while its page is read without the lock of the shard, requests for the page wait
+// until the read is over.
 typedef struct CacheEntry {
-    Page page;
+    uint8_t *data; // the `page_size` bytes of the page
     int page_number;
+    atomic_int pin_count;
+    bool dirty;
+    bool prefetched;
+    bool loading;
+    int hash_next;
 } CacheEntry;
 
-// it opens the datafile or create it if it doesn't exist and returns 0
-// if the file is already open or something happened during the process it returns -1
-int open_database();
+// CacheStats counts how the buffer pool served the page requests since the database was opened.
+// readahead hits are prefetched pages that were requested afterwards, readahead misses are
+// prefetched pages that were evicted before anyone asked for them.
+typedef struct CacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t readahead_pages;
+    uint64_t readahead_hits;
+    uint64_t readahead_misses;
+} CacheStats;
+
+// IoStats describes the I/O of a database since it was opened with `collect_io_stats`.
+// reads and writes are those of the datafile, or of the arena of an in-memory database, not of the log.
+typedef struct IoStats {
+    uint64_t page_reads;              // by `read_page` and by readahead
+    uint64_t page_writes;             // by `write_page`, evictions, flushes and checkpoints of the log
+    uint64_t bytes_read;              // as transferred: the slots of a compressed datafile are smaller than a page
+    uint64_t bytes_written;
+    uint64_t syncs;                   // fsyncs of the datafile and of the log, those of checkpoints included
+    CacheStats cache;                 // collected whether `collect_io_stats` is set or not
+    LatencyHistogram read_latency;    // one call per page read by `read_page`, one per readahead request
+    LatencyHistogram write_latency;   // one call per page written by `write_page`, one per run of a flush
+} IoStats;
+
+// MmapAdvice tells the kernel how the mapped datafile is going to be read.
+typedef enum MmapAdvice {
+    MMAP_ADVICE_NORMAL,
+    MMAP_ADVICE_SEQUENTIAL, // scans: read ahead aggressively and drop pages behind the reader.
+    MMAP_ADVICE_RANDOM,     // point lookups: don't read ahead.
+} MmapAdvice;
+
+// Pager is an open database: the datafile, its write-ahead log and the buffer pool in front of them.
+// every other function takes the pager returned by `open_database`, several databases can be open at once.
+// the functions of a pager may be called from several threads, except `close_database`, `submit_page_io` and
+// `reap_page_io`. reads that hit the buffer pool only contend with requests for pages of the same shard.
+// a page obtained through `pin_page` or `view_page` isn't protected from other threads changing it.
+typedef struct Pager Pager;
+
+// DatabaseOptions tunes the storage engine when the datafile is opened.
+// passing nullptr to `open_database` uses the defaults.
+typedef struct DatabaseOptions {
+    int cache_size;               // number of frames in the buffer pool, `DEFAULT_CACHE_SIZE` when 0.
+    int io_queue_depth;           // requests kept in flight by `submit_page_io`, `DEFAULT_IO_QUEUE_DEPTH` when 0.
+    AsyncBackend io_backend;      // backend of `submit_page_io`, picked at runtime by default.
+    bool use_mmap;                // serve reads from a shared read-only mapping of the datafile.
+    MmapAdvice mmap_advice;       // initial access pattern of the mapping.
+    int readahead_pages;          // largest readahead window, `DEFAULT_READAHEAD_PAGES` when 0, disabled when negative.
+    CachePolicyKind cache_policy; // replacement policy of the buffer pool, LRU by default.
+    bool use_wal;                 // commit through a write-ahead log next to the datafile.
+    int checkpoint_frames;        // log size that triggers a checkpoint, `DEFAULT_CHECKPOINT_FRAMES` when 0.
+    int page_size;                // page size of a new datafile, `DEFAULT_PAGE_SIZE` when 0. ignored for an existing one.
+    int cache_shards;             // independently locked parts of the buffer pool, `DEFAULT_CACHE_SHARDS` when 0.
+                                  // rounded down to a power of two, fewer when the shards would be too small.
+    bool use_direct_io;           // read and write the datafile with O_DIRECT, bypassing the page cache of the kernel.
+                                  // ignored in mmap mode, buffered I/O is kept where the filesystem doesn't support it.
+    bool use_compression;         // store the pages of a new datafile compressed. ignored for an existing one.
+    bool collect_io_stats;        // count and time the I/O of the datafile for `io_stats`, off it costs a branch.
+} DatabaseOptions;
+
+// it opens the datafile at `path` or create it if it doesn't exist and returns its pager.
+// only the header page is read, the bitmap pages are loaded when they are needed.
+// the log lives next to the datafile, at `path` followed by `WAL_SUFFIX`. a log left behind by a crash is
+// recovered, and copied into the datafile unless `use_wal` is set.
+// the page size of an existing datafile is read from its header, a new one uses `page_size`.
+// if the file is already open by another pager, isn't a database, has a layout of another version, the page size
+// is invalid or something happened during the process it returns nullptr.
+// the pages of a compressed datafile are kept uncompressed in the buffer pool and compressed when they are written
+// back, in slots after the header page. `use_mmap` and `use_direct_io` don't apply to it and `submit_page_io`
+// isn't available.
+// `MEMORY_DATABASE` as `path` opens a new, private database whose pages live in anonymous memory and disappear
+// with the pager: no file is touched, `use_wal`, `use_mmap` and `use_direct_io` are ignored and `submit_page_io`
+// isn't available.
+Pager *open_database(const char *path, const DatabaseOptions *options);
+
+// flushes the dirty pages, checkpoints and removes the log, closes the datafile and frees the pager.
+// returns -1 if `pager` is nullptr.
+int close_database(Pager *pager);
 
-// closing the datafile and freeing the variable that holds it.
-// if it's already closed if returns -1.
-int close_database();
+// reads `page_size` bytes from the datafile at offset `page_number * page_size`.
+// a page past the end of the datafile reads as zeros, a truncated page fails with -1 and `errno` set to EIO.
+int read_page(Pager *pager, int page_number, Page *page);
 
-// reads `PAGE_SIZE` of bytes from the datafile starting from the position `page_number`.
-int read_page(int page_number, Page *page);
+// writes `page_size` bytes into the datafile at offset `page_number * page_size`, bypassing the buffer pool and the log.
+// short writes are retried, -1 is returned with `errno` set if the page couldn't be written entirely.
+int write_page(Pager *pager, int page_number, const Page *page);
 
-// writes `PAGE_SIZE` of bytes into the datafile starting from position `page_number`.
-int write_page(int page_number, const Page *page);
+// returns true if the datafile is read and written with O_DIRECT. the buffers given to `submit_page_io` must then be
+// aligned on `MIN_PAGE_SIZE`, `read_page` and `write_page` copy pages that aren't through an aligned buffer.
+bool uses_direct_io(Pager *pager);
 
-// returns the index of the page if it exists.
-int cache_search(int page_number);
+// returns the index of the frame holding the page if it is cached, -1 otherwise.
+int cache_search(Pager *pager, int page_number);
 
-// write the page in the appropriate free space inside the datafile.
-// @return `page_number`
-int allocate_page(Page *page);
+// write the page in the lowest free page of the datafile, growing the datafile when there is none.
+// the datafile grows by whole extents that are reserved up front with fallocate.
+// the page goes through the buffer pool and reaches the datafile when it is flushed.
+// @return `page_number`, or -1 if no page could be allocated.
+int allocate_page(Pager *pager, Page *page);
+
+// reserves `count` physically contiguous pages and returns the first one, or -1 if they couldn't be allocated.
+// the lowest run of free pages that is long enough is preferred, otherwise the run is appended to the datafile.
+// nothing is written: pages appended to the datafile read as zeros, reused pages keep their old content.
+// a run is tracked by a single bitmap page, so `count` is below `page_size * 8`.
+int allocate_pages(Pager *pager, int count);
 
 // freeing the page in the position `page_number`.
-int free_page(int page_number);
+// returns -1 if the page isn't in use or can't be freed (the header or a bitmap page).
+int free_page(Pager *pager, int page_number);
+
+// called by `vacuum_step` once the content of the page `from` was copied to the page `to`, so that the owner
+// of the page updates the references to it. returning -1 cancels the move.
+typedef int (*PageMover)(void *context, int from, int to);
+
+// compacts the datafile by at most `max_pages` pages: free pages at the end of the datafile are dropped and the
+// last pages in use move to the lowest free pages, then the dirty pages are flushed, the datafile synced and
+// truncated. with a log it shrinks at the next checkpoint. `mover` runs with the lock of the pager held and must
+// not allocate or free pages. a pinned page isn't moved, and nothing is moved, dropped or truncated while a view
+// of the mapping from `view_page` is held. returns the number of pages moved or dropped, 0 once nothing is left
+// to do, or -1.
+int vacuum_step(Pager *pager, int max_pages, PageMover mover, void *context);
+
+// returns a copy of the header of the open database.
+DatabaseHeader database_header(Pager *pager);
+
+// reads the page through the buffer pool, loading it from the datafile and evicting
+// the frame picked by the replacement policy when the page isn't cached yet.
+// once a run of ascending pages is read, the following pages are prefetched in one read, one window ahead
+// of the reader. the window doubles while the run goes on, up to a quarter of the pool.
+int read_page_with_cache(Pager *pager, int page_number, Page *page);
+
+// stores the page in the buffer pool and marks it dirty, the datafile is updated by `flush_dirty_pages`.
+int write_page_with_cache(Pager *pager, int page_number, const Page *page);
+
+// writes every dirty frame back to the datafile in page order, merging adjacent pages into one write.
+// in WAL mode the dirty frames are appended to the log as one transaction instead, and the call returns once
+// the log is synced: callers that commit at the same time share the fsync. the log is checkpointed when it grows
+// past `checkpoint_frames`, -1 is returned if the checkpoint fails although the transaction is durable then.
+// pages evicted since the last commit are logged without one and a checkpoint keeps them: after a commit the log
+// holds about `checkpoint_frames` frames plus the pages evicted since that commit.
+// it runs at checkpoints and when the database is closed.
+int flush_dirty_pages(Pager *pager);
+
+// flushes the dirty pages and makes the datafile durable: in WAL mode the log is copied back into
+// the datafile and reset, otherwise the datafile is synced.
+int checkpoint_database(Pager *pager);
+
+// returns a pointer to the frame holding the page, loading it into the buffer pool if needed.
+// the frame stays resident until it is released with `unpin_page`.
+// returns nullptr if the page can't be read or every frame is pinned.
+Page *pin_page(Pager *pager, int page_number);
+
+// releases a frame obtained through `pin_page`. passing `dirty` marks the frame as modified.
+// returns -1 if the page isn't pinned.
+int unpin_page(Pager *pager, int page_number, bool dirty);
+
+// returns a read-only pointer to the page without copying it.
+// in mmap mode pages that aren't held by the buffer pool point straight into the mapping of the datafile,
+// otherwise the page is pinned in the buffer pool. the pointer is valid until `release_view` is called.
+const Page *view_page(Pager *pager, int page_number);
+
+// releases a pointer obtained through `view_page`.
+int release_view(Pager *pager, const Page *view);
+
+// changes the access pattern hint of the mapping for `page_count` pages starting at `first_page`,
+// or for the whole mapping when `page_count` is 0. returns -1 when the database isn't in mmap mode.
+int advise_access(Pager *pager, int first_page, int page_count, MmapAdvice advice);
+
+// queues reads or writes of whole pages that bypass the buffer pool, without waiting for them.
+// returns the number of queued requests, which is less than `count` once the queue is full or an error stopped
+// the submission after some of them, or -1 if none could be queued.
+int submit_page_io(Pager *pager, PageRequest *requests, int count);
+
+// waits for at least `min_complete` of the submitted requests and returns how many completed.
+int reap_page_io(Pager *pager, int min_complete);
+
+// returns the hit, miss, eviction and readahead counters of the buffer pool.
+CacheStats cache_stats(Pager *pager);
+
+// returns the I/O counters and latency histograms of the database, only the cache counters when the database
+// doesn't collect statistics.
+IoStats io_stats(Pager *pager);
+
+// writes the I/O statistics of the database as text, one line per counter group then the latency histograms.
+// returns -1 if the output failed.
+int dump_io_stats(Pager *pager, FILE *output);
 
-// add the read page to the cache memory
-int read_page_with_cache(int page_number, Page *page);
+// returns the counters of the codec of a compressed datafile, all zeros for a datafile that isn't compressed.
+PageCodecStats compression_stats(Pager *pager);
 
-// if the page exists in the cache memory we update it with new page and write the changes to the datafile.
-int write_page_with_cache(int page_number, const Page *page);
+// returns how many frames of the buffer pool are backed by huge pages right now, or -1 if it can't be told.
+// the frames are mapped as one region: explicit huge pages are used when the system reserved some, otherwise
+// pools of at least 2 MB ask for transparent huge pages, which the kernel hands out as memory allows.
+int huge_page_frames(Pager *pager);
 
-#endif
\ No newline at end of file
+#endif
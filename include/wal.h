@@ -0,0 +1,73 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WAL_MAGIC                   "MASQLWAL"
+#define WAL_SUFFIX                  "-wal"
+#define WAL_HEADER_SIZE             32
+#define WAL_FRAME_HEADER_SIZE       16
+#define DEFAULT_CHECKPOINT_FRAMES   1000
+
+// WalStats counts what the log did since it was opened.
+typedef struct WalStats
+{
+    uint64_t frames;         // page images appended
+    uint64_t commits;        // transactions made durable
+    uint64_t syncs;          // fsyncs of the log by committers, one of them covers every commit appended before it
+    uint64_t checkpoints;    // times the log was copied back into the datafile and reset
+    uint64_t reset_syncs;    // fsyncs of the header of the log when it is created or reset
+    uint64_t datafile_syncs; // fsyncs of the datafile by checkpoints
+} WalStats;
+
+// Wal is a write-ahead log of page images kept next to the datafile.
+// the log starts with a header followed by frames, each made of a frame header and a page image.
+// a frame whose header carries the commit flag ends a transaction, frames after the last commit
+// are ignored when the log is recovered. every function may be called from several threads.
+typedef struct Wal Wal;
+
+// opens the log at `path` or creates it, recovering the committed frames of a previous run.
+// returns nullptr if the log can't be opened.
+Wal *wal_open(const char *path, int page_size);
+
+// closes the log without checkpointing it.
+void wal_close(Wal *wal);
+
+// appends the images of `count` pages at the end of the log and returns the sequence number of the last one,
+// or -1 on error. when `commit` is set, the last frame ends a transaction that `wal_sync` makes durable.
+// the frames are visible to `wal_read_page` right away.
+int64_t wal_append(Wal *wal, const int *page_numbers, const uint8_t *const *pages, int count, bool commit);
+
+// waits until the frame `sequence` and every frame before it are on stable storage.
+// committers that wait together share one fsync: the first one syncs for everyone appended so far.
+int wal_sync(Wal *wal, int64_t sequence);
+
+// copies the newest image of `page_number` into `page`. returns 1 if the log holds the page, 0 if it doesn't
+// and -1 on error.
+int wal_read_page(Wal *wal, int page_number, uint8_t *page);
+
+// returns true if the log holds an image of `page_number`.
+bool wal_contains(Wal *wal, int page_number);
+
+// returns the number of frames in the log.
+int wal_frame_count(Wal *wal);
+
+// writes the newest committed image of every page back into the datafile `db_fd` in page order, syncs the
+// datafile and resets the log. frames appended without a commit after them move to the start of the new log,
+// which holds nothing else.
+// the pages are copied through an aligned buffer, `db_fd` may be opened with O_DIRECT.
+int wal_checkpoint(Wal *wal, int db_fd);
+
+// WalPageWriter stores the image of `page_number` in a datafile that doesn't keep page n at offset n * page_size.
+// returns 0, or -1 on error.
+typedef int (*WalPageWriter)(void *context, int page_number, const uint8_t *page);
+
+// checkpoints like `wal_checkpoint`, handing every page to `writer` instead of writing it at its offset in `db_fd`.
+// `db_fd` is still synced before the log is reset, `writer` is expected to write into it.
+int wal_checkpoint_with(Wal *wal, int db_fd, WalPageWriter writer, void *context);
+
+// returns the counters of the log.
+WalStats wal_stats(Wal *wal);
+
+#endif // WAL_H
@@ -0,0 +1,373 @@
+#include "async_io.h"
+#include "file_io.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+struct AsyncIO
+{
+    AsyncBackend backend;
+    int fd;
+    int page_size;
+    int queue_depth;
+    int in_flight;
+#ifdef HAVE_IO_URING
+    int ring_fd;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+#endif
+};
+
+// finishes a request whose first `done` bytes were already transferred, with the same
+// semantics as `read_page`/`write_page`: a page past the end of the file reads as zeros.
+static int finish_request(const AsyncIO *aio, PageRequest *request, size_t done)
+{
+    size_t page_size = (size_t)aio->page_size;
+    uint8_t *buffer = request->buffer;
+    off_t offset = (off_t)request->page_number * aio->page_size + (off_t)done;
+    if (request->write)
+    {
+        return pwrite_full(aio->fd, buffer + done, page_size - done, offset);
+    }
+
+    ssize_t n = pread_full(aio->fd, buffer + done, page_size - done, offset);
+    if (n < 0)
+    {
+        return -1;
+    }
+    done += (size_t)n;
+    if (done == 0)
+    {
+        memset(buffer, 0, page_size);
+    }
+    else if (done < page_size)
+    {
+        errno = EIO; // truncated page
+        return -1;
+    }
+    return 0;
+}
+
+#ifdef HAVE_IO_URING
+static int io_uring_setup_raw(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter_raw(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static void ring_unmap(AsyncIO *aio)
+{
+    if (aio->sqes != nullptr)
+    {
+        munmap(aio->sqes, aio->sqes_size);
+    }
+    if (aio->cq_ring != nullptr && aio->cq_ring != aio->sq_ring)
+    {
+        munmap(aio->cq_ring, aio->cq_ring_size);
+    }
+    if (aio->sq_ring != nullptr)
+    {
+        munmap(aio->sq_ring, aio->sq_ring_size);
+    }
+    close(aio->ring_fd);
+}
+
+static int ring_open(AsyncIO *aio)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    aio->ring_fd = io_uring_setup_raw((unsigned)aio->queue_depth, &params);
+    if (aio->ring_fd < 0)
+    {
+        return -1;
+    }
+
+    aio->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    aio->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (aio->cq_ring_size > aio->sq_ring_size)
+        {
+            aio->sq_ring_size = aio->cq_ring_size;
+        }
+        aio->cq_ring_size = aio->sq_ring_size;
+    }
+
+    aio->sq_ring = mmap(nullptr, aio->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        aio->ring_fd, IORING_OFF_SQ_RING);
+    if (aio->sq_ring == MAP_FAILED)
+    {
+        aio->sq_ring = nullptr;
+        ring_unmap(aio);
+        return -1;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        aio->cq_ring = aio->sq_ring;
+    }
+    else
+    {
+        aio->cq_ring = mmap(nullptr, aio->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            aio->ring_fd, IORING_OFF_CQ_RING);
+        if (aio->cq_ring == MAP_FAILED)
+        {
+            aio->cq_ring = nullptr;
+            ring_unmap(aio);
+            return -1;
+        }
+    }
+
+    aio->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    aio->sqes = mmap(nullptr, aio->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     aio->ring_fd, IORING_OFF_SQES);
+    if (aio->sqes == MAP_FAILED)
+    {
+        aio->sqes = nullptr;
+        ring_unmap(aio);
+        return -1;
+    }
+
+    uint8_t *sq = aio->sq_ring;
+    uint8_t *cq = aio->cq_ring;
+    aio->sq_head = (unsigned *)(sq + params.sq_off.head);
+    aio->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    aio->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    aio->sq_array = (unsigned *)(sq + params.sq_off.array);
+    aio->cq_head = (unsigned *)(cq + params.cq_off.head);
+    aio->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    aio->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    aio->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+// publishes the requests on the submission queue and hands them to the kernel. returns the number of requests the
+// kernel took, the others are withdrawn from the queue and never complete. returns -1 if it took none.
+static int ring_submit(AsyncIO *aio, PageRequest *requests, int count)
+{
+    unsigned first = *aio->sq_tail;
+    unsigned tail = first;
+    for (int i = 0; i < count; i++)
+    {
+        unsigned index = tail & *aio->sq_mask;
+        struct io_uring_sqe *sqe = &aio->sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = requests[i].write ? IORING_OP_WRITE : IORING_OP_READ;
+        sqe->fd = aio->fd;
+        sqe->off = (uint64_t)requests[i].page_number * (uint64_t)aio->page_size;
+        sqe->addr = (uint64_t)(uintptr_t)requests[i].buffer;
+        sqe->len = (unsigned)aio->page_size;
+        sqe->user_data = (uint64_t)(uintptr_t)&requests[i];
+        aio->sq_array[index] = index;
+        tail++;
+    }
+    __atomic_store_n(aio->sq_tail, tail, __ATOMIC_RELEASE);
+
+    int submitted = 0;
+    while (submitted < count)
+    {
+        int n = io_uring_enter_raw(aio->ring_fd, (unsigned)(count - submitted), 0, 0);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN))
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        submitted += n;
+    }
+    if (submitted < count)
+    {
+        // the kernel only takes entries during io_uring_enter, the head tells which ones it took: the entries
+        // after it are taken back so that a later call doesn't submit them.
+        int error = errno;
+        unsigned head = __atomic_load_n(aio->sq_head, __ATOMIC_ACQUIRE);
+        submitted = (int)(head - first);
+        __atomic_store_n(aio->sq_tail, head, __ATOMIC_RELEASE);
+        if (submitted == 0)
+        {
+            errno = error;
+            return -1;
+        }
+    }
+    return submitted;
+}
+
+static int ring_reap(AsyncIO *aio, int min_complete)
+{
+    int reaped = 0;
+    while (true)
+    {
+        unsigned head = *aio->cq_head;
+        unsigned tail = __atomic_load_n(aio->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail)
+        {
+            struct io_uring_cqe *cqe = &aio->cqes[head & *aio->cq_mask];
+            PageRequest *request = (PageRequest *)(uintptr_t)cqe->user_data;
+            if (cqe->res < 0)
+            {
+                errno = -cqe->res;
+                request->result = -1;
+            }
+            else if (cqe->res < aio->page_size)
+            {
+                request->result = finish_request(aio, request, (size_t)cqe->res);
+            }
+            else
+            {
+                request->result = 0;
+            }
+            head++;
+            reaped++;
+        }
+        __atomic_store_n(aio->cq_head, head, __ATOMIC_RELEASE);
+
+        if (reaped >= min_complete)
+        {
+            return reaped;
+        }
+        if (io_uring_enter_raw(aio->ring_fd, 0, (unsigned)(min_complete - reaped), IORING_ENTER_GETEVENTS) < 0 &&
+            errno != EINTR)
+        {
+            return reaped > 0 ? reaped : -1;
+        }
+    }
+}
+#endif
+
+AsyncIO *async_io_open(int fd, int page_size, int queue_depth, AsyncBackend backend)
+{
+    AsyncIO *aio = calloc(1, sizeof(AsyncIO));
+    if (aio == nullptr)
+    {
+        return nullptr;
+    }
+    aio->fd = fd;
+    aio->page_size = page_size;
+    aio->queue_depth = queue_depth > 0 ? queue_depth : DEFAULT_IO_QUEUE_DEPTH;
+    aio->backend = ASYNC_BACKEND_SYNC;
+
+    if (backend != ASYNC_BACKEND_SYNC)
+    {
+#ifdef HAVE_IO_URING
+        if (ring_open(aio) == 0)
+        {
+            aio->backend = ASYNC_BACKEND_IO_URING;
+        }
+#endif
+        if (aio->backend != ASYNC_BACKEND_IO_URING && backend == ASYNC_BACKEND_IO_URING)
+        {
+            free(aio);
+            return nullptr;
+        }
+    }
+    return aio;
+}
+
+void async_io_close(AsyncIO *aio)
+{
+    if (aio == nullptr)
+    {
+        return;
+    }
+    async_io_reap(aio, aio->in_flight);
+#ifdef HAVE_IO_URING
+    if (aio->backend == ASYNC_BACKEND_IO_URING)
+    {
+        ring_unmap(aio);
+    }
+#endif
+    free(aio);
+}
+
+AsyncBackend async_io_backend(const AsyncIO *aio)
+{
+    return aio->backend;
+}
+
+int async_io_submit(AsyncIO *aio, PageRequest *requests, int count)
+{
+    int room = aio->queue_depth - aio->in_flight;
+    if (count > room)
+    {
+        count = room;
+    }
+    if (count <= 0)
+    {
+        return 0;
+    }
+
+#ifdef HAVE_IO_URING
+    if (aio->backend == ASYNC_BACKEND_IO_URING)
+    {
+        int submitted = ring_submit(aio, requests, count);
+        if (submitted > 0)
+        {
+            aio->in_flight += submitted;
+        }
+        return submitted;
+    }
+#endif
+
+    // the synchronous backend completes the requests right away, reaping only hands them back.
+    for (int i = 0; i < count; i++)
+    {
+        requests[i].result = finish_request(aio, &requests[i], 0);
+    }
+    aio->in_flight += count;
+    return count;
+}
+
+int async_io_reap(AsyncIO *aio, int min_complete)
+{
+    if (min_complete > aio->in_flight)
+    {
+        min_complete = aio->in_flight;
+    }
+
+    int reaped = aio->in_flight;
+#ifdef HAVE_IO_URING
+    if (aio->backend == ASYNC_BACKEND_IO_URING)
+    {
+        reaped = ring_reap(aio, min_complete);
+        if (reaped < 0)
+        {
+            return -1;
+        }
+    }
+#endif
+    aio->in_flight -= reaped;
+    return reaped;
+}
+
+int async_io_in_flight(const AsyncIO *aio)
+{
+    return aio->in_flight;
+}
@@ -0,0 +1,588 @@
+#include "bplus_tree.h"
+#include "key_search.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NODE_LEAF           1
+#define NODE_INTERNAL       2
+#define NODE_HEADER_SIZE    16
+#define LEAF_SLOT_SIZE      10 // the key of an entry and the offset of its cell
+#define CELL_HEADER_SIZE    2  // the length of the value
+
+// NodeHeader starts every page of a tree, the keys follow it in ascending order.
+// a leaf has one cell offset per key after its keys, the cells fill the page from its end: the length of the
+// value then its bytes. an internal node holds `internal_capacity` key slots followed by the child pages:
+// the keys of child `i` are below key `i` and not below key `i - 1`.
+typedef struct NodeHeader
+{
+    uint16_t kind;
+    uint16_t count;      // keys in the node
+    uint32_t cells;      // leaf: offset of the lowest cell
+    uint32_t next;       // leaf: page of the next leaf in key order, 0 after the last one
+    uint32_t fragmented; // leaf: bytes of cells left behind by removed entries, reclaimed when the leaf is compacted
+} NodeHeader;
+
+_Static_assert(sizeof(NodeHeader) == NODE_HEADER_SIZE, "the node header has a fixed size");
+
+struct BPlusTree
+{
+    Pager *pager;
+    int root;
+    int page_size;
+    int internal_capacity;
+    uint8_t *scratch; // a page to rebuild a node in
+};
+
+static NodeHeader *node_header(uint8_t *node)
+{
+    return (NodeHeader *)node;
+}
+
+static int64_t *node_keys(uint8_t *node)
+{
+    return (int64_t *)(node + NODE_HEADER_SIZE);
+}
+
+static uint16_t *leaf_offsets(uint8_t *node)
+{
+    return (uint16_t *)(node + NODE_HEADER_SIZE + sizeof(int64_t) * node_header(node)->count);
+}
+
+static uint32_t *node_children(const BPlusTree *tree, uint8_t *node)
+{
+    return (uint32_t *)(node + NODE_HEADER_SIZE + sizeof(int64_t) * tree->internal_capacity);
+}
+
+// pins the node on `page_number`, returns nullptr if it can't be read.
+static uint8_t *pin_node(BPlusTree *tree, int page_number)
+{
+    Page *page = pin_page(tree->pager, page_number);
+    return page == nullptr ? nullptr : page->data;
+}
+
+static void unpin_node(BPlusTree *tree, int page_number, bool dirty)
+{
+    unpin_page(tree->pager, page_number, dirty);
+}
+
+static void reset_leaf(const BPlusTree *tree, uint8_t *node, uint32_t next)
+{
+    *node_header(node) = (NodeHeader){NODE_LEAF, 0, (uint32_t)tree->page_size, next, 0};
+}
+
+// allocates a page for a new node and returns it pinned, its number in `page_number`.
+static uint8_t *new_node(BPlusTree *tree, int *page_number)
+{
+    *page_number = allocate_pages(tree->pager, 1);
+    if (*page_number == -1)
+    {
+        return nullptr;
+    }
+    uint8_t *node = pin_node(tree, *page_number);
+    if (node == nullptr)
+    {
+        free_page(tree->pager, *page_number);
+        return nullptr;
+    }
+    memset(node, 0, tree->page_size);
+    return node;
+}
+
+static int entry_size(int length)
+{
+    return LEAF_SLOT_SIZE + CELL_HEADER_SIZE + length;
+}
+
+// returns the bytes between the cell offsets and the cells.
+static int leaf_free(const uint8_t *node)
+{
+    const NodeHeader *header = (const NodeHeader *)node;
+    return (int)header->cells - NODE_HEADER_SIZE - LEAF_SLOT_SIZE * header->count;
+}
+
+static const uint8_t *leaf_value(uint8_t *node, int index, int *length)
+{
+    const uint8_t *cell = node + leaf_offsets(node)[index];
+    uint16_t cell_length;
+    memcpy(&cell_length, cell, sizeof(cell_length));
+    *length = cell_length;
+    return cell + CELL_HEADER_SIZE;
+}
+
+// returns the position of the first key of the leaf that isn't below `key`, `found` tells whether it is `key`.
+static int leaf_position(uint8_t *node, int64_t key, bool *found)
+{
+    const int64_t *keys = node_keys(node);
+    int count = node_header(node)->count;
+    int index = int64_rank(keys, count, key, false);
+    *found = index < count && keys[index] == key;
+    return index;
+}
+
+// returns the child of an internal node whose keys include `key`.
+static int child_position(uint8_t *node, int64_t key)
+{
+    return int64_rank(node_keys(node), node_header(node)->count, key, true);
+}
+
+// inserts an entry at `index`, the leaf has room for it between its offsets and its cells.
+static void leaf_insert_at(uint8_t *node, int index, int64_t key, const void *value, int length)
+{
+    NodeHeader *header = node_header(node);
+    int count = header->count;
+    uint8_t *offsets = (uint8_t *)leaf_offsets(node);
+    // the offsets move past the new key, those from `index` on one more slot to make room for the new offset.
+    memmove(offsets + sizeof(int64_t) + sizeof(uint16_t) * (index + 1), offsets + sizeof(uint16_t) * index,
+            sizeof(uint16_t) * (count - index));
+    memmove(offsets + sizeof(int64_t), offsets, sizeof(uint16_t) * index);
+    int64_t *keys = node_keys(node);
+    memmove(keys + index + 1, keys + index, sizeof(int64_t) * (count - index));
+    keys[index] = key;
+
+    header->cells -= CELL_HEADER_SIZE + length;
+    uint16_t cell_length = (uint16_t)length;
+    memcpy(node + header->cells, &cell_length, sizeof(cell_length));
+    memcpy(node + header->cells + CELL_HEADER_SIZE, value, length);
+    header->count++;
+    leaf_offsets(node)[index] = (uint16_t)header->cells;
+}
+
+static void leaf_remove_at(uint8_t *node, int index)
+{
+    NodeHeader *header = node_header(node);
+    int count = header->count;
+    int length;
+    leaf_value(node, index, &length);
+    header->fragmented += CELL_HEADER_SIZE + length;
+
+    int64_t *keys = node_keys(node);
+    uint8_t *offsets = (uint8_t *)leaf_offsets(node);
+    memmove(keys + index, keys + index + 1, sizeof(int64_t) * (count - index - 1));
+    memmove(offsets - sizeof(int64_t), offsets, sizeof(uint16_t) * index);
+    memmove(offsets - sizeof(int64_t) + sizeof(uint16_t) * index, offsets + sizeof(uint16_t) * (index + 1),
+            sizeof(uint16_t) * (count - index - 1));
+    header->count--;
+}
+
+// rewrites the leaf with its cells packed against the end of the page.
+static void compact_leaf(BPlusTree *tree, uint8_t *node)
+{
+    memcpy(tree->scratch, node, tree->page_size);
+    reset_leaf(tree, node, node_header(tree->scratch)->next);
+    int count = node_header(tree->scratch)->count;
+    for (int i = 0; i < count; i++)
+    {
+        int length;
+        const uint8_t *value = leaf_value(tree->scratch, i, &length);
+        leaf_insert_at(node, i, node_keys(tree->scratch)[i], value, length);
+    }
+}
+
+// splits a full leaf in two halves of about the same size while inserting the entry at `index`.
+// the upper half moves to the new node `right_node` on page `right`, its first key is returned in `separator`.
+static void split_leaf(BPlusTree *tree, uint8_t *node, int index, int64_t key, const void *value, int length,
+                       int right, uint8_t *right_node, int64_t *separator)
+{
+    memcpy(tree->scratch, node, tree->page_size);
+    uint8_t *old = tree->scratch;
+    int count = node_header(old)->count;
+    int total = entry_size(length);
+    for (int i = 0; i < count; i++)
+    {
+        int old_length;
+        leaf_value(old, i, &old_length);
+        total += entry_size(old_length);
+    }
+
+    reset_leaf(tree, right_node, node_header(old)->next);
+    reset_leaf(tree, node, (uint32_t)right);
+    uint8_t *target = node;
+    int used = 0;
+    for (int i = 0; i <= count; i++)
+    {
+        int64_t entry_key = key;
+        const void *entry_value = value;
+        int entry_length = length;
+        if (i != index)
+        {
+            int from = i < index ? i : i - 1;
+            entry_key = node_keys(old)[from];
+            entry_value = leaf_value(old, from, &entry_length);
+        }
+        // the left half takes entries until it holds half of the bytes, and at least one entry.
+        if (target == node && used > 0 && used + entry_size(entry_length) / 2 > total / 2)
+        {
+            target = right_node;
+        }
+        leaf_insert_at(target, node_header(target)->count, entry_key, entry_value, entry_length);
+        used += entry_size(entry_length);
+    }
+    *separator = node_keys(right_node)[0];
+}
+
+static void internal_insert_at(BPlusTree *tree, uint8_t *node, int index, int64_t key, uint32_t child)
+{
+    NodeHeader *header = node_header(node);
+    int64_t *keys = node_keys(node);
+    uint32_t *children = node_children(tree, node);
+    memmove(keys + index + 1, keys + index, sizeof(int64_t) * (header->count - index));
+    memmove(children + index + 2, children + index + 1, sizeof(uint32_t) * (header->count - index));
+    keys[index] = key;
+    children[index + 1] = child;
+    header->count++;
+}
+
+// splits a full internal node while inserting `key` and the child after it at `index`.
+// the middle key moves up into `separator`, the keys after it to the new node `right_node`.
+static void split_internal(BPlusTree *tree, uint8_t *node, int index, int64_t key, uint32_t child,
+                           uint8_t *right_node, int64_t *separator)
+{
+    // the node with the new key doesn't fit in a page, it is assembled in the scratch page.
+    int count = node_header(node)->count + 1;
+    int64_t *keys = (int64_t *)tree->scratch;
+    uint32_t *children = (uint32_t *)(tree->scratch + sizeof(int64_t) * count);
+    memcpy(keys, node_keys(node), sizeof(int64_t) * index);
+    memcpy(keys + index + 1, node_keys(node) + index, sizeof(int64_t) * (count - 1 - index));
+    keys[index] = key;
+    memcpy(children, node_children(tree, node), sizeof(uint32_t) * (index + 1));
+    memcpy(children + index + 2, node_children(tree, node) + index + 1, sizeof(uint32_t) * (count - 1 - index));
+    children[index + 1] = child;
+
+    int middle = count / 2;
+    *separator = keys[middle];
+    node_header(node)->count = (uint16_t)middle;
+    memcpy(node_keys(node), keys, sizeof(int64_t) * middle);
+    memcpy(node_children(tree, node), children, sizeof(uint32_t) * (middle + 1));
+    *node_header(right_node) = (NodeHeader){NODE_INTERNAL, (uint16_t)(count - middle - 1), 0, 0, 0};
+    memcpy(node_keys(right_node), keys + middle + 1, sizeof(int64_t) * (count - middle - 1));
+    memcpy(node_children(tree, right_node), children + middle + 1, sizeof(uint32_t) * (count - middle));
+}
+
+// the root was split into itself and `right`: its content moves to the new node `left_node` on page `left`, so
+// that the root stays where it is and becomes the parent of both halves.
+static void grow_root(BPlusTree *tree, uint8_t *root, int64_t separator, int right, int left, uint8_t *left_node)
+{
+    memcpy(left_node, root, tree->page_size);
+
+    memset(root, 0, tree->page_size);
+    *node_header(root) = (NodeHeader){NODE_INTERNAL, 1, 0, 0, 0};
+    node_keys(root)[0] = separator;
+    node_children(tree, root)[0] = (uint32_t)left;
+    node_children(tree, root)[1] = (uint32_t)right;
+}
+
+int bplus_create(Pager *pager)
+{
+    if (pager == nullptr)
+    {
+        return -1;
+    }
+    BPlusTree tree = {.pager = pager, .page_size = (int)database_header(pager).page_size};
+    int root;
+    uint8_t *node = new_node(&tree, &root);
+    if (node == nullptr)
+    {
+        return -1;
+    }
+    reset_leaf(&tree, node, 0);
+    unpin_node(&tree, root, true);
+    return root;
+}
+
+BPlusTree *bplus_open(Pager *pager, int root_page)
+{
+    if (pager == nullptr || root_page <= HEADER_PAGE)
+    {
+        return nullptr;
+    }
+    BPlusTree *tree = malloc(sizeof(BPlusTree));
+    if (tree == nullptr)
+    {
+        return nullptr;
+    }
+    tree->pager = pager;
+    tree->root = root_page;
+    tree->page_size = (int)database_header(pager).page_size;
+    tree->internal_capacity = (tree->page_size - NODE_HEADER_SIZE - (int)sizeof(uint32_t)) /
+                              (int)(sizeof(int64_t) + sizeof(uint32_t));
+    tree->scratch = malloc(tree->page_size);
+    uint8_t *root = tree->scratch != nullptr ? pin_node(tree, root_page) : nullptr;
+    int kind = root != nullptr ? node_header(root)->kind : 0;
+    if (root != nullptr)
+    {
+        unpin_node(tree, root_page, false);
+    }
+    if (kind != NODE_LEAF && kind != NODE_INTERNAL)
+    {
+        errno = EINVAL;
+        bplus_close(tree);
+        return nullptr;
+    }
+    return tree;
+}
+
+void bplus_close(BPlusTree *tree)
+{
+    if (tree == nullptr)
+    {
+        return;
+    }
+    free(tree->scratch);
+    free(tree);
+}
+
+int bplus_max_value(const BPlusTree *tree)
+{
+    return (tree->page_size - NODE_HEADER_SIZE) / 4 - LEAF_SLOT_SIZE - CELL_HEADER_SIZE;
+}
+
+// pins the leaf that holds `key`. the internal nodes on the way down are stored in `path` with the position
+// of the child that was followed, `depth` receives their number. returns nullptr if a node can't be read.
+static uint8_t *find_leaf(BPlusTree *tree, int64_t key, int *path, int *positions, int *depth, int *leaf)
+{
+    *depth = 0;
+    int page_number = tree->root;
+    uint8_t *node = pin_node(tree, page_number);
+    while (node != nullptr && node_header(node)->kind == NODE_INTERNAL)
+    {
+        if (*depth == BPLUS_MAX_HEIGHT - 1)
+        {
+            unpin_node(tree, page_number, false);
+            errno = EIO; // a cycle between the nodes, the tree is corrupt
+            return nullptr;
+        }
+        int position = child_position(node, key);
+        path[*depth] = page_number;
+        positions[*depth] = position;
+        (*depth)++;
+        int child = (int)node_children(tree, node)[position];
+        unpin_node(tree, page_number, false);
+        page_number = child;
+        node = pin_node(tree, page_number);
+    }
+    *leaf = page_number;
+    return node;
+}
+
+static void unpin_nodes(BPlusTree *tree, const int *pages, int count, bool dirty)
+{
+    for (int i = 0; i < count; i++)
+    {
+        unpin_node(tree, pages[i], dirty);
+    }
+}
+
+// pins the parents that a split of the leaf at the end of `path` reaches, from the lowest one up: those that are
+// full and split as well, then the first one with room for a key. returns how many were pinned into `pages` and
+// `nodes`, or -1 if one can't be read, none is left pinned then.
+static int pin_parents(BPlusTree *tree, const int *path, int depth, int *pages, uint8_t **nodes)
+{
+    int pinned = 0;
+    while (pinned < depth)
+    {
+        pages[pinned] = path[depth - 1 - pinned];
+        nodes[pinned] = pin_node(tree, pages[pinned]);
+        if (nodes[pinned] == nullptr)
+        {
+            unpin_nodes(tree, pages, pinned, false);
+            return -1;
+        }
+        pinned++;
+        if (node_header(nodes[pinned - 1])->count < tree->internal_capacity)
+        {
+            break;
+        }
+    }
+    return pinned;
+}
+
+int bplus_put(BPlusTree *tree, int64_t key, const void *value, int length)
+{
+    if (tree == nullptr || length < 0 || length > bplus_max_value(tree))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int path[BPLUS_MAX_HEIGHT];
+    int positions[BPLUS_MAX_HEIGHT];
+    int depth;
+    int page_number;
+    uint8_t *node = find_leaf(tree, key, path, positions, &depth, &page_number);
+    if (node == nullptr)
+    {
+        return -1;
+    }
+
+    bool found;
+    int index = leaf_position(node, key, &found);
+    int needed = entry_size(length);
+    int reclaimable = leaf_free(node) + (int)node_header(node)->fragmented;
+    if (found)
+    {
+        int old_length;
+        leaf_value(node, index, &old_length);
+        reclaimable += entry_size(old_length);
+    }
+    if (reclaimable >= needed)
+    {
+        if (found)
+        {
+            leaf_remove_at(node, index);
+        }
+        if (leaf_free(node) < needed)
+        {
+            compact_leaf(tree, node);
+        }
+        leaf_insert_at(node, index, key, value, length);
+        unpin_node(tree, page_number, true);
+        return 0;
+    }
+
+    // the leaf is full: it splits, then each parent that is full as well. the parents are pinned and the new
+    // nodes allocated before the leaf changes, a failure leaves the tree as it was.
+    int parents[BPLUS_MAX_HEIGHT];
+    uint8_t *parent_nodes[BPLUS_MAX_HEIGHT];
+    int levels = pin_parents(tree, path, depth, parents, parent_nodes);
+    if (levels == -1)
+    {
+        unpin_node(tree, page_number, false);
+        return -1;
+    }
+    // the root grows when every node up to it splits.
+    bool grows = levels == depth &&
+                 (depth == 0 || node_header(parent_nodes[depth - 1])->count == tree->internal_capacity);
+    int splits = grows ? levels : levels - 1;
+    int count = 1 + splits + (grows ? 1 : 0);
+    int pages[BPLUS_MAX_HEIGHT + 1];
+    uint8_t *nodes[BPLUS_MAX_HEIGHT + 1];
+    int reserved = 0;
+    while (reserved < count && (nodes[reserved] = new_node(tree, &pages[reserved])) != nullptr)
+    {
+        reserved++;
+    }
+    if (reserved < count)
+    {
+        for (int i = 0; i < reserved; i++)
+        {
+            unpin_node(tree, pages[i], false);
+            free_page(tree->pager, pages[i]);
+        }
+        unpin_nodes(tree, parents, levels, false);
+        unpin_node(tree, page_number, false);
+        return -1;
+    }
+
+    if (found)
+    {
+        leaf_remove_at(node, index);
+    }
+    int64_t separator;
+    split_leaf(tree, node, index, key, value, length, pages[0], nodes[0], &separator);
+    int right = pages[0];
+    for (int level = 0; level < splits; level++)
+    {
+        split_internal(tree, parent_nodes[level], positions[depth - 1 - level], separator, (uint32_t)right,
+                       nodes[level + 1], &separator);
+        right = pages[level + 1];
+    }
+    if (grows)
+    {
+        uint8_t *root = depth == 0 ? node : parent_nodes[depth - 1];
+        grow_root(tree, root, separator, right, pages[count - 1], nodes[count - 1]);
+    }
+    else
+    {
+        internal_insert_at(tree, parent_nodes[levels - 1], positions[depth - levels], separator, (uint32_t)right);
+    }
+    unpin_nodes(tree, pages, count, true);
+    unpin_nodes(tree, parents, levels, true);
+    unpin_node(tree, page_number, true);
+    return 0;
+}
+
+int bplus_get(BPlusTree *tree, int64_t key, void *value, int capacity)
+{
+    if (tree == nullptr || capacity < 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int path[BPLUS_MAX_HEIGHT];
+    int positions[BPLUS_MAX_HEIGHT];
+    int depth;
+    int page_number;
+    uint8_t *node = find_leaf(tree, key, path, positions, &depth, &page_number);
+    if (node == nullptr)
+    {
+        return -1;
+    }
+    bool found;
+    int index = leaf_position(node, key, &found);
+    int length = -1;
+    if (found)
+    {
+        const uint8_t *stored = leaf_value(node, index, &length);
+        memcpy(value, stored, length < capacity ? length : capacity);
+    }
+    unpin_node(tree, page_number, false);
+    if (!found)
+    {
+        errno = ENOENT;
+    }
+    return length;
+}
+
+int bplus_delete(BPlusTree *tree, int64_t key)
+{
+    if (tree == nullptr)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int path[BPLUS_MAX_HEIGHT];
+    int positions[BPLUS_MAX_HEIGHT];
+    int depth;
+    int page_number;
+    uint8_t *node = find_leaf(tree, key, path, positions, &depth, &page_number);
+    if (node == nullptr)
+    {
+        return -1;
+    }
+    bool found;
+    int index = leaf_position(node, key, &found);
+    if (found)
+    {
+        leaf_remove_at(node, index);
+    }
+    unpin_node(tree, page_number, found);
+    if (!found)
+    {
+        errno = ENOENT;
+        return -1;
+    }
+    return 0;
+}
+
+int bplus_height(BPlusTree *tree)
+{
+    if (tree == nullptr)
+    {
+        return -1;
+    }
+
+    int path[BPLUS_MAX_HEIGHT];
+    int positions[BPLUS_MAX_HEIGHT];
+    int depth;
+    int page_number;
+    uint8_t *node = find_leaf(tree, INT64_MIN, path, positions, &depth, &page_number);
+    if (node == nullptr)
+    {
+        return -1;
+    }
+    unpin_node(tree, page_number, false);
+    return depth + 1;
+}
@@ -42,11 +42,15 @@ bool key_equal_to(PairType type, Key key, Key to)
     return key.integer == to.integer;
 }
 
+_Static_assert(sizeof(BTreeNode) <= BTREE_NODE_SIZE, "a node fits in a page");
+
 BTreeNode *new_node(int num_pairs, bool is_leaf)
 {
     BTreeNode *node = malloc(sizeof(BTreeNode));
     node->num_pairs = num_pairs;
     node->is_leaf = is_leaf;
+    node->next = nullptr;
+    node->prev = nullptr;
 
     for (int i = 0; i < BTREE_ORDER; i++)
     {
@@ -77,78 +81,119 @@ void free_node(BTreeNode *node)
     free(node);
 }
 
-void btree_split_child(BTreeNode *parent, int index)
+// returns the position of the first key of the node that isn't below `key`, or above it when `inclusive` is set.
+// the type of the keys is checked once, integer keys are compared inline rather than through `key_less_than`.
+static int key_rank(const BTreeNode *node, PairType type, Key key, bool inclusive)
 {
-    BTreeNode *child = parent->children[index];
-    int mid = (MAX_PAIRS + 1) / 2;
-
-    BTreeNode *new_child = new_node(mid, child->is_leaf);
-
-    // Move half of keys from child to new_child
-    for (int j = 0; j < new_child->num_pairs; j++)
+    int low = 0;
+    int high = node->num_pairs;
+    if (type == INT)
     {
-        new_child->pairs[j] = child->pairs[j + mid - 1];
+        while (low < high)
+        {
+            int middle = (low + high) / 2;
+            int stored = node->keys[middle].integer;
+            if (stored < key.integer || (inclusive && stored == key.integer))
+            {
+                low = middle + 1;
+            }
+            else
+            {
+                high = middle;
+            }
+        }
+        return low;
     }
 
-    // Move children if not a leaf
-    if (!child->is_leaf)
+    while (low < high)
     {
-        for (int j = 0; j <= new_child->num_pairs; j++)
+        int middle = (low + high) / 2;
+        bool below = inclusive ? !key_less_than(type, key, node->keys[middle])
+                               : key_less_than(type, node->keys[middle], key);
+        if (below)
         {
-            new_child->children[j] = child->children[j + mid - 1];
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
         }
     }
-    else
-    {
-        child->next = new_child;
-    }
+    return low;
+}
+
+// returns the position of the first key of the node that isn't below `key`.
+static int lower_bound(const BTreeNode *node, PairType type, Key key)
+{
+    return key_rank(node, type, key, false);
+}
 
-    // Reduce number of keys in the original child
-    child->num_pairs -= mid;
+// returns the position of the first key of the node above `key`, which is also the child holding `key`.
+static int upper_bound(const BTreeNode *node, PairType type, Key key)
+{
+    return key_rank(node, type, key, true);
+}
 
-    // Shift parent's children to make room for new_child
-    for (int j = parent->num_pairs; j >= index + 1; j--)
+void btree_split_child(BTreeNode *parent, int index)
+{
+    BTreeNode *child = parent->children[index];
+    int mid = child->num_pairs / 2;
+    Key separator = child->keys[mid];
+
+    BTreeNode *new_child = new_node(0, child->is_leaf);
+    if (child->is_leaf)
     {
-        parent->children[j + 1] = parent->children[j];
+        // the separator stays in the leaf, a leaf holds every pair
+        new_child->num_pairs = child->num_pairs - mid;
+        memcpy(new_child->keys, child->keys + mid, sizeof(Key) * new_child->num_pairs);
+        memcpy(new_child->values, child->values + mid, sizeof(Value) * new_child->num_pairs);
+        memcpy(new_child->value_types, child->value_types + mid, sizeof(PairType) * new_child->num_pairs);
+        new_child->next = child->next;
+        new_child->prev = child;
+        if (child->next != nullptr)
+        {
+            child->next->prev = new_child;
+        }
+        child->next = new_child;
     }
-    parent->children[index + 1] = new_child;
-
-    // Move parent's keys
-    for (int j = parent->num_pairs - 1; j >= index; j--)
+    else
     {
-        parent->pairs[j + 1] = parent->pairs[j];
+        new_child->num_pairs = child->num_pairs - mid - 1;
+        memcpy(new_child->keys, child->keys + mid + 1, sizeof(Key) * new_child->num_pairs);
+        memcpy(new_child->children, child->children + mid + 1, sizeof(BTreeNode *) * (new_child->num_pairs + 1));
     }
-    parent->pairs[index].key_type = child->pairs[mid - 1].key_type; // Move the median key up to the parent
-    parent->pairs[index].key = child->pairs[mid - 1].key;
+    child->num_pairs = mid;
+
+    // Shift parent's keys and children to make room for new_child
+    memmove(parent->keys + index + 1, parent->keys + index, sizeof(Key) * (parent->num_pairs - index));
+    memmove(parent->children + index + 2, parent->children + index + 1,
+            sizeof(BTreeNode *) * (parent->num_pairs - index));
+    parent->keys[index] = separator;
+    parent->children[index + 1] = new_child;
     parent->num_pairs++;
 }
 
 void btree_insert_nonfull(BTreeNode *node, Pair pair)
 {
-    int index = node->num_pairs - 1;
+    int index = upper_bound(node, pair.key_type, pair.key);
     if (node->is_leaf)
     {
-        while (index >= 0 && key_less_than(pair.key_type, pair.key, node->pairs[index].key))
-        {
-            node->pairs[index + 1] = node->pairs[index];
-            index--;
-        }
-        node->pairs[index + 1] = pair;
+        int moved = node->num_pairs - index;
+        memmove(node->keys + index + 1, node->keys + index, sizeof(Key) * moved);
+        memmove(node->values + index + 1, node->values + index, sizeof(Value) * moved);
+        memmove(node->value_types + index + 1, node->value_types + index, sizeof(PairType) * moved);
+        node->keys[index] = pair.key;
+        node->values[index] = pair.value;
+        node->value_types[index] = pair.value_type;
         node->num_pairs++;
     }
     else
     {
-        // Find the child to insert the key into
-        while (index >= 0 && key_less_than(pair.key_type, pair.key, node->pairs[index].key))
-        {
-            index--;
-        }
-        index++;
         // if the child is full split it.
         if (node->children[index]->num_pairs == MAX_PAIRS)
         {
             btree_split_child(node, index);
-            if (key_greater_than(pair.key_type, pair.key, node->pairs[index].key))
+            if (!key_less_than(pair.key_type, pair.key, node->keys[index]))
             {
                 index++;
             }
@@ -174,6 +219,89 @@ void btree_insert(BTreeNode **root, Pair pair)
     }
 }
 
+// returns the size of part `index` when `total` items are shared as evenly as possible into `parts`.
+static int share_of(int total, int parts, int index)
+{
+    return total / parts + (index < total % parts);
+}
+
+BTreeNode *btree_bulk_load(const Pair *pairs, int count, double fill_factor)
+{
+    if (!(fill_factor > 0 && fill_factor <= 1))
+    {
+        return nullptr;
+    }
+    for (int i = 1; i < count; i++)
+    {
+        if (key_less_than(pairs[i].key_type, pairs[i].key, pairs[i - 1].key))
+        {
+            return nullptr;
+        }
+    }
+    if (count == 0)
+    {
+        return new_node(0, 1);
+    }
+
+    // pairs are shared evenly between the leaves, none gets more than the fill factor allows
+    int per_leaf = (int)(MAX_PAIRS * fill_factor);
+    per_leaf = per_leaf < 1 ? 1 : per_leaf;
+    int level_count = (count + per_leaf - 1) / per_leaf;
+    BTreeNode **level = malloc(sizeof(BTreeNode *) * level_count);
+    Key *lowest = malloc(sizeof(Key) * level_count);
+    const Pair *pair = pairs;
+    for (int i = 0; i < level_count; i++)
+    {
+        BTreeNode *leaf = new_node(share_of(count, level_count, i), 1);
+        for (int j = 0; j < leaf->num_pairs; j++, pair++)
+        {
+            leaf->keys[j] = pair->key;
+            leaf->values[j] = pair->value;
+            leaf->value_types[j] = pair->value_type;
+        }
+        if (i > 0)
+        {
+            leaf->prev = level[i - 1];
+            level[i - 1]->next = leaf;
+        }
+        level[i] = leaf;
+        lowest[i] = leaf->keys[0];
+    }
+
+    // a node takes the lowest key of each child but the first. with fewer than 4 children per node, sharing
+    // the nodes of a level could leave a parent with a single child.
+    int per_node = (int)(BTREE_ORDER * fill_factor);
+    per_node = per_node < 4 ? 4 : per_node;
+    while (level_count > 1)
+    {
+        int parent_count = (level_count + per_node - 1) / per_node;
+        int child = 0;
+        for (int i = 0; i < parent_count; i++)
+        {
+            int children = share_of(level_count, parent_count, i);
+            BTreeNode *parent = new_node(children - 1, 0);
+            Key parent_lowest = lowest[child];
+            for (int j = 0; j < children; j++, child++)
+            {
+                parent->children[j] = level[child];
+                if (j > 0)
+                {
+                    parent->keys[j - 1] = lowest[child];
+                }
+            }
+            // parents take the place of their children, which were read before
+            level[i] = parent;
+            lowest[i] = parent_lowest;
+        }
+        level_count = parent_count;
+    }
+
+    BTreeNode *root = level[0];
+    free(level);
+    free(lowest);
+    return root;
+}
+
 bool btree_search(BTreeNode *root, Pair *pair)
 {
     if (root == NULL)
@@ -181,27 +309,129 @@ bool btree_search(BTreeNode *root, Pair *pair)
         return 0;
     }
 
-    int i = 0;
-    while (i < root->num_pairs && key_less_than(root->pairs[i].key_type, root->pairs[i].key, pair->key))
+    BTreeNode *node = root;
+    while (!node->is_leaf)
     {
-        i++;
+        node = node->children[upper_bound(node, pair->key_type, pair->key)];
     }
 
-    if (root->is_leaf)
+    int i = lower_bound(node, pair->key_type, pair->key);
+    if (i < node->num_pairs && key_equal_to(pair->key_type, pair->key, node->keys[i]))
+    {
+        pair->value_type = node->value_types[i];
+        pair->value = node->values[i];
+        return 1;
+    }
+    return 0;
+}
+
+// moves a cursor at the end of its leaf to the first pair of the leaves that follow, skipping empty ones.
+static bool settle_forward(BTreeCursor *cursor)
+{
+    while (cursor->leaf != nullptr && cursor->index >= cursor->leaf->num_pairs)
+    {
+        cursor->leaf = cursor->leaf->next;
+        cursor->index = 0;
+    }
+    return cursor->leaf != nullptr;
+}
+
+// moves a cursor before the start of its leaf to the last pair of the leaves that precede, skipping empty ones.
+static bool settle_backward(BTreeCursor *cursor)
+{
+    while (cursor->leaf != nullptr && cursor->index < 0)
+    {
+        cursor->leaf = cursor->leaf->prev;
+        cursor->index = cursor->leaf != nullptr ? cursor->leaf->num_pairs - 1 : 0;
+    }
+    return cursor->leaf != nullptr;
+}
+
+BTreeCursor btree_seek(BTreeNode *root, PairType type, Key key)
+{
+    BTreeCursor cursor = {.leaf = root, .index = 0};
+    if (root == nullptr)
+    {
+        return cursor;
+    }
+
+    // equal keys can end a child and start the next one, the leftmost child that may hold `key` is followed
+    while (!cursor.leaf->is_leaf)
+    {
+        cursor.leaf = cursor.leaf->children[lower_bound(cursor.leaf, type, key)];
+    }
+    cursor.index = lower_bound(cursor.leaf, type, key);
+    settle_forward(&cursor);
+    return cursor;
+}
+
+BTreeCursor btree_first(BTreeNode *root)
+{
+    BTreeCursor cursor = {.leaf = root, .index = 0};
+    if (root == nullptr)
+    {
+        return cursor;
+    }
+    while (!cursor.leaf->is_leaf)
+    {
+        cursor.leaf = cursor.leaf->children[0];
+    }
+    settle_forward(&cursor);
+    return cursor;
+}
+
+BTreeCursor btree_last(BTreeNode *root)
+{
+    BTreeCursor cursor = {.leaf = root, .index = -1};
+    if (root == nullptr)
+    {
+        return cursor;
+    }
+    while (!cursor.leaf->is_leaf)
+    {
+        cursor.leaf = cursor.leaf->children[cursor.leaf->num_pairs];
+    }
+    cursor.index = cursor.leaf->num_pairs - 1;
+    settle_backward(&cursor);
+    return cursor;
+}
+
+bool cursor_valid(const BTreeCursor *cursor)
+{
+    return cursor->leaf != nullptr;
+}
+
+bool cursor_next(BTreeCursor *cursor)
+{
+    if (cursor->leaf == nullptr)
     {
-        if (i < root->num_pairs && key_equal_to(pair->key_type, pair->key, root->pairs[i].key))
-        {
-            pair->value_type = root->pairs[i].value_type;
-            pair->value = root->pairs[i].value;
-            return 1;
-        }
         return 0;
     }
+    cursor->index++;
+    return settle_forward(cursor);
+}
 
-    if (i < root->num_pairs && key_equal_to(pair->key_type, pair->key, root->pairs[i].key))
+bool cursor_prev(BTreeCursor *cursor)
+{
+    if (cursor->leaf == nullptr)
     {
-        return btree_search(root->children[i + 1], pair);
+        return 0;
     }
+    cursor->index--;
+    return settle_backward(cursor);
+}
 
-    return btree_search(root->children[i], pair);
+Key cursor_key(const BTreeCursor *cursor)
+{
+    return cursor->leaf->keys[cursor->index];
+}
+
+Value cursor_value(const BTreeCursor *cursor)
+{
+    return cursor->leaf->values[cursor->index];
+}
+
+PairType cursor_value_type(const BTreeCursor *cursor)
+{
+    return cursor->leaf->value_types[cursor->index];
 }
@@ -0,0 +1,343 @@
+#include "cache_policy.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+// the lists a node can be on. LRU only uses `LIST_RECENT`. 2Q uses it as the A1in FIFO, `LIST_FREQUENT`
+// as the main LRU and `LIST_GHOST_RECENT` as A1out. ARC uses the four of them as T1, T2, B1 and B2.
+enum
+{
+    LIST_NONE,
+    LIST_RECENT,
+    LIST_FREQUENT,
+    LIST_GHOST_RECENT,
+    LIST_GHOST_FREQUENT,
+    LIST_COUNT,
+};
+
+// PolicyList is a doubly linked list of nodes, from the most recently used `head` to the `tail`.
+typedef struct PolicyList
+{
+    int head;
+    int tail;
+    int size;
+} PolicyList;
+
+typedef struct PolicyNode
+{
+    int prev;
+    int next;
+    int page_number;
+    int hash_next; // ghost nodes only
+    uint8_t list;
+} PolicyNode;
+
+// CachePolicy keeps one node per frame of the pool followed by the ghost nodes, which hold
+// the page numbers of evicted pages and are found by page number through a hash table.
+struct CachePolicy
+{
+    CachePolicyKind kind;
+    int capacity;
+    int target; // 2Q: largest A1in before it is preferred for eviction. ARC: adaptive target size of T1.
+    PolicyList lists[LIST_COUNT];
+    PolicyNode *nodes;
+    int ghost_capacity;
+    int free_ghost; // unused ghost nodes, chained through `next`
+    int *buckets;
+    int bucket_mask;
+};
+
+static void list_unlink(CachePolicy *policy, int node)
+{
+    PolicyNode *entry = &policy->nodes[node];
+    PolicyList *list = &policy->lists[entry->list];
+    if (entry->prev != -1)
+    {
+        policy->nodes[entry->prev].next = entry->next;
+    }
+    else
+    {
+        list->head = entry->next;
+    }
+    if (entry->next != -1)
+    {
+        policy->nodes[entry->next].prev = entry->prev;
+    }
+    else
+    {
+        list->tail = entry->prev;
+    }
+    list->size--;
+    entry->list = LIST_NONE;
+}
+
+static void list_push_front(CachePolicy *policy, int list_id, int node)
+{
+    PolicyNode *entry = &policy->nodes[node];
+    PolicyList *list = &policy->lists[list_id];
+    entry->list = (uint8_t)list_id;
+    entry->prev = -1;
+    entry->next = list->head;
+    if (list->head != -1)
+    {
+        policy->nodes[list->head].prev = node;
+    }
+    list->head = node;
+    if (list->tail == -1)
+    {
+        list->tail = node;
+    }
+    list->size++;
+}
+
+static int ghost_bucket(const CachePolicy *policy, int page_number)
+{
+    return (int)(((uint32_t)page_number * 2654435761u) & (uint32_t)policy->bucket_mask);
+}
+
+static int ghost_find(const CachePolicy *policy, int page_number)
+{
+    int node = policy->buckets[ghost_bucket(policy, page_number)];
+    while (node != -1 && policy->nodes[node].page_number != page_number)
+    {
+        node = policy->nodes[node].hash_next;
+    }
+    return node;
+}
+
+// forgets the evicted page held by the ghost `node`.
+static void ghost_drop(CachePolicy *policy, int node)
+{
+    int *link = &policy->buckets[ghost_bucket(policy, policy->nodes[node].page_number)];
+    while (*link != node)
+    {
+        link = &policy->nodes[*link].hash_next;
+    }
+    *link = policy->nodes[node].hash_next;
+
+    list_unlink(policy, node);
+    policy->nodes[node].page_number = -1;
+    policy->nodes[node].next = policy->free_ghost;
+    policy->free_ghost = node;
+}
+
+// remembers `page_number` at the head of the ghost list `list_id`, forgetting the oldest ghost if needed.
+static void ghost_add(CachePolicy *policy, int list_id, int page_number)
+{
+    if (policy->free_ghost == -1)
+    {
+        PolicyList *recent = &policy->lists[LIST_GHOST_RECENT];
+        PolicyList *frequent = &policy->lists[LIST_GHOST_FREQUENT];
+        ghost_drop(policy, recent->size >= frequent->size ? recent->tail : frequent->tail);
+    }
+
+    int node = policy->free_ghost;
+    policy->free_ghost = policy->nodes[node].next;
+    policy->nodes[node].page_number = page_number;
+    int bucket = ghost_bucket(policy, page_number);
+    policy->nodes[node].hash_next = policy->buckets[bucket];
+    policy->buckets[bucket] = node;
+    list_push_front(policy, list_id, node);
+}
+
+// returns the least recently used frame of the list accepted by `evictable`, or -1.
+static int list_victim(const CachePolicy *policy, int list_id, FrameFilter evictable, void *context)
+{
+    int node = policy->lists[list_id].tail;
+    while (node != -1 && !evictable(node, context))
+    {
+        node = policy->nodes[node].prev;
+    }
+    return node;
+}
+
+CachePolicy *cache_policy_create(CachePolicyKind kind, int capacity)
+{
+    CachePolicy *policy = calloc(1, sizeof(CachePolicy));
+    if (policy == nullptr)
+    {
+        return nullptr;
+    }
+    policy->kind = kind;
+    policy->capacity = capacity;
+    switch (kind)
+    {
+    case CACHE_POLICY_2Q:
+        // the sizes suggested by the 2Q paper: A1in holds a quarter of the pool, A1out half of it.
+        policy->target = capacity / 4 > 0 ? capacity / 4 : 1;
+        policy->ghost_capacity = capacity / 2 > 0 ? capacity / 2 : 1;
+        break;
+    case CACHE_POLICY_ARC:
+        policy->target = 0;
+        policy->ghost_capacity = capacity;
+        break;
+    default:
+        policy->ghost_capacity = 0;
+        break;
+    }
+
+    int buckets = 1;
+    while (buckets < policy->ghost_capacity * 2)
+    {
+        buckets <<= 1;
+    }
+    policy->nodes = malloc(sizeof(PolicyNode) * (size_t)(capacity + policy->ghost_capacity));
+    policy->buckets = malloc(sizeof(int) * (size_t)buckets);
+    if (policy->nodes == nullptr || policy->buckets == nullptr)
+    {
+        cache_policy_destroy(policy);
+        return nullptr;
+    }
+    policy->bucket_mask = buckets - 1;
+    for (int i = 0; i < buckets; i++)
+    {
+        policy->buckets[i] = -1;
+    }
+    for (int i = 0; i < LIST_COUNT; i++)
+    {
+        policy->lists[i] = (PolicyList){-1, -1, 0};
+    }
+
+    policy->free_ghost = -1;
+    for (int i = capacity + policy->ghost_capacity - 1; i >= 0; i--)
+    {
+        policy->nodes[i] = (PolicyNode){-1, -1, -1, -1, LIST_NONE};
+        if (i >= capacity)
+        {
+            policy->nodes[i].next = policy->free_ghost;
+            policy->free_ghost = i;
+        }
+    }
+    return policy;
+}
+
+void cache_policy_destroy(CachePolicy *policy)
+{
+    if (policy == nullptr)
+    {
+        return;
+    }
+    free(policy->nodes);
+    free(policy->buckets);
+    free(policy);
+}
+
+CachePolicyKind cache_policy_kind(const CachePolicy *policy)
+{
+    return policy->kind;
+}
+
+void cache_policy_touch(CachePolicy *policy, int frame)
+{
+    int list = policy->nodes[frame].list;
+    if (list == LIST_NONE || (policy->kind == CACHE_POLICY_2Q && list == LIST_RECENT))
+    {
+        return; // 2Q doesn't reorder A1in, a page only proves itself once it came back from A1out.
+    }
+
+    list_unlink(policy, frame);
+    list_push_front(policy, policy->kind == CACHE_POLICY_LRU ? LIST_RECENT : LIST_FREQUENT, frame);
+}
+
+void cache_policy_insert(CachePolicy *policy, int frame, int page_number)
+{
+    policy->nodes[frame].page_number = page_number;
+    if (policy->kind == CACHE_POLICY_LRU)
+    {
+        list_push_front(policy, LIST_RECENT, frame);
+        return;
+    }
+
+    int ghost = ghost_find(policy, page_number);
+    if (ghost == -1)
+    {
+        list_push_front(policy, LIST_RECENT, frame);
+        if (policy->kind == CACHE_POLICY_ARC)
+        {
+            // keep |T1| + |B1| <= c and the whole directory <= 2c.
+            PolicyList *lists = policy->lists;
+            if (lists[LIST_RECENT].size + lists[LIST_GHOST_RECENT].size > policy->capacity &&
+                lists[LIST_GHOST_RECENT].size > 0)
+            {
+                ghost_drop(policy, lists[LIST_GHOST_RECENT].tail);
+            }
+            else if (lists[LIST_RECENT].size + lists[LIST_FREQUENT].size + lists[LIST_GHOST_RECENT].size +
+                             lists[LIST_GHOST_FREQUENT].size >
+                         2 * policy->capacity &&
+                     lists[LIST_GHOST_FREQUENT].size > 0)
+            {
+                ghost_drop(policy, lists[LIST_GHOST_FREQUENT].tail);
+            }
+        }
+        return;
+    }
+
+    if (policy->kind == CACHE_POLICY_ARC)
+    {
+        // a ghost hit tells which list was too short: grow the target of that side.
+        int recent = policy->lists[LIST_GHOST_RECENT].size;
+        int frequent = policy->lists[LIST_GHOST_FREQUENT].size;
+        if (policy->nodes[ghost].list == LIST_GHOST_RECENT)
+        {
+            int delta = recent >= frequent ? 1 : frequent / recent;
+            policy->target = policy->target + delta < policy->capacity ? policy->target + delta : policy->capacity;
+        }
+        else
+        {
+            int delta = frequent >= recent ? 1 : recent / frequent;
+            policy->target = policy->target - delta > 0 ? policy->target - delta : 0;
+        }
+    }
+    ghost_drop(policy, ghost);
+    list_push_front(policy, LIST_FREQUENT, frame);
+}
+
+int cache_policy_victim(CachePolicy *policy, int page_number, FrameFilter evictable, void *context)
+{
+    int first = LIST_RECENT;
+    if (policy->kind == CACHE_POLICY_2Q)
+    {
+        int recent = policy->lists[LIST_RECENT].size;
+        if (recent <= policy->target && policy->lists[LIST_FREQUENT].size > 0)
+        {
+            first = LIST_FREQUENT;
+        }
+    }
+    else if (policy->kind == CACHE_POLICY_ARC)
+    {
+        int recent = policy->lists[LIST_RECENT].size;
+        int ghost = ghost_find(policy, page_number);
+        bool in_frequent_ghost = ghost != -1 && policy->nodes[ghost].list == LIST_GHOST_FREQUENT;
+        if (recent == 0 || (recent < policy->target || (recent == policy->target && !in_frequent_ghost)))
+        {
+            first = LIST_FREQUENT;
+        }
+    }
+
+    int frame = list_victim(policy, first, evictable, context);
+    if (frame == -1 && policy->kind != CACHE_POLICY_LRU)
+    {
+        frame = list_victim(policy, first == LIST_RECENT ? LIST_FREQUENT : LIST_RECENT, evictable, context);
+    }
+    return frame;
+}
+
+void cache_policy_evict(CachePolicy *policy, int frame)
+{
+    int list = policy->nodes[frame].list;
+    if (list == LIST_NONE)
+    {
+        return;
+    }
+    list_unlink(policy, frame);
+
+    int page_number = policy->nodes[frame].page_number;
+    policy->nodes[frame].page_number = -1;
+    if (policy->kind == CACHE_POLICY_2Q && list == LIST_RECENT)
+    {
+        ghost_add(policy, LIST_GHOST_RECENT, page_number);
+    }
+    else if (policy->kind == CACHE_POLICY_ARC)
+    {
+        ghost_add(policy, list == LIST_RECENT ? LIST_GHOST_RECENT : LIST_GHOST_FREQUENT, page_number);
+    }
+}
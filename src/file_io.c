@@ -0,0 +1,122 @@
+#include "file_io.h"
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+ssize_t pread_full(int fd, void *buf, size_t count, off_t offset)
+{
+    size_t done = 0;
+    while (done < count)
+    {
+        ssize_t n = pread(fd, (uint8_t *)buf + done, count - done, offset + (off_t)done);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0)
+        {
+            break; // end of file
+        }
+        done += (size_t)n;
+    }
+    return (ssize_t)done;
+}
+
+ssize_t preadv_full(int fd, struct iovec *iov, int iovcnt, off_t offset)
+{
+    size_t done = 0;
+    while (iovcnt > 0)
+    {
+        ssize_t n = preadv(fd, iov, iovcnt, offset);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0)
+        {
+            break; // end of file
+        }
+
+        offset += n;
+        done += (size_t)n;
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    return (ssize_t)done;
+}
+
+int pwrite_full(int fd, const void *buf, size_t count, off_t offset)
+{
+    size_t done = 0;
+    while (done < count)
+    {
+        ssize_t n = pwrite(fd, (const uint8_t *)buf + done, count - done, offset + (off_t)done);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0)
+        {
+            errno = EIO;
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+int pwritev_full(int fd, struct iovec *iov, int iovcnt, off_t offset)
+{
+    while (iovcnt > 0)
+    {
+        ssize_t n = pwritev(fd, iov, iovcnt, offset);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0)
+        {
+            errno = EIO;
+            return -1;
+        }
+
+        offset += n;
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include "io_stats.h"
+#include <time.h>
+
+uint64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int bucket_of(uint64_t ns)
+{
+    int bucket = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+    return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+void latency_record(LatencyRecorder *recorder, uint64_t ns)
+{
+    atomic_fetch_add_explicit(&recorder->buckets[bucket_of(ns)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&recorder->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&recorder->total_ns, ns, memory_order_relaxed);
+    uint_fast64_t max = atomic_load_explicit(&recorder->max_ns, memory_order_relaxed);
+    while (ns > max && !atomic_compare_exchange_weak_explicit(&recorder->max_ns, &max, ns, memory_order_relaxed,
+                                                              memory_order_relaxed))
+    {
+    }
+}
+
+LatencyHistogram latency_snapshot(LatencyRecorder *recorder)
+{
+    LatencyHistogram histogram;
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        histogram.buckets[i] = atomic_load_explicit(&recorder->buckets[i], memory_order_relaxed);
+    }
+    histogram.count = atomic_load_explicit(&recorder->count, memory_order_relaxed);
+    histogram.total_ns = atomic_load_explicit(&recorder->total_ns, memory_order_relaxed);
+    histogram.max_ns = atomic_load_explicit(&recorder->max_ns, memory_order_relaxed);
+    return histogram;
+}
+
+// returns the first latency past bucket `bucket`.
+static uint64_t bucket_end(int bucket)
+{
+    return (uint64_t)1 << (bucket + 1);
+}
+
+uint64_t latency_percentile(const LatencyHistogram *histogram, double fraction)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        total += histogram->buckets[i];
+    }
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    // the rank of the call, counted from 1, that `fraction` of the calls don't exceed.
+    uint64_t rank = (uint64_t)(fraction * (double)total + 0.999999);
+    rank = rank == 0 ? 1 : rank > total ? total : rank;
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        seen += histogram->buckets[i];
+        if (seen >= rank)
+        {
+            // the maximum is a tighter bound for the calls of the highest bucket in use.
+            uint64_t end = bucket_end(i) - 1;
+            return i == LATENCY_BUCKETS - 1 || histogram->max_ns < end ? histogram->max_ns : end;
+        }
+    }
+    return histogram->max_ns;
+}
+
+// writes `ns` with the unit that keeps it short.
+static void format_ns(uint64_t ns, char *text, size_t size)
+{
+    if (ns < 1000)
+    {
+        snprintf(text, size, "%llu ns", (unsigned long long)ns);
+    }
+    else if (ns < 1000000)
+    {
+        snprintf(text, size, "%.1f us", (double)ns / 1e3);
+    }
+    else if (ns < 1000000000)
+    {
+        snprintf(text, size, "%.1f ms", (double)ns / 1e6);
+    }
+    else
+    {
+        snprintf(text, size, "%.2f s", (double)ns / 1e9);
+    }
+}
+
+int latency_dump(const LatencyHistogram *histogram, const char *name, FILE *output)
+{
+    char mean[16], median[16], p99[16], max[16];
+    format_ns(histogram->count == 0 ? 0 : histogram->total_ns / histogram->count, mean, sizeof(mean));
+    format_ns(latency_percentile(histogram, 0.5), median, sizeof(median));
+    format_ns(latency_percentile(histogram, 0.99), p99, sizeof(p99));
+    format_ns(histogram->max_ns, max, sizeof(max));
+    if (fprintf(output, "%s: %llu calls, mean %s, p50 %s, p99 %s, max %s\n", name,
+                (unsigned long long)histogram->count, mean, median, p99, max) < 0)
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        if (histogram->buckets[i] == 0)
+        {
+            continue;
+        }
+        char from[16], to[16];
+        format_ns(i == 0 ? 0 : (uint64_t)1 << i, from, sizeof(from));
+        format_ns(bucket_end(i), to, sizeof(to));
+        int written = i == LATENCY_BUCKETS - 1
+                          ? fprintf(output, "  %10s and more  %llu\n", from, (unsigned long long)histogram->buckets[i])
+                          : fprintf(output, "  %10s - %-10s  %llu\n", from, to, (unsigned long long)histogram->buckets[i]);
+        if (written < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
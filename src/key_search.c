@@ -0,0 +1,133 @@
+#include "key_search.h"
+#include <stdatomic.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KEY_SEARCH_X86
+#endif
+
+// narrows [`low`, `high`) by bisection until at most `window` keys are left, the rank lies within it.
+static void bisect(const int64_t *keys, int *low, int *high, int64_t key, bool inclusive, int window)
+{
+    while (*high - *low > window)
+    {
+        int middle = (*low + *high) / 2;
+        if (keys[middle] < key || (inclusive && keys[middle] == key))
+        {
+            *low = middle + 1;
+        }
+        else
+        {
+            *high = middle;
+        }
+    }
+}
+
+static int rank_scalar(const int64_t *keys, int count, int64_t key, bool inclusive)
+{
+    int low = 0;
+    int high = count;
+    bisect(keys, &low, &high, key, inclusive, 0);
+    return low;
+}
+
+#ifdef KEY_SEARCH_X86
+__attribute__((target("sse4.2"))) static int rank_sse42(const int64_t *keys, int count, int64_t key, bool inclusive)
+{
+    int low = 0;
+    int high = count;
+    bisect(keys, &low, &high, key, inclusive, KEY_SEARCH_WINDOW);
+
+    // keys below `key` are those it is greater than, keys not above it those that aren't greater than it.
+    __m128i needle = _mm_set1_epi64x(key);
+    int rank = low;
+    int i = low;
+    for (; i + 2 <= high; i += 2)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i *)(keys + i));
+        __m128i greater = inclusive ? _mm_cmpgt_epi64(block, needle) : _mm_cmpgt_epi64(needle, block);
+        int counted = __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(greater)));
+        rank += inclusive ? 2 - counted : counted;
+    }
+    for (; i < high; i++)
+    {
+        rank += inclusive ? keys[i] <= key : keys[i] < key;
+    }
+    return rank;
+}
+
+__attribute__((target("avx2"))) static int rank_avx2(const int64_t *keys, int count, int64_t key, bool inclusive)
+{
+    int low = 0;
+    int high = count;
+    bisect(keys, &low, &high, key, inclusive, KEY_SEARCH_WINDOW);
+
+    __m256i needle = _mm256_set1_epi64x(key);
+    int rank = low;
+    int i = low;
+    for (; i + 4 <= high; i += 4)
+    {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(keys + i));
+        __m256i greater = inclusive ? _mm256_cmpgt_epi64(block, needle) : _mm256_cmpgt_epi64(needle, block);
+        int counted = __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(greater)));
+        rank += inclusive ? 4 - counted : counted;
+    }
+    for (; i < high; i++)
+    {
+        rank += inclusive ? keys[i] <= key : keys[i] < key;
+    }
+    return rank;
+}
+#endif
+
+bool key_search_supported(KeySearchKind kind)
+{
+    switch (kind)
+    {
+    case KEY_SEARCH_SCALAR:
+        return true;
+#ifdef KEY_SEARCH_X86
+    case KEY_SEARCH_SSE42:
+        return __builtin_cpu_supports("sse4.2");
+    case KEY_SEARCH_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+KeySearchKind key_search_kind()
+{
+    // every thread picks the same kind, a race only repeats the probe.
+    static atomic_int picked = -1;
+    int kind = atomic_load_explicit(&picked, memory_order_relaxed);
+    if (kind == -1)
+    {
+        kind = key_search_supported(KEY_SEARCH_AVX2)    ? KEY_SEARCH_AVX2
+               : key_search_supported(KEY_SEARCH_SSE42) ? KEY_SEARCH_SSE42
+                                                        : KEY_SEARCH_SCALAR;
+        atomic_store_explicit(&picked, kind, memory_order_relaxed);
+    }
+    return (KeySearchKind)kind;
+}
+
+int int64_rank_using(KeySearchKind kind, const int64_t *keys, int count, int64_t key, bool inclusive)
+{
+    switch (kind)
+    {
+#ifdef KEY_SEARCH_X86
+    case KEY_SEARCH_AVX2:
+        return rank_avx2(keys, count, key, inclusive);
+    case KEY_SEARCH_SSE42:
+        return rank_sse42(keys, count, key, inclusive);
+#endif
+    default:
+        return rank_scalar(keys, count, key, inclusive);
+    }
+}
+
+int int64_rank(const int64_t *keys, int count, int64_t key, bool inclusive)
+{
+    return int64_rank_using(key_search_kind(), keys, count, key, inclusive);
+}
@@ -0,0 +1,636 @@
+#include "page_codec.h"
+#include "file_io.h"
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LZ_MIN_MATCH    4
+#define LZ_HASH_BITS    12
+#define LZ_MAX_OFFSET   65535
+#define LZ_SKIP_SHIFT   6 // the search speeds up the longer it goes without a match, incompressible data is cheap
+#define SLOT_MAGIC      0x544f4c53u // "SLOT"
+#define SLOT_RAW        1           // the payload is the page itself, it didn't compress
+
+// SlotHeader starts every slot. the checksum covers the fields before it, the payload has its own.
+typedef struct SlotHeader
+{
+    uint32_t magic;
+    int32_t page_number;
+    uint64_t sequence; // grows with every write, the slot of a page with the highest one holds its newest image
+    uint32_t length;   // bytes of payload after the header
+    uint16_t units;    // size of the slot in `SLOT_UNIT`, which may exceed what the payload needs
+    uint16_t flags;
+    uint32_t payload_checksum;
+    uint32_t checksum;
+} SlotHeader;
+
+_Static_assert(sizeof(SlotHeader) == SLOT_HEADER_SIZE, "the slot header has a fixed size");
+
+// SlotRef locates the slot of a page, `offset` is 0 for a page without one.
+typedef struct SlotRef
+{
+    int64_t offset;
+    uint64_t sequence;
+    int units;
+} SlotRef;
+
+// FreeList is a stack of the offsets of free slots of one size.
+typedef struct FreeList
+{
+    int64_t *offsets;
+    int count;
+    int capacity;
+} FreeList;
+
+// PendingSlot is a slot a page moved out of. the slot that replaced it may not be on disk yet, after a crash the
+// page is found in the old slot again: it isn't reused before the file is synced.
+typedef struct PendingSlot
+{
+    int64_t offset;
+    int units;
+} PendingSlot;
+
+struct PageCodec
+{
+    pthread_mutex_t lock; // guards everything below but the constants
+    int fd;
+    int page_size;
+    int max_units; // units of a slot holding an uncompressed page
+    int64_t data_offset;
+    int64_t end;       // where the next slot is appended
+    uint64_t sequence; // of the last slot written
+    SlotRef *slots;    // indexed by page number
+    int slot_capacity;
+    FreeList *free; // free slots by size, `max_units + 1` lists
+    PendingSlot *pending; // slots left since the last sync
+    int pending_count;
+    int pending_capacity;
+    PageCodecStats stats;
+};
+
+static uint32_t read32(const uint8_t *bytes)
+{
+    uint32_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+static int lz_hash(uint32_t sequence)
+{
+    return (int)((sequence * 2654435761u) >> (32 - LZ_HASH_BITS));
+}
+
+// appends the bytes that extend a length too long for its 4 bits in the token. returns nullptr when full.
+static uint8_t *put_length(uint8_t *out, const uint8_t *end, int length)
+{
+    for (; length >= 255; length -= 255)
+    {
+        if (out == end)
+        {
+            return nullptr;
+        }
+        *out++ = 255;
+    }
+    if (out == end)
+    {
+        return nullptr;
+    }
+    *out++ = (uint8_t)length;
+    return out;
+}
+
+// appends a sequence: a token, `literal_count` bytes copied from `literals` and, when `match_length` isn't 0,
+// the offset and the length of a match. the last sequence of a block has no match. returns nullptr when full.
+static uint8_t *put_sequence(uint8_t *out, const uint8_t *end, const uint8_t *literals, int literal_count,
+                             int offset, int match_length)
+{
+    if (out == end)
+    {
+        return nullptr;
+    }
+    uint8_t *token = out++;
+    int match_code = match_length > 0 ? match_length - LZ_MIN_MATCH : 0;
+    *token = (uint8_t)(((literal_count < 15 ? literal_count : 15) << 4) | (match_code < 15 ? match_code : 15));
+    if (literal_count >= 15 && (out = put_length(out, end, literal_count - 15)) == nullptr)
+    {
+        return nullptr;
+    }
+    if (end - out < literal_count)
+    {
+        return nullptr;
+    }
+    memcpy(out, literals, (size_t)literal_count);
+    out += literal_count;
+    if (match_length == 0)
+    {
+        return out;
+    }
+
+    if (end - out < 2)
+    {
+        return nullptr;
+    }
+    *out++ = (uint8_t)offset;
+    *out++ = (uint8_t)(offset >> 8);
+    if (match_code >= 15 && (out = put_length(out, end, match_code - 15)) == nullptr)
+    {
+        return nullptr;
+    }
+    return out;
+}
+
+int lz_compress(const uint8_t *source, int size, uint8_t *destination, int capacity)
+{
+    uint32_t table[1 << LZ_HASH_BITS] = {0}; // position + 1 of the last 4 bytes seen with each hash
+    const uint8_t *end = destination + capacity;
+    uint8_t *out = destination;
+    int anchor = 0; // first byte not covered by a sequence yet
+    int position = 0;
+    while (position + LZ_MIN_MATCH <= size)
+    {
+        uint32_t sequence = read32(source + position);
+        int hash = lz_hash(sequence);
+        int candidate = (int)table[hash] - 1;
+        table[hash] = (uint32_t)position + 1;
+        if (candidate < 0 || position - candidate > LZ_MAX_OFFSET || read32(source + candidate) != sequence)
+        {
+            position += 1 + ((position - anchor) >> LZ_SKIP_SHIFT);
+            continue;
+        }
+
+        int length = LZ_MIN_MATCH;
+        while (position + length < size && source[candidate + length] == source[position + length])
+        {
+            length++;
+        }
+        out = put_sequence(out, end, source + anchor, position - anchor, position - candidate, length);
+        if (out == nullptr)
+        {
+            return -1;
+        }
+        position += length;
+        anchor = position;
+    }
+
+    out = put_sequence(out, end, source + anchor, size - anchor, 0, 0);
+    return out == nullptr ? -1 : (int)(out - destination);
+}
+
+// reads the bytes that extend a length and adds them to `length`. returns -1 if the input ends first.
+static int get_length(const uint8_t **in, const uint8_t *end, int *length)
+{
+    uint8_t byte;
+    do
+    {
+        if (*in == end || *length > INT_MAX / 2)
+        {
+            return -1;
+        }
+        byte = *(*in)++;
+        *length += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+int lz_decompress(const uint8_t *source, int size, uint8_t *destination, int capacity)
+{
+    const uint8_t *in = source;
+    const uint8_t *end = source + size;
+    int out = 0;
+    while (in < end)
+    {
+        int token = *in++;
+        int literals = token >> 4;
+        if ((literals == 15 && get_length(&in, end, &literals) != 0) || literals > end - in || literals > capacity - out)
+        {
+            return -1;
+        }
+        memcpy(destination + out, in, (size_t)literals);
+        in += literals;
+        out += literals;
+        if (in == end)
+        {
+            break; // the last sequence has no match
+        }
+
+        if (end - in < 2)
+        {
+            return -1;
+        }
+        int offset = in[0] | in[1] << 8;
+        in += 2;
+        int length = token & 15;
+        if (length == 15 && get_length(&in, end, &length) != 0)
+        {
+            return -1;
+        }
+        length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > out || length > capacity - out)
+        {
+            return -1;
+        }
+        if (offset >= length)
+        {
+            memcpy(destination + out, destination + out - offset, (size_t)length);
+        }
+        else
+        {
+            // the match overlaps the bytes it produces, it is copied forward one byte at a time.
+            for (int i = 0; i < length; i++)
+            {
+                destination[out + i] = destination[out - offset + i];
+            }
+        }
+        out += length;
+    }
+    return out;
+}
+
+// FNV-1a, like the checksums of the log.
+static uint32_t checksum_of(const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    uint32_t checksum = 2166136261u;
+    for (size_t i = 0; i < size; i++)
+    {
+        checksum = (checksum ^ bytes[i]) * 16777619u;
+    }
+    return checksum;
+}
+
+static uint32_t header_checksum(const SlotHeader *header)
+{
+    return checksum_of(header, offsetof(SlotHeader, checksum));
+}
+
+static int units_for(int length)
+{
+    return (SLOT_HEADER_SIZE + length + SLOT_UNIT - 1) / SLOT_UNIT;
+}
+
+static bool is_valid_header(const PageCodec *codec, const SlotHeader *header)
+{
+    return header->magic == SLOT_MAGIC && header->checksum == header_checksum(header) && header->page_number >= 0 &&
+           header->units > 0 && header->units <= codec->max_units && header->length <= (uint32_t)codec->page_size &&
+           units_for((int)header->length) <= header->units;
+}
+
+// makes the map large enough for `page_number`, the caller holds the lock.
+static int reserve_slots(PageCodec *codec, int page_number)
+{
+    if (page_number < codec->slot_capacity)
+    {
+        return 0;
+    }
+    int capacity = codec->slot_capacity > 0 ? codec->slot_capacity : 64;
+    while (capacity <= page_number)
+    {
+        capacity = capacity > INT_MAX / 2 ? INT_MAX : capacity * 2;
+    }
+    SlotRef *slots = realloc(codec->slots, sizeof(SlotRef) * (size_t)capacity);
+    if (slots == nullptr)
+    {
+        return -1;
+    }
+    memset(slots + codec->slot_capacity, 0, sizeof(SlotRef) * (size_t)(capacity - codec->slot_capacity));
+    codec->slots = slots;
+    codec->slot_capacity = capacity;
+    return 0;
+}
+
+static int push_free(PageCodec *codec, int units, int64_t offset)
+{
+    FreeList *list = &codec->free[units];
+    if (list->count == list->capacity)
+    {
+        int capacity = list->capacity > 0 ? list->capacity * 2 : 16;
+        int64_t *offsets = realloc(list->offsets, sizeof(int64_t) * (size_t)capacity);
+        if (offsets == nullptr)
+        {
+            return -1;
+        }
+        list->offsets = offsets;
+        list->capacity = capacity;
+    }
+    list->offsets[list->count++] = offset;
+    return 0;
+}
+
+// keeps the slot a page moved out of from reuse until the next sync, the caller holds the lock.
+static int push_pending(PageCodec *codec, int units, int64_t offset)
+{
+    if (codec->pending_count == codec->pending_capacity)
+    {
+        int capacity = codec->pending_capacity > 0 ? codec->pending_capacity * 2 : 16;
+        PendingSlot *pending = realloc(codec->pending, sizeof(PendingSlot) * (size_t)capacity);
+        if (pending == nullptr)
+        {
+            return -1;
+        }
+        codec->pending = pending;
+        codec->pending_capacity = capacity;
+    }
+    codec->pending[codec->pending_count++] = (PendingSlot){offset, units};
+    return 0;
+}
+
+// returns the offset of a slot of `units` for a page: a free one of that size, or a new one at the end of the file.
+static int64_t take_slot(PageCodec *codec, int units)
+{
+    FreeList *list = &codec->free[units];
+    if (list->count > 0)
+    {
+        codec->stats.free_bytes -= (uint64_t)units * SLOT_UNIT;
+        return list->offsets[--list->count];
+    }
+    int64_t offset = codec->end;
+    codec->end += (int64_t)units * SLOT_UNIT;
+    return offset;
+}
+
+// reads the slot at `offset` and checks its header against `page_number` and its payload against its checksum.
+// returns the slot, header first, to be freed by the caller, or nullptr with `errno` set. the bytes read from the
+// file are added to `bytes_read` when it isn't nullptr.
+static uint8_t *read_slot(const PageCodec *codec, int64_t offset, int units, int page_number, uint64_t *bytes_read)
+{
+    uint8_t *slot = malloc((size_t)units * SLOT_UNIT);
+    if (slot == nullptr)
+    {
+        return nullptr;
+    }
+    ssize_t done = pread_full(codec->fd, slot, (size_t)units * SLOT_UNIT, offset);
+    if (done > 0 && bytes_read != nullptr)
+    {
+        *bytes_read += (uint64_t)done;
+    }
+    SlotHeader header;
+    memcpy(&header, slot, sizeof(header));
+    if (done < SLOT_HEADER_SIZE || !is_valid_header(codec, &header) || header.page_number != page_number ||
+        header.length > (size_t)done - SLOT_HEADER_SIZE ||
+        checksum_of(slot + SLOT_HEADER_SIZE, header.length) != header.payload_checksum)
+    {
+        free(slot);
+        errno = done < 0 ? errno : EIO;
+        return nullptr;
+    }
+    return slot;
+}
+
+// records the slot found at `offset` while the codec is opened. when two slots hold the same page, the newer one
+// wins if its payload is intact: a crash may have torn it while it was being written.
+static int scan_slot(PageCodec *codec, const SlotHeader *header, int64_t offset)
+{
+    if (reserve_slots(codec, header->page_number) != 0)
+    {
+        return -1;
+    }
+    SlotRef *ref = &codec->slots[header->page_number];
+    SlotRef found = {offset, header->sequence, header->units};
+    if (header->sequence > codec->sequence)
+    {
+        codec->sequence = header->sequence;
+    }
+    if (ref->offset == 0)
+    {
+        *ref = found;
+        codec->stats.pages++;
+        codec->stats.slot_bytes += (uint64_t)found.units * SLOT_UNIT;
+        return 0;
+    }
+
+    SlotRef newer = found.sequence > ref->sequence ? found : *ref;
+    SlotRef older = found.sequence > ref->sequence ? *ref : found;
+    uint8_t *slot = read_slot(codec, newer.offset, newer.units, header->page_number, nullptr);
+    free(slot);
+    SlotRef kept = slot != nullptr ? newer : older;
+    SlotRef dropped = slot != nullptr ? older : newer;
+    codec->stats.slot_bytes += (uint64_t)(kept.units - ref->units) * SLOT_UNIT;
+    codec->stats.free_bytes += (uint64_t)dropped.units * SLOT_UNIT;
+    *ref = kept;
+    return push_free(codec, dropped.units, dropped.offset);
+}
+
+void page_codec_close(PageCodec *codec)
+{
+    if (codec == nullptr)
+    {
+        return;
+    }
+    for (int i = 0; codec->free != nullptr && i <= codec->max_units; i++)
+    {
+        free(codec->free[i].offsets);
+    }
+    free(codec->free);
+    free(codec->pending);
+    free(codec->slots);
+    pthread_mutex_destroy(&codec->lock);
+    free(codec);
+}
+
+PageCodec *page_codec_open(int fd, int page_size, int64_t data_offset)
+{
+    PageCodec *codec = calloc(1, sizeof(PageCodec));
+    if (codec == nullptr)
+    {
+        return nullptr;
+    }
+    pthread_mutex_init(&codec->lock, nullptr);
+    codec->fd = fd;
+    codec->page_size = page_size;
+    codec->max_units = units_for(page_size);
+    codec->data_offset = data_offset;
+    codec->free = calloc((size_t)codec->max_units + 1, sizeof(FreeList));
+    struct stat st;
+    if (codec->free == nullptr || fstat(fd, &st) != 0)
+    {
+        page_codec_close(codec);
+        return nullptr;
+    }
+
+    // a slot damaged by a crash is stepped over one unit at a time until the next valid header.
+    int64_t offset = data_offset;
+    while (offset + SLOT_HEADER_SIZE <= st.st_size)
+    {
+        SlotHeader header;
+        if (pread_full(fd, &header, sizeof(header), offset) != sizeof(header))
+        {
+            page_codec_close(codec);
+            return nullptr;
+        }
+        if (!is_valid_header(codec, &header))
+        {
+            offset += SLOT_UNIT;
+            continue;
+        }
+        if (scan_slot(codec, &header, offset) != 0)
+        {
+            page_codec_close(codec);
+            return nullptr;
+        }
+        offset += (int64_t)header.units * SLOT_UNIT;
+    }
+    int64_t end = (st.st_size + SLOT_UNIT - 1) / SLOT_UNIT * SLOT_UNIT;
+    codec->end = end > data_offset ? end : data_offset;
+    return codec;
+}
+
+int page_codec_read(PageCodec *codec, int page_number, uint8_t *page)
+{
+    pthread_mutex_lock(&codec->lock);
+    SlotRef ref = page_number >= 0 && page_number < codec->slot_capacity ? codec->slots[page_number] : (SlotRef){0};
+    pthread_mutex_unlock(&codec->lock);
+    if (ref.offset == 0)
+    {
+        memset(page, 0, (size_t)codec->page_size); // never written
+        return 0;
+    }
+
+    uint64_t bytes_read = 0;
+    uint8_t *slot = read_slot(codec, ref.offset, ref.units, page_number, &bytes_read);
+    pthread_mutex_lock(&codec->lock);
+    codec->stats.bytes_read += bytes_read;
+    pthread_mutex_unlock(&codec->lock);
+    if (slot == nullptr)
+    {
+        return -1;
+    }
+    SlotHeader header;
+    memcpy(&header, slot, sizeof(header));
+    int length;
+    if (header.flags & SLOT_RAW)
+    {
+        length = header.length == (uint32_t)codec->page_size ? codec->page_size : -1;
+        memcpy(page, slot + SLOT_HEADER_SIZE, (size_t)codec->page_size);
+    }
+    else
+    {
+        length = lz_decompress(slot + SLOT_HEADER_SIZE, (int)header.length, page, codec->page_size);
+    }
+    free(slot);
+    if (length != codec->page_size)
+    {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+int page_codec_write(PageCodec *codec, int page_number, const uint8_t *page)
+{
+    if (page_number < 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    uint8_t *slot = malloc((size_t)codec->max_units * SLOT_UNIT);
+    if (slot == nullptr)
+    {
+        return -1;
+    }
+
+    // a page is only kept compressed when that saves at least one unit.
+    SlotHeader header = {.magic = SLOT_MAGIC, .page_number = page_number};
+    int length = lz_compress(page, codec->page_size, slot + SLOT_HEADER_SIZE, codec->page_size);
+    if (length == -1 || units_for(length) >= codec->max_units)
+    {
+        length = codec->page_size;
+        memcpy(slot + SLOT_HEADER_SIZE, page, (size_t)length);
+        header.flags = SLOT_RAW;
+    }
+    header.length = (uint32_t)length;
+    header.payload_checksum = checksum_of(slot + SLOT_HEADER_SIZE, (size_t)length);
+    int units = units_for(length);
+
+    pthread_mutex_lock(&codec->lock);
+    if (reserve_slots(codec, page_number) != 0)
+    {
+        pthread_mutex_unlock(&codec->lock);
+        free(slot);
+        return -1;
+    }
+    SlotRef *ref = &codec->slots[page_number];
+    if (ref->offset == 0 || units > ref->units)
+    {
+        if (ref->offset != 0)
+        {
+            codec->stats.relocations++;
+            codec->stats.slot_bytes -= (uint64_t)ref->units * SLOT_UNIT;
+            codec->stats.pages--;
+            // without memory for the list the old slot is only lost to reuse.
+            if (push_pending(codec, ref->units, ref->offset) == 0)
+            {
+                codec->stats.free_bytes += (uint64_t)ref->units * SLOT_UNIT;
+            }
+        }
+        ref->offset = take_slot(codec, units);
+        ref->units = units;
+        codec->stats.slot_bytes += (uint64_t)units * SLOT_UNIT;
+        codec->stats.pages++;
+    }
+    ref->sequence = ++codec->sequence;
+    header.units = (uint16_t)ref->units; // a page rewritten in place keeps the size of its slot
+    header.sequence = ref->sequence;
+    int64_t offset = ref->offset;
+    if (header.flags & SLOT_RAW)
+    {
+        codec->stats.raw_writes++;
+    }
+    else
+    {
+        codec->stats.compressed_writes++;
+    }
+    pthread_mutex_unlock(&codec->lock);
+
+    header.checksum = header_checksum(&header);
+    memcpy(slot, &header, sizeof(header));
+    int result = pwrite_full(codec->fd, slot, SLOT_HEADER_SIZE + (size_t)length, offset);
+    free(slot);
+    if (result == 0)
+    {
+        pthread_mutex_lock(&codec->lock);
+        codec->stats.bytes_written += SLOT_HEADER_SIZE + (uint64_t)length;
+        pthread_mutex_unlock(&codec->lock);
+    }
+    return result;
+}
+
+int page_codec_sync(PageCodec *codec)
+{
+    // the slots left before the sync are taken apart, those left while it runs wait for the next one.
+    pthread_mutex_lock(&codec->lock);
+    PendingSlot *pending = codec->pending;
+    int count = codec->pending_count;
+    codec->pending = nullptr;
+    codec->pending_count = 0;
+    codec->pending_capacity = 0;
+    pthread_mutex_unlock(&codec->lock);
+
+    int result = fdatasync(codec->fd);
+    pthread_mutex_lock(&codec->lock);
+    for (int i = 0; i < count; i++)
+    {
+        int pushed = result == 0 ? push_free(codec, pending[i].units, pending[i].offset)
+                                 : push_pending(codec, pending[i].units, pending[i].offset);
+        if (pushed != 0)
+        {
+            codec->stats.free_bytes -= (uint64_t)pending[i].units * SLOT_UNIT; // lost to reuse
+        }
+    }
+    pthread_mutex_unlock(&codec->lock);
+    free(pending);
+    return result == 0 ? 0 : -1;
+}
+
+PageCodecStats page_codec_stats(PageCodec *codec)
+{
+    pthread_mutex_lock(&codec->lock);
+    PageCodecStats stats = codec->stats;
+    pthread_mutex_unlock(&codec->lock);
+    return stats;
+}
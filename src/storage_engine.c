@@ -1,136 +1,2491 @@
-
 #include "storage_engine.h"
+#include "file_io.h"
+#include "io_stats.h"
+#include "page_codec.h"
+#include "wal.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MMAP_MIN_SIZE (16 * 1024 * 1024)
+#define READAHEAD_MAX_RUN 64 // pages read by a single readahead request
+#define SHARD_MIN_FRAMES 64  // smaller shards would evict pages that a single pool keeps
+#define IO_ALIGNMENT MIN_PAGE_SIZE // alignment of the buffers given to the datafile, a multiple of every logical block size
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024) // smaller frame arenas are mapped with regular pages
+#define MEMORY_MIN_SIZE (1024 * 1024)    // first reservation of the page arena of an in-memory database
+
+// BufferPool is a shard of the buffer pool: a share of the frames with their page_number -> frame hash table
+// and their replacement policy, all guarded by `lock`. pages are spread over the shards by the hash of their number.
+// each frame also has a latch, taken shared by readers while they copy the page out and exclusively by writers
+// while they change it, so that the lock of the shard isn't held during the copy.
+typedef struct BufferPool
+{
+    pthread_mutex_t lock;
+    CacheEntry *entries;
+    uint8_t *frames; // the pages of the entries, one after the other, a slice of the arena of the pager
+    pthread_rwlock_t *latches;
+    int *buckets;
+    int bucket_mask;
+    int capacity;
+    int count;     // frames handed out at least once
+    int free_head; // frames without a page, chained through `hash_next`
+    int flush_pins; // frames pinned by a flush until their pages are written or logged
+    int write_backs; // dirty victims being written back without the lock
+    int loads;       // `loading` frames
+    pthread_cond_t unpinned; // signalled when a flush releases its frames, a write-back ends or a frame is loaded
+    CachePolicy *policy;
+    CacheStats stats;
+} BufferPool;
+
+// FileMap is the read-only shared mapping of the datafile used in mmap mode.
+// it reserves more address space than the datafile needs so that the file can grow without remapping.
+typedef struct FileMap
+{
+    uint8_t *base;
+    size_t size;
+    int views; // pointers handed out by `view_page` that haven't been released yet
+    MmapAdvice advice;
+} FileMap;
+
+// Readahead follows the page numbers requested by `read_page_with_cache` to spot sequential scans.
+// pages up to `next_page` are already prefetched, reading `marker` triggers the next window.
+typedef struct Readahead
+{
+    int last_page;
+    int window;     // pages prefetched by the last window, 0 while no run is detected
+    int max_window;
+    int marker;
+    int next_page;
+} Readahead;
+
+// IoCounters collects the I/O of a pager that was opened with `collect_io_stats`.
+typedef struct IoCounters
+{
+    atomic_uint_fast64_t page_reads;
+    atomic_uint_fast64_t page_writes;
+    atomic_uint_fast64_t bytes_read;    // but those of the slots of a compressed datafile, counted by its codec
+    atomic_uint_fast64_t bytes_written;
+    atomic_uint_fast64_t syncs; // of the datafile by the pager, the log counts its own and those of checkpoints
+    LatencyRecorder read_latency;
+    LatencyRecorder write_latency;
+} IoCounters;
+
+// Pager is an open database: the datafile, its log and the buffer pool in front of them.
+// locks are taken in this order: `readahead_lock`, `lock`, the shard locks by increasing index, `map_lock`.
+// frame latches are only waited for while holding the lock of their own shard, or no lock for a write-back.
+struct Pager
+{
+    int fd;
+    char *path;
+    char *wal_path;
+    int page_size;
+    int bitmap_bits; // pages tracked by a bitmap page
+    bool direct_io;  // `fd` was switched to O_DIRECT
+    bool in_memory;  // the pages live in `memory` instead of a datafile, `fd` is -1
+    uint8_t *memory; // the page arena of an in-memory database, it grows and may move
+    size_t memory_size;
+    bool compressed;   // the datafile stores its pages through `codec`, all but the header page
+    PageCodec *codec;
+    pthread_mutex_t lock; // serializes the changes of the header and the bitmap pages, and the flushes
+    atomic_int file_pages; // pages backed by the datafile, including the preallocated extent
+    DatabaseHeader header;
+    bool header_dirty;
+    bool shrink_pending; // `vacuum_step` dropped pages at the end of the database, the datafile can be truncated
+    AsyncIO *aio;
+    Wal *wal;
+    atomic_bool wal_pending; // frames were logged by evictions since the last commit
+    int checkpoint_frames;
+    bool use_mmap;
+    pthread_mutex_t map_lock; // guards `file_map` and `memory`
+    FileMap file_map;
+    uint8_t *frame_arena; // the frames of every shard, in a single anonymous mapping
+    size_t arena_size;
+    bool arena_hugetlb; // the arena is made of explicit huge pages
+    BufferPool *shards;
+    int shard_count;
+    int shard_shift; // the top bits of the hash of a page number pick its shard
+    int shard_capacity;
+    pthread_mutex_t readahead_lock;
+    Readahead readahead;
+    atomic_int prefetch_evicted; // prefetched pages evicted unread since the last request
+    bool collect_io_stats;
+    IoCounters io;
+};
+
+static int pool_fetch(Pager *pager, BufferPool *pool, int page_number, bool load);
+static int load_page(Pager *pager, int page_number, Page *page);
+static int write_back(Pager *pager, CacheEntry *entry);
+static int checkpoint_log(Pager *pager);
+static int flush_pool(Pager *pager, int64_t *commit);
+static int init_bitmap_page(Pager *pager, int page_number);
+static int preallocate(Pager *pager, int page_count);
+
+static uint32_t page_hash(int page_number)
+{
+    return (uint32_t)page_number * 2654435761u;
+}
+
+// returns the shard that caches `page_number`.
+static BufferPool *pool_of(Pager *pager, int page_number)
+{
+    if (pager->shard_count == 1)
+    {
+        return &pager->shards[0];
+    }
+    return &pager->shards[page_hash(page_number) >> pager->shard_shift];
+}
+
+static int pool_bucket(const BufferPool *pool, int page_number)
+{
+    return (int)(page_hash(page_number) & (uint32_t)pool->bucket_mask);
+}
+
+static void pool_destroy(BufferPool *pool)
+{
+    if (pool->capacity > 0)
+    {
+        for (int i = 0; i < pool->capacity; i++)
+        {
+            pthread_rwlock_destroy(&pool->latches[i]);
+        }
+        pthread_cond_destroy(&pool->unpinned);
+        pthread_mutex_destroy(&pool->lock);
+    }
+    free(pool->entries);
+    free(pool->latches);
+    free(pool->buckets);
+    cache_policy_destroy(pool->policy);
+    *pool = (BufferPool){.free_head = -1};
+}
+
+// sets up a shard of `capacity` frames whose pages are stored at `frames`.
+static int pool_init(BufferPool *pool, uint8_t *frames, int capacity, int page_size, CachePolicyKind policy)
+{
+    int buckets = 1;
+    while (buckets < capacity * 2)
+    {
+        buckets <<= 1;
+    }
+
+    pool->entries = malloc(sizeof(CacheEntry) * capacity);
+    pool->frames = frames;
+    pool->latches = malloc(sizeof(pthread_rwlock_t) * capacity);
+    pool->buckets = malloc(sizeof(int) * buckets);
+    pool->policy = cache_policy_create(policy, capacity);
+    if (pool->entries == nullptr || pool->latches == nullptr || pool->buckets == nullptr || pool->policy == nullptr)
+    {
+        pool_destroy(pool);
+        return -1;
+    }
+
+    pthread_mutex_init(&pool->lock, nullptr);
+    pthread_cond_init(&pool->unpinned, nullptr);
+    for (int i = 0; i < buckets; i++)
+    {
+        pool->buckets[i] = -1;
+    }
+    for (int i = 0; i < capacity; i++)
+    {
+        pool->entries[i].data = pool->frames + (size_t)i * (size_t)page_size;
+        pool->entries[i].page_number = -1;
+        atomic_init(&pool->entries[i].pin_count, 0);
+        pool->entries[i].dirty = false;
+        pool->entries[i].prefetched = false;
+        pool->entries[i].loading = false;
+        pthread_rwlock_init(&pool->latches[i], nullptr);
+    }
+    pool->bucket_mask = buckets - 1;
+    pool->capacity = capacity;
+    pool->count = 0;
+    pool->free_head = -1;
+    pool->flush_pins = 0;
+    pool->write_backs = 0;
+    pool->loads = 0;
+    pool->stats = (CacheStats){0};
+    return 0;
+}
+
+// hands a frame that holds no page back to the pool, it is the first one reused.
+static void pool_release_frame(BufferPool *pool, int frame)
+{
+    pool->entries[frame].page_number = -1;
+    atomic_store(&pool->entries[frame].pin_count, 0);
+    pool->entries[frame].hash_next = pool->free_head;
+    pool->free_head = frame;
+}
+
+static void hash_insert(BufferPool *pool, int frame)
+{
+    int bucket = pool_bucket(pool, pool->entries[frame].page_number);
+    pool->entries[frame].hash_next = pool->buckets[bucket];
+    pool->buckets[bucket] = frame;
+}
+
+static void hash_remove(BufferPool *pool, int frame)
+{
+    int *link = &pool->buckets[pool_bucket(pool, pool->entries[frame].page_number)];
+    while (*link != -1)
+    {
+        if (*link == frame)
+        {
+            *link = pool->entries[frame].hash_next;
+            return;
+        }
+        link = &pool->entries[*link].hash_next;
+    }
+}
+
+// returns the frame of the shard holding `page_number`, or -1. the lock of the shard is held by the caller.
+static int pool_search(const BufferPool *pool, int page_number)
+{
+    if (pool->count == 0)
+    {
+        return -1;
+    }
 
-static FILE *db_file = NULL;
-static FreeList free_list = {{0}, 0};
-static CacheEntry cache[MAX_CACHE];
-static int cache_count = 0;
+    int frame = pool->buckets[pool_bucket(pool, page_number)];
+    while (frame != -1 && pool->entries[frame].page_number != page_number)
+    {
+        frame = pool->entries[frame].hash_next;
+    }
+    return frame;
+}
+
+static bool frame_is_evictable(int frame, void *context)
+{
+    const BufferPool *pool = context;
+    return atomic_load(&pool->entries[frame].pin_count) == 0;
+}
+
+static bool frame_is_clean(int frame, void *context)
+{
+    const BufferPool *pool = context;
+    return atomic_load(&pool->entries[frame].pin_count) == 0 && !pool->entries[frame].dirty;
+}
 
-int open_database()
+// returns a frame of the shard ready to receive `page_number`, evicting the unpinned page chosen by
+// the replacement policy if the shard is full. returns -1 with `errno` set to EBUSY when every frame is pinned,
+// or when `clean` is set and every unpinned frame is dirty.
+// a dirty victim is pinned and written back with the lock of the shard released, then evicted if it wasn't used
+// in the meantime: the caller looks for `page_number` again once it gets a frame.
+static int pool_take_frame(Pager *pager, BufferPool *pool, int page_number, bool clean)
 {
-    db_file = fopen(FILENAME, "r+b");
-    if (db_file == NULL)
+    if (pool->free_head != -1)
+    {
+        int frame = pool->free_head;
+        pool->free_head = pool->entries[frame].hash_next;
+        return frame;
+    }
+    if (pool->count < pool->capacity)
+    {
+        return pool->count++;
+    }
+
+    int victim;
+    CacheEntry *entry;
+    while (true)
     {
-        db_file = fopen(FILENAME, "w+b");
-        if (db_file == NULL)
+        victim = cache_policy_victim(pool->policy, page_number, clean ? frame_is_clean : frame_is_evictable, pool);
+        if (victim == -1)
+        {
+            errno = EBUSY;
+            return -1;
+        }
+        entry = &pool->entries[victim];
+        if (!entry->dirty)
+        {
+            break;
+        }
+
+        // the pin keeps the frame in place and the latch keeps writers out, a writer that comes after the copy
+        // marks the page dirty again.
+        atomic_fetch_add(&entry->pin_count, 1);
+        entry->dirty = false;
+        pool->write_backs++;
+        pthread_mutex_unlock(&pool->lock);
+        pthread_rwlock_rdlock(&pool->latches[victim]);
+        int result = write_back(pager, entry);
+        pthread_rwlock_unlock(&pool->latches[victim]);
+        pthread_mutex_lock(&pool->lock);
+        atomic_fetch_sub(&entry->pin_count, 1);
+        if (--pool->write_backs == 0)
         {
+            pthread_cond_broadcast(&pool->unpinned);
+        }
+        if (result != 0)
+        {
+            entry->dirty = true;
             return -1;
         }
+        if (atomic_load(&entry->pin_count) == 0 && !entry->dirty)
+        {
+            break;
+        }
+    }
+
+    cache_policy_evict(pool->policy, victim);
+    hash_remove(pool, victim);
+    entry->page_number = -1;
+    pool->stats.evictions++;
+    if (entry->prefetched)
+    {
+        // the scan didn't get that far, the next window is smaller.
+        entry->prefetched = false;
+        pool->stats.readahead_misses++;
+        atomic_fetch_add(&pager->prefetch_evicted, 1);
+    }
+    return victim;
+}
+
+// maps the frames of the buffer pool as one anonymous region, so that a large pool is backed by huge pages
+// and costs few TLB entries: explicit huge pages when some are reserved, otherwise 2 MB aligned memory that
+// the kernel is asked to back with transparent huge pages. frames start on a page boundary, O_DIRECT can use them.
+static int map_frame_arena(Pager *pager, size_t size)
+{
+    if (size < HUGE_PAGE_SIZE)
+    {
+        pager->frame_arena = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        pager->arena_size = size;
+        return pager->frame_arena == MAP_FAILED ? -1 : 0;
     }
 
-    // TODO: here we assume that all pages are free in the start of the server.
-    //       we need to load the current state of the pages into the free_list.
-    for (int i = 0; i < MAX_PAGES; i++)
+    size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    pager->arena_size = size;
+    pager->frame_arena = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (pager->frame_arena != MAP_FAILED)
     {
-        free_list.list[i] = i;
+        pager->arena_hugetlb = true;
+        return 0;
     }
-    free_list.count = MAX_PAGES;
 
-    // Initialize cache entries
-    for (int i = 0; i < MAX_CACHE; i++)
+    // a transparent huge page needs a 2 MB aligned range: map one more and trim both ends.
+    uint8_t *base = mmap(nullptr, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+    {
+        pager->frame_arena = MAP_FAILED;
+        return -1;
+    }
+    size_t head = (HUGE_PAGE_SIZE - (uintptr_t)base % HUGE_PAGE_SIZE) % HUGE_PAGE_SIZE;
+    if (head > 0)
     {
-        cache[i].page_number = -1;
+        munmap(base, head);
     }
-    
+    munmap(base + head + size, HUGE_PAGE_SIZE - head);
+    pager->frame_arena = base + head;
+    madvise(pager->frame_arena, size, MADV_HUGEPAGE); // only a hint, the kernel may not have huge pages to spare
     return 0;
 }
 
-int close_database()
+static int madvise_flag(MmapAdvice advice)
+{
+    switch (advice)
+    {
+    case MMAP_ADVICE_SEQUENTIAL:
+        return MADV_SEQUENTIAL;
+    case MMAP_ADVICE_RANDOM:
+        return MADV_RANDOM;
+    default:
+        return MADV_NORMAL;
+    }
+}
+
+// maps at least `needed` bytes of the datafile, growing the mapping in place when possible.
+// a mapping with outstanding views is never moved. returns -1 if the mapping couldn't be grown.
+static int map_datafile(Pager *pager, size_t needed)
 {
-    if (db_file != NULL)
+    size_t size = MMAP_MIN_SIZE;
+    while (size < needed)
+    {
+        size <<= 1;
+    }
+    if (pager->file_map.base != nullptr && size <= pager->file_map.size)
     {
-        fclose(db_file);
-        db_file = NULL;
         return 0;
     }
-    return -1;
+
+    uint8_t *base = MAP_FAILED;
+    if (pager->file_map.base != nullptr)
+    {
+        base = mremap(pager->file_map.base, pager->file_map.size, size, 0);
+        if (base == MAP_FAILED && pager->file_map.views > 0)
+        {
+            return -1;
+        }
+        if (base == MAP_FAILED)
+        {
+            munmap(pager->file_map.base, pager->file_map.size);
+            pager->file_map.base = nullptr;
+        }
+    }
+    if (base == MAP_FAILED)
+    {
+        base = mmap(nullptr, size, PROT_READ, MAP_SHARED, pager->fd, 0);
+        if (base == MAP_FAILED)
+        {
+            return -1;
+        }
+    }
+
+    pager->file_map.base = base;
+    pager->file_map.size = size;
+    madvise(pager->file_map.base, pager->file_map.size, madvise_flag(pager->file_map.advice));
+    return 0;
+}
+
+// returns the page inside the mapping, or nullptr when it has to be read with a system call:
+// not in mmap mode, past the end of the datafile or beyond a mapping that can't grow.
+// the caller holds `map_lock`.
+static const Page *mapped_page(Pager *pager, int page_number)
+{
+    if (pager->file_map.base == nullptr || page_number < 0 || page_number >= pager->file_pages)
+    {
+        return nullptr;
+    }
+    if (map_datafile(pager, (size_t)pager->file_pages * pager->page_size) != 0)
+    {
+        return nullptr;
+    }
+    return (const Page *)(pager->file_map.base + (size_t)page_number * pager->page_size);
+}
+
+static off_t page_offset(const Pager *pager, int page_number)
+{
+    return (off_t)page_number * pager->page_size;
 }
 
-int read_page(int page_number, Page *page)
+// makes room for `page_count` pages in the arena of an in-memory database. the arena is anonymous memory reserved
+// a power of two at a time: pages never written read as zeros and cost nothing until they are.
+// the caller holds `map_lock`.
+static int grow_memory(Pager *pager, int page_count)
 {
-    if (db_file == NULL)
+    size_t needed = (size_t)page_count * pager->page_size;
+    if (needed <= pager->memory_size)
+    {
+        return 0;
+    }
+    size_t size = pager->memory_size > 0 ? pager->memory_size : MEMORY_MIN_SIZE;
+    while (size < needed)
+    {
+        size <<= 1;
+    }
+
+    uint8_t *base;
+    if (pager->memory == nullptr)
+    {
+        base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    }
+    else
+    {
+        base = mremap(pager->memory, pager->memory_size, size, MREMAP_MAYMOVE);
+    }
+    if (base == MAP_FAILED)
     {
         return -1;
     }
-    fseek(db_file, page_number * PAGE_SIZE, SEEK_SET);
-    fread(page->data, PAGE_SIZE, 1, db_file);
+    pager->memory = base;
+    pager->memory_size = size;
     return 0;
 }
 
-int write_page(int page_number, const Page *page)
+// records that the datafile now extends at least up to `page_number`.
+static void note_file_extent(Pager *pager, int page_number)
+{
+    int pages = atomic_load(&pager->file_pages);
+    while (page_number >= pages && !atomic_compare_exchange_weak(&pager->file_pages, &pages, page_number + 1))
+    {
+    }
+}
+
+// releases everything `open_database` acquired and frees the pager. the dirty pages are expected to be
+// flushed already.
+static int release_database(Pager *pager)
+{
+    async_io_close(pager->aio);
+    wal_close(pager->wal);
+    page_codec_close(pager->codec);
+    if (pager->file_map.base != nullptr)
+    {
+        munmap(pager->file_map.base, pager->file_map.size);
+    }
+    for (int i = 0; pager->shards != nullptr && i < pager->shard_count; i++)
+    {
+        pool_destroy(&pager->shards[i]);
+    }
+    free(pager->shards);
+    if (pager->frame_arena != MAP_FAILED)
+    {
+        munmap(pager->frame_arena, pager->arena_size);
+    }
+    if (pager->memory != nullptr)
+    {
+        munmap(pager->memory, pager->memory_size);
+    }
+    pthread_mutex_destroy(&pager->lock);
+    pthread_mutex_destroy(&pager->map_lock);
+    pthread_mutex_destroy(&pager->readahead_lock);
+    int result = pager->fd == -1 ? 0 : close(pager->fd);
+    free(pager->path);
+    free(pager->wal_path);
+    free(pager);
+    return result == 0 ? 0 : -1;
+}
+
+static bool is_valid_page_size(int page_size)
+{
+    return page_size >= MIN_PAGE_SIZE && page_size <= MAX_PAGE_SIZE && (page_size & (page_size - 1)) == 0;
+}
+
+// picks the page size and the compression of the database: the ones recorded by the header of an existing
+// datafile, the ones of `options` for a new one. the header fits in the first `MIN_PAGE_SIZE` bytes whatever
+// the page size is.
+static int read_format(Pager *pager, const DatabaseOptions *options)
 {
-    if (db_file == NULL)
+    DatabaseHeader on_disk;
+    ssize_t done = pager->in_memory ? 0 : pread_full(pager->fd, &on_disk, sizeof(on_disk), 0);
+    if (done < 0)
+    {
+        return -1;
+    }
+    if (done == 0)
+    {
+        pager->page_size = options->page_size > 0 ? options->page_size : DEFAULT_PAGE_SIZE;
+        pager->compressed = options->use_compression && !pager->in_memory;
+    }
+    else if (done < (ssize_t)sizeof(on_disk) || memcmp(on_disk.magic, DATABASE_MAGIC, sizeof(on_disk.magic)) != 0 ||
+             on_disk.version != DATABASE_VERSION)
+    {
+        errno = EINVAL; // not a database, or a format this version doesn't know
+        return -1;
+    }
+    else
+    {
+        pager->page_size = (int)on_disk.page_size;
+        pager->compressed = (on_disk.flags & DATABASE_COMPRESSED) != 0;
+    }
+
+    if (!is_valid_page_size(pager->page_size))
     {
+        errno = EINVAL;
         return -1;
     }
-    fseek(db_file, page_number * PAGE_SIZE, SEEK_SET);
-    fwrite(page->data, PAGE_SIZE, 1, db_file);
+    pager->bitmap_bits = pager->page_size * 8;
     return 0;
 }
 
-int allocate_page(Page *page)
+// switches the datafile to O_DIRECT when its filesystem supports it with buffers and offsets aligned on
+// `IO_ALIGNMENT`. a filesystem that refuses it, such as an old tmpfs, keeps the buffered I/O without an error.
+static void enable_direct_io(Pager *pager)
 {
-    if (free_list.count == 0)
+#ifdef STATX_DIOALIGN
+    struct statx st;
+    if (statx(pager->fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &st) == 0 && (st.stx_mask & STATX_DIOALIGN) != 0 &&
+        (st.stx_dio_offset_align == 0 || st.stx_dio_offset_align > IO_ALIGNMENT || st.stx_dio_mem_align > IO_ALIGNMENT))
     {
-        return -1; // no free pages
+        return; // no direct I/O on this file, or blocks larger than a page
     }
-    int page_number = free_list.list[--free_list.count];
-    write_page(page_number, page);
-    return page_number;
+#endif
+    int flags = fcntl(pager->fd, F_GETFL);
+    pager->direct_io = flags != -1 && fcntl(pager->fd, F_SETFL, flags | O_DIRECT) == 0;
+}
+
+// loads the header page, or lays out the header and the first bitmap page of an empty datafile.
+static int load_header(Pager *pager)
+{
+    Page page;
+    if (load_page(pager, HEADER_PAGE, &page) != 0)
+    {
+        return -1;
+    }
+    memcpy(&pager->header, page.data, sizeof(DatabaseHeader));
+    pager->header_dirty = false;
+    if (memcmp(pager->header.magic, DATABASE_MAGIC, sizeof(pager->header.magic)) == 0)
+    {
+        return 0;
+    }
+    if (pager->file_pages > 0)
+    {
+        errno = EINVAL; // not a database
+        return -1;
+    }
+
+    memcpy(pager->header.magic, DATABASE_MAGIC, sizeof(pager->header.magic));
+    pager->header.version = DATABASE_VERSION;
+    pager->header.page_size = (uint32_t)pager->page_size;
+    pager->header.page_count = 2;
+    pager->header.free_count = 0;
+    pager->header.free_hint = 2;
+    pager->header.flags = pager->compressed ? DATABASE_COMPRESSED : 0;
+    pager->header_dirty = true;
+
+    // the header reaches the datafile before anything else, even in WAL mode:
+    // the page size has to be known to read the log back.
+    memset(page.data, 0, (size_t)pager->page_size);
+    memcpy(page.data, &pager->header, sizeof(DatabaseHeader));
+    if (write_page(pager, HEADER_PAGE, &page) != 0 || preallocate(pager, pager->header.page_count) != 0)
+    {
+        return -1;
+    }
+    return init_bitmap_page(pager, 1);
+}
+
+// opens the log next to the datafile. a log left behind by a crash is replayed into the datafile first
+// when the database isn't opened in WAL mode, and removed.
+static int open_log(Pager *pager, bool use_wal)
+{
+    if (pager->in_memory || (!use_wal && access(pager->wal_path, F_OK) != 0))
+    {
+        return 0;
+    }
+    pager->wal = wal_open(pager->wal_path, pager->page_size);
+    if (pager->wal == nullptr || use_wal)
+    {
+        return pager->wal == nullptr ? -1 : 0;
+    }
+
+    int result = checkpoint_log(pager);
+    wal_close(pager->wal);
+    pager->wal = nullptr;
+    return result == 0 ? unlink(pager->wal_path) : -1;
 }
 
-int free_page(int page_number)
+// opens and locks the datafile of the pager, recovers its log and sets up the I/O modes asked by `options`.
+static int open_datafile(Pager *pager, const DatabaseOptions *options)
 {
-    if (free_list.count == MAX_PAGES)
+    // a second pager on the same datafile would keep its own copy of the header and the bitmap pages.
+    pager->fd = open(pager->path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (pager->fd == -1 || flock(pager->fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        return -1;
+    }
+
+    if (read_format(pager, options) != 0)
+    {
+        return -1;
+    }
+    // the log is replayed through the codec, which has to know where the pages are first.
+    if (pager->compressed)
+    {
+        pager->use_mmap = false;
+        pager->codec = page_codec_open(pager->fd, pager->page_size, page_offset(pager, HEADER_PAGE + 1));
+        if (pager->codec == nullptr)
+        {
+            return -1;
+        }
+    }
+    struct stat st;
+    if (open_log(pager, options->use_wal) != 0 || fstat(pager->fd, &st) != 0)
+    {
+        return -1;
+    }
+    if (options->use_direct_io && !options->use_mmap && !pager->compressed)
+    {
+        enable_direct_io(pager);
+    }
+    pager->file_pages = (int)((st.st_size + pager->page_size - 1) / pager->page_size);
+
+    if (pager->use_mmap && map_datafile(pager, (size_t)pager->file_pages * pager->page_size) != 0)
     {
-        return -1; // all pages are free.
+        return -1;
     }
-    free_list.list[free_list.count++] = page_number;
     return 0;
 }
 
-int cache_search(int page_number)
+Pager *open_database(const char *path, const DatabaseOptions *options)
 {
-    if (cache_count > 0)
+    DatabaseOptions defaults = {0};
+    if (options == nullptr)
+    {
+        options = &defaults;
+    }
+    Pager *pager = calloc(1, sizeof(Pager));
+    if (pager == nullptr)
+    {
+        return nullptr;
+    }
+    pager->fd = -1;
+    pager->frame_arena = MAP_FAILED;
+    pthread_mutex_init(&pager->lock, nullptr);
+    pthread_mutex_init(&pager->map_lock, nullptr);
+    pthread_mutex_init(&pager->readahead_lock, nullptr);
+
+    int cache_size = options->cache_size > 0 ? options->cache_size : DEFAULT_CACHE_SIZE;
+    int shards = options->cache_shards > 0 ? options->cache_shards : DEFAULT_CACHE_SHARDS;
+    pager->shard_count = 1;
+    pager->shard_shift = 32;
+    while (pager->shard_count * 2 <= shards && pager->shard_count * 2 <= MAX_CACHE_SHARDS &&
+           cache_size / (pager->shard_count * 2) >= SHARD_MIN_FRAMES)
     {
-        for (int i = 0; i < cache_count; i++)
+        pager->shard_count *= 2;
+        pager->shard_shift--;
+    }
+    pager->shard_capacity = cache_size / pager->shard_count;
+    int max_window = options->readahead_pages != 0 ? options->readahead_pages : DEFAULT_READAHEAD_PAGES;
+    if (max_window > cache_size / 4)
+    {
+        max_window = cache_size / 4; // keep most of the pool for the pages in use
+    }
+    pager->readahead = (Readahead){-1, 0, max_window, -1, -1};
+    pager->checkpoint_frames = options->checkpoint_frames > 0 ? options->checkpoint_frames : DEFAULT_CHECKPOINT_FRAMES;
+    pager->in_memory = strcmp(path, MEMORY_DATABASE) == 0;
+    pager->use_mmap = options->use_mmap && !pager->in_memory;
+    pager->collect_io_stats = options->collect_io_stats;
+    pager->file_map = (FileMap){nullptr, 0, 0, options->mmap_advice};
+
+    pager->path = strdup(path);
+    pager->wal_path = malloc(strlen(path) + sizeof(WAL_SUFFIX));
+    if (pager->path == nullptr || pager->wal_path == nullptr)
+    {
+        release_database(pager);
+        return nullptr;
+    }
+    strcpy(pager->wal_path, path);
+    strcat(pager->wal_path, WAL_SUFFIX);
+
+    if (pager->in_memory ? read_format(pager, options) != 0 : open_datafile(pager, options) != 0)
+    {
+        release_database(pager);
+        return nullptr;
+    }
+
+    size_t shard_bytes = (size_t)pager->shard_capacity * (size_t)pager->page_size;
+    pager->shards = calloc(pager->shard_count, sizeof(BufferPool));
+    if (pager->shards == nullptr || map_frame_arena(pager, shard_bytes * (size_t)pager->shard_count) != 0)
+    {
+        release_database(pager);
+        return nullptr;
+    }
+    for (int i = 0; i < pager->shard_count; i++)
+    {
+        uint8_t *frames = pager->frame_arena + (size_t)i * shard_bytes;
+        if (pool_init(&pager->shards[i], frames, pager->shard_capacity, pager->page_size, options->cache_policy) != 0)
         {
-            if (cache[i].page_number == page_number)
-            {
-                return i;
-            }
+            release_database(pager);
+            return nullptr;
         }
     }
-    return -1;
-} 
 
-int read_page_with_cache(int page_number, Page *page)
+    if (!pager->in_memory && !pager->compressed)
+    {
+        pager->aio = async_io_open(pager->fd, pager->page_size, options->io_queue_depth, options->io_backend);
+    }
+    if ((pager->aio == nullptr && !pager->in_memory && !pager->compressed) || load_header(pager) != 0)
+    {
+        release_database(pager);
+        return nullptr;
+    }
+
+    return pager;
+}
+
+int close_database(Pager *pager)
 {
-    int page_index = cache_search(page_number);
-    if (page_index != -1) {
-        *page = cache[page_index].page;
-        return 0;
+    if (pager == nullptr)
+    {
+        return -1;
     }
 
-    int result = read_page(page_number, page);
-    if (cache_count < MAX_CACHE)
+    int result = flush_dirty_pages(pager);
+    if (result == 0 && pager->wal != nullptr)
+    {
+        // the log isn't needed once everything is in the datafile.
+        result = checkpoint_log(pager) == 0 && unlink(pager->wal_path) == 0 ? 0 : -1;
+    }
+    if (release_database(pager) != 0)
     {
-        cache[cache_count++] = (CacheEntry){*page, page_number};
+        result = -1;
     }
     return result;
 }
 
-int write_page_with_cache(int page_number, const Page *page)
+// returns the start time of an I/O to count, 0 when the pager doesn't collect statistics.
+static uint64_t io_start(const Pager *pager)
 {
-    if (cache_count < MAX_CACHE)
+    return pager->collect_io_stats ? monotonic_ns() : 0;
+}
+
+// counts `pages` pages read since `start`, returned by `io_start`, which transferred `bytes`.
+static void count_reads(Pager *pager, int pages, ssize_t bytes, uint64_t start)
+{
+    if (pager->collect_io_stats)
     {
-        int page_index = cache_search(page_number);
-        if (page_index != -1) 
-        {
-            cache[page_index].page = *page;
+        latency_record(&pager->io.read_latency, monotonic_ns() - start);
+        atomic_fetch_add_explicit(&pager->io.page_reads, (uint_fast64_t)pages, memory_order_relaxed);
+        atomic_fetch_add_explicit(&pager->io.bytes_read, (uint_fast64_t)bytes, memory_order_relaxed);
+    }
+}
+
+// counts `pages` pages written since `start`, returned by `io_start`, which transferred `bytes`.
+static void count_writes(Pager *pager, int pages, ssize_t bytes, uint64_t start)
+{
+    if (pager->collect_io_stats)
+    {
+        latency_record(&pager->io.write_latency, monotonic_ns() - start);
+        atomic_fetch_add_explicit(&pager->io.page_writes, (uint_fast64_t)pages, memory_order_relaxed);
+        atomic_fetch_add_explicit(&pager->io.bytes_written, (uint_fast64_t)bytes, memory_order_relaxed);
+    }
+}
+
+// makes the datafile durable and counts the fsync.
+static int sync_datafile(Pager *pager)
+{
+    int result = pager->codec != nullptr ? page_codec_sync(pager->codec) : fdatasync(pager->fd);
+    if (result == 0 && pager->collect_io_stats)
+    {
+        atomic_fetch_add_explicit(&pager->io.syncs, 1, memory_order_relaxed);
+    }
+    return result;
+}
+
+// writes the `count` pages of `iov` into the datafile starting at `page_number`, or into the arena of an
+// in-memory database. `iov` is used up by the write.
+static int write_run(Pager *pager, int page_number, struct iovec *iov, int count)
+{
+    if (pager->codec != nullptr)
+    {
+        // every page gets a slot of its own, there is no run on disk.
+        for (int i = 0; i < count; i++)
+        {
+            if (write_page(pager, page_number + i, iov[i].iov_base) != 0)
+            {
+                return -1;
+            }
+        }
+        return 0;
+    }
+    uint64_t start = io_start(pager);
+    if (!pager->in_memory)
+    {
+        if (pwritev_full(pager->fd, iov, count, page_offset(pager, page_number)) != 0)
+        {
+            return -1;
+        }
+        count_writes(pager, count, (ssize_t)count * pager->page_size, start);
+        note_file_extent(pager, page_number + count - 1);
+        return 0;
+    }
+
+    pthread_mutex_lock(&pager->map_lock);
+    int result = grow_memory(pager, page_number + count);
+    for (int i = 0; i < count && result == 0; i++)
+    {
+        memcpy(pager->memory + (size_t)page_offset(pager, page_number + i), iov[i].iov_base, pager->page_size);
+    }
+    pthread_mutex_unlock(&pager->map_lock);
+    if (result == 0)
+    {
+        count_writes(pager, count, (ssize_t)count * pager->page_size, start);
+        note_file_extent(pager, page_number + count - 1);
+    }
+    return result;
+}
+
+bool uses_direct_io(Pager *pager)
+{
+    return pager != nullptr && pager->direct_io;
+}
+
+// returns a buffer the datafile can be read into or written from for the page at `data`: `data` itself,
+// or in direct I/O mode an aligned buffer to free when `data` isn't aligned. returns nullptr if none could be allocated.
+static uint8_t *io_buffer(const Pager *pager, const uint8_t *data)
+{
+    if (!pager->direct_io || (uintptr_t)data % IO_ALIGNMENT == 0)
+    {
+        return (uint8_t *)data;
+    }
+    void *buffer;
+    if (posix_memalign(&buffer, IO_ALIGNMENT, (size_t)pager->page_size) != 0)
+    {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    return buffer;
+}
+
+// reads a page from where it is stored and returns the number of bytes that took, 0 for a page that was never
+// written or one of a compressed datafile, whose codec counts its own. returns -1 on error.
+static ssize_t read_stored_page(Pager *pager, int page_number, Page *page)
+{
+    if (pager->in_memory)
+    {
+        // like past the end of a datafile, pages beyond the arena have never been written and read as zeros.
+        pthread_mutex_lock(&pager->map_lock);
+        size_t offset = (size_t)page_offset(pager, page_number);
+        bool stored = offset < pager->memory_size;
+        if (stored)
+        {
+            memcpy(page->data, pager->memory + offset, pager->page_size);
+        }
+        else
+        {
+            memset(page->data, 0, pager->page_size);
+        }
+        pthread_mutex_unlock(&pager->map_lock);
+        return stored ? pager->page_size : 0;
+    }
+    if (pager->codec != nullptr && page_number != HEADER_PAGE)
+    {
+        return page_codec_read(pager->codec, page_number, page->data);
+    }
+    if (pager->use_mmap)
+    {
+        pthread_mutex_lock(&pager->map_lock);
+        const Page *mapped = mapped_page(pager, page_number);
+        if (mapped != nullptr)
+        {
+            memcpy(page->data, mapped->data, pager->page_size);
+        }
+        pthread_mutex_unlock(&pager->map_lock);
+        if (mapped != nullptr)
+        {
+            return pager->page_size;
+        }
+    }
+
+    uint8_t *buffer = io_buffer(pager, page->data);
+    if (buffer == nullptr)
+    {
+        return -1;
+    }
+    ssize_t done = pread_full(pager->fd, buffer, pager->page_size, page_offset(pager, page_number));
+    if (buffer != page->data)
+    {
+        if (done > 0)
+        {
+            memcpy(page->data, buffer, (size_t)done);
+        }
+        free(buffer);
+    }
+    if (done < 0)
+    {
+        return -1;
+    }
+    if (done == 0)
+    {
+        // the page lies past the end of the datafile, it has never been written.
+        memset(page->data, 0, pager->page_size);
+    }
+    else if (done < pager->page_size)
+    {
+        errno = EIO; // truncated page
+        return -1;
+    }
+    return done;
+}
+
+int read_page(Pager *pager, int page_number, Page *page)
+{
+    if (pager == nullptr || page_number < 0)
+    {
+        return -1;
+    }
+    uint64_t start = io_start(pager);
+    ssize_t bytes = read_stored_page(pager, page_number, page);
+    if (bytes < 0)
+    {
+        return -1;
+    }
+    count_reads(pager, 1, bytes, start);
+    return 0;
+}
+
+int write_page(Pager *pager, int page_number, const Page *page)
+{
+    if (pager == nullptr || page_number < 0)
+    {
+        return -1;
+    }
+    if (pager->in_memory)
+    {
+        struct iovec iov = {(void *)page->data, pager->page_size};
+        return write_run(pager, page_number, &iov, 1);
+    }
+    uint64_t start = io_start(pager);
+    if (pager->codec != nullptr && page_number != HEADER_PAGE)
+    {
+        if (page_codec_write(pager->codec, page_number, page->data) != 0)
+        {
+            return -1;
+        }
+        count_writes(pager, 1, 0, start); // the codec counts the bytes of the slot
+        note_file_extent(pager, page_number);
+        return 0;
+    }
+    uint8_t *buffer = io_buffer(pager, page->data);
+    if (buffer == nullptr)
+    {
+        return -1;
+    }
+    if (buffer != page->data)
+    {
+        memcpy(buffer, page->data, pager->page_size);
+    }
+    int result = pwrite_full(pager->fd, buffer, pager->page_size, page_offset(pager, page_number));
+    if (buffer != page->data)
+    {
+        free(buffer);
+    }
+    if (result != 0)
+    {
+        return -1;
+    }
+    count_writes(pager, 1, pager->page_size, start);
+    note_file_extent(pager, page_number);
+    return 0;
+}
+
+// reads the newest image of a page: from the log when it holds the page, from the datafile otherwise.
+static int load_page(Pager *pager, int page_number, Page *page)
+{
+    if (pager->wal != nullptr)
+    {
+        int logged = wal_read_page(pager->wal, page_number, page->data);
+        if (logged != 0)
+        {
+            return logged == 1 ? 0 : -1;
+        }
+    }
+    return read_page(pager, page_number, page);
+}
+
+// writes an evicted dirty frame out. in WAL mode the page is logged without a commit:
+// it is visible to this process but only survives a crash with the next commit.
+static int write_back(Pager *pager, CacheEntry *entry)
+{
+    if (pager->wal == nullptr)
+    {
+        return write_page(pager, entry->page_number, (const Page *)entry->data);
+    }
+    const uint8_t *data = entry->data;
+    if (wal_append(pager->wal, &entry->page_number, &data, 1, false) == -1)
+    {
+        return -1;
+    }
+    atomic_store(&pager->wal_pending, true);
+    return 0;
+}
+
+// returns the bitmap page that tracks `page_number`.
+static int bitmap_page_of(const Pager *pager, int page_number)
+{
+    return 1 + (page_number - 1) / pager->bitmap_bits * pager->bitmap_bits;
+}
+
+static bool is_bitmap_page(const Pager *pager, int page_number)
+{
+    return page_number > HEADER_PAGE && (page_number - 1) % pager->bitmap_bits == 0;
+}
+
+// reserves the space of the datafile up to `page_count` pages, a whole extent at a time.
+static int preallocate(Pager *pager, int page_count)
+{
+    if (page_count <= pager->file_pages)
+    {
+        return 0;
+    }
+
+    // extents grow with the database so that big files don't pay a system call every few pages.
+    int extent = pager->file_pages / 8 > EXTENT_PAGES ? pager->file_pages / 8 : EXTENT_PAGES;
+    int target = pager->file_pages + extent;
+    if (target < page_count)
+    {
+        target = page_count;
+    }
+
+    off_t offset = page_offset(pager, pager->file_pages);
+    off_t length = page_offset(pager, target) - offset;
+    if (pager->in_memory || pager->compressed)
+    {
+        // the arena or the slots grow when the pages are written, reserving space up front buys nothing.
+        note_file_extent(pager, target - 1);
+        return 0;
+    }
+    if (fallocate(pager->fd, 0, offset, length) != 0)
+    {
+        // filesystems without fallocate still get a file of the right size, just sparse.
+        if ((errno != EOPNOTSUPP && errno != ENOSYS) || ftruncate(pager->fd, page_offset(pager, target)) != 0)
+        {
+            return -1;
+        }
+    }
+    note_file_extent(pager, target - 1);
+    return 0;
+}
+
+// sets or clears the bits of the `count` pages starting at `first`, which are tracked by the same bitmap page.
+// returns how many of those bits were set before, or -1 if the bitmap couldn't be loaded.
+static int bitmap_set_range(Pager *pager, int first, int count, bool used)
+{
+    int bitmap = bitmap_page_of(pager, first);
+    Page *page = pin_page(pager, bitmap);
+    if (page == nullptr)
+    {
+        return -1;
+    }
+
+    int was_used = 0;
+    for (int bit = first - bitmap; bit < first - bitmap + count; bit++)
+    {
+        uint8_t mask = (uint8_t)(1u << (bit % 8));
+        if (page->data[bit / 8] & mask)
+        {
+            was_used++;
+        }
+        if (used)
+        {
+            page->data[bit / 8] |= mask;
+        }
+        else
+        {
+            page->data[bit / 8] &= (uint8_t)~mask;
+        }
+    }
+    unpin_page(pager, bitmap, was_used != (used ? count : 0));
+    return was_used;
+}
+
+// lays out an empty bitmap page that only marks itself as used.
+static int init_bitmap_page(Pager *pager, int page_number)
+{
+    Page page = {0};
+    page.data[0] = 1;
+    return write_page_with_cache(pager, page_number, &page);
+}
+
+// grows the database up to `page_count` pages.
+static int grow_database(Pager *pager, int page_count)
+{
+    if (preallocate(pager, page_count) != 0)
+    {
+        return -1;
+    }
+    pager->header.page_count = (uint32_t)page_count;
+    pager->header_dirty = true;
+    return 0;
+}
+
+// grows the database by a run of `count` contiguous pages, marks them as used and returns the first one.
+// a run never spans a bitmap page: when the pages left before the next bitmap page are too few
+// they are kept as free pages and the run starts after the bitmap page.
+static int append_run(Pager *pager, int count)
+{
+    while (true)
+    {
+        int first = (int)pager->header.page_count;
+        if (first > INT_MAX - count - 1)
+        {
+            return -1;
+        }
+
+        if (is_bitmap_page(pager, first))
+        {
+            if (grow_database(pager, first + 1) != 0 || init_bitmap_page(pager, first) != 0)
+            {
+                return -1;
+            }
+            continue;
+        }
+
+        int next_bitmap = bitmap_page_of(pager, first) + pager->bitmap_bits;
+        if (first + count > next_bitmap)
+        {
+            if (grow_database(pager, next_bitmap) != 0)
+            {
+                return -1;
+            }
+            pager->header.free_count += (uint32_t)(next_bitmap - first);
+            if ((uint32_t)first < pager->header.free_hint)
+            {
+                pager->header.free_hint = (uint32_t)first;
+            }
+            continue;
+        }
+
+        if (grow_database(pager, first + count) != 0)
+        {
+            return -1;
+        }
+        if (bitmap_set_range(pager, first, count, true) == -1)
+        {
+            // the bitmap page can't be loaded, the pages are in the datafile now and stay there as free ones
+            pager->header.free_count += (uint32_t)count;
+            if ((uint32_t)first < pager->header.free_hint)
+            {
+                pager->header.free_hint = (uint32_t)first;
+            }
+            return -1;
+        }
+        return first;
+    }
+}
+
+// returns the first page of the lowest run of `count` free pages below `page_count`, or -1 if there is none.
+// `lowest_free` receives the lowest free page met on the way, -1 if there was none.
+static int find_free_run(Pager *pager, int count, int *lowest_free)
+{
+    *lowest_free = -1;
+    int page_number = (int)pager->header.free_hint;
+    while (page_number < (int)pager->header.page_count)
+    {
+        int bitmap = bitmap_page_of(pager, page_number);
+        const Page *page = pin_page(pager, bitmap);
+        if (page == nullptr)
+        {
+            return -1;
+        }
+
+        int last = bitmap + pager->bitmap_bits;
+        if (last > (int)pager->header.page_count)
+        {
+            last = (int)pager->header.page_count;
+        }
+        int run_start = -1;
+        int found = -1;
+        for (int p = page_number; p < last && found == -1; p++)
+        {
+            int bit = p - bitmap;
+            if (bit % 8 == 0 && page->data[bit / 8] == 0xFF && p + 7 < last)
+            {
+                run_start = -1;
+                p += 7; // skip a byte of used pages at once
+                continue;
+            }
+            if (page->data[bit / 8] & (1u << (bit % 8)))
+            {
+                run_start = -1;
+                continue;
+            }
+
+            if (*lowest_free == -1)
+            {
+                *lowest_free = p;
+            }
+            if (run_start == -1)
+            {
+                run_start = p;
+            }
+            if (p - run_start + 1 == count)
+            {
+                found = run_start;
+            }
+        }
+        unpin_page(pager, bitmap, false);
+        if (found != -1)
+        {
+            return found;
+        }
+        page_number = last;
+    }
+    return -1;
+}
+
+// allocates a run of `count` pages, the caller holds the lock of the pager.
+static int allocate_run(Pager *pager, int count)
+{
+    int lowest_free = -1;
+    int first = -1;
+    if (pager->header.free_count >= (uint32_t)count)
+    {
+        first = find_free_run(pager, count, &lowest_free);
+    }
+    if (lowest_free != -1)
+    {
+        pager->header.free_hint = (uint32_t)lowest_free;
+        pager->header_dirty = true;
+    }
+    if (first == -1)
+    {
+        return append_run(pager, count);
+    }
+
+    if (bitmap_set_range(pager, first, count, true) == -1)
+    {
+        return -1;
+    }
+    pager->header.free_count -= (uint32_t)count;
+    if (first == lowest_free)
+    {
+        pager->header.free_hint = (uint32_t)(first + count);
+    }
+    pager->header_dirty = true;
+    return first;
+}
+
+int allocate_pages(Pager *pager, int count)
+{
+    if (pager == nullptr || count <= 0 || count >= pager->bitmap_bits)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&pager->lock);
+    int first = allocate_run(pager, count);
+    pthread_mutex_unlock(&pager->lock);
+    return first;
+}
+
+int allocate_page(Pager *pager, Page *page)
+{
+    int page_number = allocate_pages(pager, 1);
+    if (page_number == -1)
+    {
+        return -1; // no space left
+    }
+    if (write_page_with_cache(pager, page_number, page) != 0)
+    {
+        return -1;
+    }
+    return page_number;
+}
+
+// frees a page, the caller holds the lock of the pager. returns -1 if the page wasn't in use.
+static int release_page(Pager *pager, int page_number)
+{
+    int was_used = page_number < (int)pager->header.page_count ? bitmap_set_range(pager, page_number, 1, false) : 0;
+    if (was_used != 1)
+    {
+        return -1; // not in use, or already free
+    }
+    pager->header.free_count++;
+    if ((uint32_t)page_number < pager->header.free_hint)
+    {
+        pager->header.free_hint = (uint32_t)page_number;
+    }
+    pager->header_dirty = true;
+    return 0;
+}
+
+int free_page(Pager *pager, int page_number)
+{
+    if (pager == nullptr || page_number <= HEADER_PAGE || is_bitmap_page(pager, page_number))
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&pager->lock);
+    int result = release_page(pager, page_number);
+    pthread_mutex_unlock(&pager->lock);
+    return result;
+}
+
+// returns 1 if the bitmap marks `page_number` as used, 0 if it is free, -1 if the bitmap couldn't be loaded.
+static int page_in_use(Pager *pager, int page_number)
+{
+    int bitmap = bitmap_page_of(pager, page_number);
+    const Page *page = pin_page(pager, bitmap);
+    if (page == nullptr)
+    {
+        return -1;
+    }
+    int bit = page_number - bitmap;
+    int used = (page->data[bit / 8] >> (bit % 8)) & 1;
+    unpin_page(pager, bitmap, false);
+    return used;
+}
+
+// returns true if a caller holds `page_number` pinned.
+static bool page_is_pinned(Pager *pager, int page_number)
+{
+    BufferPool *pool = pool_of(pager, page_number);
+    pthread_mutex_lock(&pool->lock);
+    int frame = pool_search(pool, page_number);
+    bool pinned = frame != -1 && atomic_load(&pool->entries[frame].pin_count) > 0;
+    pthread_mutex_unlock(&pool->lock);
+    return pinned;
+}
+
+// returns true while pointers into the mapping handed out by `view_page` haven't been released: the pages they
+// show must stay where they are.
+static bool has_views(Pager *pager)
+{
+    pthread_mutex_lock(&pager->map_lock);
+    bool views = pager->file_map.views > 0;
+    pthread_mutex_unlock(&pager->map_lock);
+    return views;
+}
+
+// drops `page_number` from the buffer pool without writing it back, its content is no longer needed.
+// returns -1 if the page is pinned.
+static int discard_page(Pager *pager, int page_number)
+{
+    BufferPool *pool = pool_of(pager, page_number);
+    pthread_mutex_lock(&pool->lock);
+    int frame = pool_search(pool, page_number);
+    if (frame != -1 && atomic_load(&pool->entries[frame].pin_count) > 0)
+    {
+        pthread_mutex_unlock(&pool->lock);
+        return -1;
+    }
+    if (frame != -1)
+    {
+        pool->entries[frame].dirty = false;
+        pool->entries[frame].prefetched = false;
+        cache_policy_evict(pool->policy, frame);
+        hash_remove(pool, frame);
+        pool_release_frame(pool, frame);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+// returns the space of the pages past the end of the database to the filesystem, or to the kernel for an
+// in-memory database. the slots of a compressed datafile are only reused.
+static int shrink_datafile(Pager *pager)
+{
+    int page_count = (int)pager->header.page_count;
+    if (!pager->shrink_pending || pager->compressed)
+    {
+        return 0;
+    }
+    pthread_mutex_lock(&pager->map_lock);
+    if (pager->file_map.views > 0)
+    {
+        // a view past the new end would fault once the file is cut, a later vacuum or checkpoint shrinks it.
+        pthread_mutex_unlock(&pager->map_lock);
+        return 0;
+    }
+    pager->shrink_pending = false;
+    atomic_store(&pager->file_pages, page_count);
+    size_t end = (size_t)page_offset(pager, page_count);
+    int result = 0;
+    if (pager->in_memory)
+    {
+        result = end < pager->memory_size ? madvise(pager->memory + end, pager->memory_size - end, MADV_DONTNEED) : 0;
+    }
+    else
+    {
+        result = ftruncate(pager->fd, (off_t)end);
+    }
+    pthread_mutex_unlock(&pager->map_lock);
+    return result;
+}
+
+// copies the live page `from` into the free page `to`, tells `mover` and frees `from`.
+// the caller holds the lock of the pager.
+static int move_page(Pager *pager, int from, int to, PageMover mover, void *context)
+{
+    const Page *source = pin_page(pager, from);
+    if (source == nullptr)
+    {
+        return -1;
+    }
+    int result = write_page_with_cache(pager, to, source);
+    unpin_page(pager, from, false);
+    if (result == 0 && mover != nullptr)
+    {
+        result = mover(context, from, to);
+    }
+    if (result != 0)
+    {
+        release_page(pager, to);
+        return -1;
+    }
+    return release_page(pager, from);
+}
+
+// removes the last page of the database when it is free, or a bitmap page with nothing after it.
+// returns 1 if it was removed, 0 if it is in use and -1 on error.
+static int trim_last_page(Pager *pager)
+{
+    int last = (int)pager->header.page_count - 1;
+    bool bitmap = is_bitmap_page(pager, last);
+    int used = bitmap ? 0 : page_in_use(pager, last);
+    if (used != 0)
+    {
+        return used == 1 ? 0 : -1;
+    }
+    if (discard_page(pager, last) != 0)
+    {
+        return 0; // someone still holds the page
+    }
+    // the log and the slots of a compressed datafile outlive the truncation: a page they hold is zeroed, so that
+    // it reads as zeros once it is appended again.
+    if (pager->codec != nullptr || (pager->wal != nullptr && wal_contains(pager->wal, last)))
+    {
+        Page *page = pin_page(pager, last);
+        if (page == nullptr)
+        {
+            return -1;
+        }
+        memset(page->data, 0, pager->page_size);
+        unpin_page(pager, last, true);
+    }
+    pager->header.page_count--;
+    pager->shrink_pending = true;
+    if (!bitmap)
+    {
+        pager->header.free_count--;
+    }
+    if (pager->header.free_hint > pager->header.page_count)
+    {
+        pager->header.free_hint = pager->header.page_count;
+    }
+    pager->header_dirty = true;
+    return 1;
+}
+
+int vacuum_step(Pager *pager, int max_pages, PageMover mover, void *context)
+{
+    if (pager == nullptr || max_pages <= 0)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&pager->lock);
+    int done = 0;
+    int result = 0;
+    // the header and the first bitmap page always stay.
+    while (done < max_pages && pager->header.page_count > 2 && !has_views(pager))
+    {
+        int trimmed = trim_last_page(pager);
+        if (trimmed != 0)
+        {
+            result = trimmed == -1 ? -1 : 0;
+            if (trimmed == -1)
+            {
+                break;
+            }
+            done++;
+            continue;
+        }
+
+        // the last page is live: it moves to the lowest free page, then it is trimmed as a free page.
+        int last = (int)pager->header.page_count - 1;
+        int lowest_free = -1;
+        if (pager->header.free_count > 0)
+        {
+            find_free_run(pager, 1, &lowest_free);
+        }
+        if (lowest_free == -1 || lowest_free > last || page_is_pinned(pager, last))
+        {
+            break;
+        }
+        int to = allocate_run(pager, 1);
+        if (to == -1 || move_page(pager, last, to, mover, context) != 0)
+        {
+            result = -1;
+            break;
+        }
+        done++;
+    }
+    if (result == 0 && pager->wal == nullptr && pager->shrink_pending && !pager->in_memory && !pager->compressed)
+    {
+        // the moved pages, the header and the bitmaps reach the disk before the pages they replace are cut off.
+        int64_t commit;
+        result = flush_pool(pager, &commit) == 0 && sync_datafile(pager) == 0 ? 0 : -1;
+    }
+    if (result == 0 && pager->wal == nullptr)
+    {
+        // with a log, the datafile shrinks when the log is checkpointed.
+        result = shrink_datafile(pager);
+    }
+    pthread_mutex_unlock(&pager->lock);
+    return result == 0 ? done : -1;
+}
+
+DatabaseHeader database_header(Pager *pager)
+{
+    pthread_mutex_lock(&pager->lock);
+    DatabaseHeader copy = pager->header;
+    pthread_mutex_unlock(&pager->lock);
+    return copy;
+}
+
+int cache_search(Pager *pager, int page_number)
+{
+    int shard = pager->shard_count == 1 ? 0 : (int)(page_hash(page_number) >> pager->shard_shift);
+    BufferPool *pool = &pager->shards[shard];
+    pthread_mutex_lock(&pool->lock);
+    int frame = pool_search(pool, page_number);
+    pthread_mutex_unlock(&pool->lock);
+    return frame == -1 ? -1 : shard * pager->shard_capacity + frame;
+}
+
+// returns the pinned frame of the shard holding `page_number`, or -1 if no frame could be used.
+// a missing page is read with the lock of the shard released, its frame is installed as `loading` beforehand.
+// when `load` is false a missing page isn't read from the datafile because the caller overwrites it entirely
+// before it releases the lock of the shard, which the caller holds. a miss that finds every frame pinned waits
+// while a flush, a write-back or a load holds some of them, they are released as soon as their I/O is done.
+static int pool_fetch(Pager *pager, BufferPool *pool, int page_number, bool load)
+{
+    int frame;
+    while (true)
+    {
+        frame = pool_search(pool, page_number);
+        if (frame != -1 && pool->entries[frame].loading)
+        {
+            pthread_cond_wait(&pool->unpinned, &pool->lock);
+            continue;
+        }
+        if (frame != -1)
+        {
+            pool->stats.hits++;
+            if (pool->entries[frame].prefetched)
+            {
+                // the first request of a prefetched page is its first use, not a sign that the page is hot.
+                pool->entries[frame].prefetched = false;
+                pool->stats.readahead_hits++;
+            }
+            else
+            {
+                cache_policy_touch(pool->policy, frame);
+            }
+            atomic_fetch_add(&pool->entries[frame].pin_count, 1);
+            return frame;
+        }
+        frame = pool_take_frame(pager, pool, page_number, false);
+        if (frame != -1 && pool_search(pool, page_number) != -1)
+        {
+            // another thread cached the page while a victim was written back.
+            pool_release_frame(pool, frame);
+            continue;
+        }
+        if (frame != -1 || errno != EBUSY || pool->flush_pins + pool->write_backs + pool->loads == 0)
+        {
+            break;
+        }
+        pthread_cond_wait(&pool->unpinned, &pool->lock);
+    }
+
+    pool->stats.misses++;
+    if (frame == -1)
+    {
+        return -1;
+    }
+
+    CacheEntry *entry = &pool->entries[frame];
+    entry->page_number = page_number;
+    atomic_store(&entry->pin_count, 1);
+    entry->dirty = false;
+    entry->prefetched = false;
+    hash_insert(pool, frame);
+    cache_policy_insert(pool->policy, frame, page_number);
+    if (!load)
+    {
+        return frame;
+    }
+
+    entry->loading = true;
+    pool->loads++;
+    pthread_mutex_unlock(&pool->lock);
+    int result = load_page(pager, page_number, (Page *)entry->data);
+    pthread_mutex_lock(&pool->lock);
+    entry->loading = false;
+    pool->loads--;
+    pthread_cond_broadcast(&pool->unpinned);
+    if (result != 0)
+    {
+        cache_policy_evict(pool->policy, frame);
+        hash_remove(pool, frame);
+        pool_release_frame(pool, frame);
+        return -1;
+    }
+    return frame;
+}
+
+Page *pin_page(Pager *pager, int page_number)
+{
+    if (pager == nullptr)
+    {
+        return nullptr;
+    }
+
+    BufferPool *pool = pool_of(pager, page_number);
+    pthread_mutex_lock(&pool->lock);
+    int frame = pool_fetch(pager, pool, page_number, true);
+    pthread_mutex_unlock(&pool->lock);
+    if (frame == -1)
+    {
+        return nullptr;
+    }
+    return (Page *)pool->entries[frame].data;
+}
+
+int unpin_page(Pager *pager, int page_number, bool dirty)
+{
+    BufferPool *pool = pool_of(pager, page_number);
+    pthread_mutex_lock(&pool->lock);
+    int frame = pool_search(pool, page_number);
+    if (frame == -1 || atomic_load(&pool->entries[frame].pin_count) == 0)
+    {
+        pthread_mutex_unlock(&pool->lock);
+        return -1;
+    }
+
+    CacheEntry *entry = &pool->entries[frame];
+    entry->dirty = entry->dirty || dirty;
+    atomic_fetch_sub(&entry->pin_count, 1);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+static void lock_shards(Pager *pager, uint64_t locked)
+{
+    for (int shard = 0; shard < pager->shard_count; shard++)
+    {
+        if (locked & (UINT64_C(1) << shard))
+        {
+            pthread_mutex_lock(&pager->shards[shard].lock);
+        }
+    }
+}
+
+static void unlock_shards(Pager *pager, uint64_t locked)
+{
+    for (int shard = 0; shard < pager->shard_count; shard++)
+    {
+        if (locked & (UINT64_C(1) << shard))
+        {
+            pthread_mutex_unlock(&pager->shards[shard].lock);
+        }
+    }
+}
+
+// locks the shards of the `count` pages starting at `first` by increasing index and returns the set of them.
+static uint64_t lock_run_shards(Pager *pager, int first, int count)
+{
+    uint64_t locked = 0;
+    for (int i = 0; i < count; i++)
+    {
+        locked |= UINT64_C(1) << (pool_of(pager, first + i) - pager->shards);
+    }
+    lock_shards(pager, locked);
+    return locked;
+}
+
+// loads the `count` pages starting at `first` into frames with a single read and queues them as recently used.
+// returns how many pages were loaded, fewer than `count` when not enough clean frames were left.
+// the frames are installed as `loading` before the shards are unlocked for the read, so that no page of the run
+// is cached by another thread or written back in the meantime, and pages that another thread cached before them
+// are left alone. a page that was logged since the caller checked it ends the run: it can't reach the log without
+// being cached, but it may have been committed and evicted before, the datafile then holds an older image.
+static int prefetch_run(Pager *pager, int first, int count)
+{
+    BufferPool *pools[READAHEAD_MAX_RUN];
+    int frames[READAHEAD_MAX_RUN];
+    struct iovec iov[READAHEAD_MAX_RUN];
+    uint64_t locked = lock_run_shards(pager, first, count);
+    int taken = 0;
+    while (taken < count)
+    {
+        BufferPool *pool = pool_of(pager, first + taken);
+        bool cached_or_logged = pool_search(pool, first + taken) != -1 ||
+                     (pager->wal != nullptr && wal_contains(pager->wal, first + taken));
+        // several shards are locked, a dirty victim would be written back with them held.
+        int frame = cached_or_logged ? -1 : pool_take_frame(pager, pool, first + taken, true);
+        if (frame == -1)
+        {
+            break;
+        }
+        CacheEntry *entry = &pool->entries[frame];
+        entry->page_number = first + taken;
+        atomic_store(&entry->pin_count, 1);
+        entry->dirty = false;
+        entry->prefetched = true;
+        entry->loading = true;
+        pool->loads++;
+        hash_insert(pool, frame);
+        cache_policy_insert(pool->policy, frame, first + taken);
+        pools[taken] = pool;
+        frames[taken] = frame;
+        iov[taken] = (struct iovec){entry->data, pager->page_size};
+        taken++;
+    }
+    unlock_shards(pager, locked);
+
+    uint64_t start = io_start(pager);
+    ssize_t n = taken > 0 ? preadv_full(pager->fd, iov, taken, page_offset(pager, first)) : 0;
+    int loaded = n < 0 ? 0 : (int)(n / pager->page_size);
+    if (n > 0)
+    {
+        count_reads(pager, taken, n, start);
+    }
+    if (n >= 0 && n % pager->page_size == 0)
+    {
+        // pages past the end of the datafile read as zeros, like in `read_page`
+        for (int i = loaded; i < taken; i++)
+        {
+            memset(pools[i]->entries[frames[i]].data, 0, pager->page_size);
+        }
+        loaded = taken;
+    }
+
+    lock_shards(pager, locked);
+    for (int i = 0; i < taken; i++)
+    {
+        BufferPool *pool = pools[i];
+        CacheEntry *entry = &pool->entries[frames[i]];
+        entry->loading = false;
+        pool->loads--;
+        pthread_cond_broadcast(&pool->unpinned);
+        if (i >= loaded)
+        {
+            entry->prefetched = false;
+            cache_policy_evict(pool->policy, frames[i]);
+            hash_remove(pool, frames[i]);
+            pool_release_frame(pool, frames[i]);
+            continue;
+        }
+        atomic_store(&entry->pin_count, 0);
+        pool->stats.readahead_pages++;
+    }
+    unlock_shards(pager, locked);
+    return loaded;
+}
+
+// a page is read ahead from the datafile unless it is cached, or logged with a newer image.
+// `prefetch_run` checks again once the page can no longer change.
+static bool is_prefetchable(Pager *pager, int page_number)
+{
+    return cache_search(pager, page_number) == -1 && (pager->wal == nullptr || !wal_contains(pager->wal, page_number));
+}
+
+// prefetches the next window of pages after `next_page`, skipping the ones that are already cached.
+static void prefetch_window(Pager *pager)
+{
+    int end = pager->readahead.next_page + pager->readahead.window;
+    int page_count = (int)database_header(pager).page_count;
+    if (end > page_count)
+    {
+        end = page_count;
+    }
+
+    pager->readahead.marker = pager->readahead.next_page;
+    int page_number = pager->readahead.next_page;
+    while (page_number < end)
+    {
+        if (!is_prefetchable(pager, page_number))
+        {
+            page_number++;
+            continue;
+        }
+        int count = 1;
+        while (page_number + count < end && count < READAHEAD_MAX_RUN && is_prefetchable(pager, page_number + count))
+        {
+            count++;
+        }
+        int loaded = prefetch_run(pager, page_number, count);
+        page_number += loaded;
+        if (loaded < count)
+        {
+            break;
+        }
+    }
+    pager->readahead.next_page = page_number;
+}
+
+// updates the access pattern with a request for `page_number` and reads ahead when a scan is going on.
+// the caller holds `readahead_lock`.
+static void update_readahead(Pager *pager, int page_number)
+{
+    bool sequential = pager->readahead.last_page != -1 && page_number == pager->readahead.last_page + 1;
+    pager->readahead.last_page = page_number;
+    for (int evicted = atomic_exchange(&pager->prefetch_evicted, 0); evicted > 0; evicted--)
+    {
+        if (pager->readahead.window > READAHEAD_MIN_PAGES)
+        {
+            pager->readahead.window /= 2;
+        }
+    }
+    if (!sequential)
+    {
+        pager->readahead.window = 0;
+        return;
+    }
+
+    if (pager->readahead.window == 0)
+    {
+        pager->readahead.window = READAHEAD_MIN_PAGES;
+        pager->readahead.next_page = page_number + 1;
+        prefetch_window(pager);
+    }
+    else if (page_number >= pager->readahead.marker)
+    {
+        if (pager->readahead.next_page <= page_number)
+        {
+            pager->readahead.next_page = page_number + 1;
         }
+        pager->readahead.window = pager->readahead.window * 2 < pager->readahead.max_window ? pager->readahead.window * 2 : pager->readahead.max_window;
+        prefetch_window(pager);
     }
-    return write_page(page_number, page);
-}
\ No newline at end of file
+}
+
+// readahead is only a hint: a request that finds another thread updating the access pattern doesn't wait for it.
+static void track_access(Pager *pager, int page_number)
+{
+    if (pager->readahead.max_window < READAHEAD_MIN_PAGES || pager->use_mmap || pager->in_memory || pager->compressed)
+    {
+        // the pool is too small, the kernel reads the mapping ahead already, there is no I/O to hide
+        // or the slots of consecutive pages aren't next to each other
+        return;
+    }
+    if (pthread_mutex_trylock(&pager->readahead_lock) == 0)
+    {
+        update_readahead(pager, page_number);
+        pthread_mutex_unlock(&pager->readahead_lock);
+    }
+}
+
+int read_page_with_cache(Pager *pager, int page_number, Page *page)
+{
+    if (pager == nullptr)
+    {
+        return -1;
+    }
+
+    // only misses and first reads of prefetched pages feed the readahead: a scan is made of them, and hits
+    // on pages already in use don't touch the state shared by every reader.
+    BufferPool *pool = pool_of(pager, page_number);
+    pthread_mutex_lock(&pool->lock);
+    int cached = pool_search(pool, page_number);
+    bool scanning = cached == -1 || pool->entries[cached].prefetched;
+    int frame = pool_fetch(pager, pool, page_number, true);
+    pthread_mutex_unlock(&pool->lock);
+    if (frame == -1)
+    {
+        return -1;
+    }
+    if (scanning)
+    {
+        track_access(pager, page_number);
+    }
+
+    // the pin keeps the frame from being evicted, the latch keeps writers out during the copy.
+    CacheEntry *entry = &pool->entries[frame];
+    pthread_rwlock_rdlock(&pool->latches[frame]);
+    memcpy(page->data, entry->data, pager->page_size);
+    pthread_rwlock_unlock(&pool->latches[frame]);
+    atomic_fetch_sub(&entry->pin_count, 1);
+    return 0;
+}
+
+int write_page_with_cache(Pager *pager, int page_number, const Page *page)
+{
+    if (pager == nullptr)
+    {
+        return -1;
+    }
+
+    BufferPool *pool = pool_of(pager, page_number);
+    pthread_mutex_lock(&pool->lock);
+    int frame = pool_fetch(pager, pool, page_number, false);
+    if (frame != -1)
+    {
+        CacheEntry *entry = &pool->entries[frame];
+        pthread_rwlock_wrlock(&pool->latches[frame]);
+        memcpy(entry->data, page->data, pager->page_size);
+        entry->dirty = true;
+        pthread_rwlock_unlock(&pool->latches[frame]);
+        atomic_fetch_sub(&entry->pin_count, 1);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return frame == -1 ? -1 : 0;
+}
+
+// DirtyFrame is a dirty frame pinned by `flush_dirty_pages` until it is written out.
+typedef struct DirtyFrame
+{
+    CacheEntry *entry;
+    pthread_rwlock_t *latch;
+    BufferPool *pool;
+} DirtyFrame;
+
+static int compare_frames_by_page(const void *a, const void *b)
+{
+    int left = ((const DirtyFrame *)a)->entry->page_number;
+    int right = ((const DirtyFrame *)b)->entry->page_number;
+    return (left > right) - (left < right);
+}
+
+// writes the dirty frames, sorted by page, into the datafile. adjacent pages are written as one run with a single pwritev.
+// writers are kept out of a run while it is written, so that changes made in the meantime aren't marked clean.
+static int write_dirty_frames(Pager *pager, const DirtyFrame *dirty, int dirty_count)
+{
+    struct iovec iov[IOV_MAX];
+    int run_start = 0;
+    while (run_start < dirty_count)
+    {
+        int run_end = run_start + 1;
+        while (run_end < dirty_count && run_end - run_start < IOV_MAX &&
+               dirty[run_end].entry->page_number == dirty[run_end - 1].entry->page_number + 1)
+        {
+            run_end++;
+        }
+
+        for (int i = run_start; i < run_end; i++)
+        {
+            pthread_rwlock_rdlock(dirty[i].latch);
+            iov[i - run_start] = (struct iovec){dirty[i].entry->data, pager->page_size};
+        }
+        int result = write_run(pager, dirty[run_start].entry->page_number, iov, run_end - run_start);
+        for (int i = run_start; i < run_end; i++)
+        {
+            dirty[i].entry->dirty = dirty[i].entry->dirty && result != 0;
+            pthread_rwlock_unlock(dirty[i].latch);
+        }
+        if (result != 0)
+        {
+            return -1;
+        }
+        run_start = run_end;
+    }
+    return 0;
+}
+
+// appends the dirty frames to the log as one transaction. returns the sequence number that `wal_sync` waits
+// for to make it durable, or -1.
+static int64_t log_dirty_frames(Pager *pager, const DirtyFrame *dirty, int dirty_count)
+{
+    int *page_numbers = malloc(sizeof(int) * (size_t)dirty_count);
+    const uint8_t **pages = malloc(sizeof(uint8_t *) * (size_t)dirty_count);
+    if (page_numbers == nullptr || pages == nullptr)
+    {
+        free(page_numbers);
+        free(pages);
+        return -1;
+    }
+    for (int i = 0; i < dirty_count; i++)
+    {
+        pthread_rwlock_rdlock(dirty[i].latch);
+        page_numbers[i] = dirty[i].entry->page_number;
+        pages[i] = dirty[i].entry->data;
+    }
+
+    // once appended the images are in the log, writers don't have to wait for the sync.
+    int64_t sequence = wal_append(pager->wal, page_numbers, pages, dirty_count, true);
+    for (int i = 0; i < dirty_count; i++)
+    {
+        dirty[i].entry->dirty = dirty[i].entry->dirty && sequence == -1;
+        pthread_rwlock_unlock(dirty[i].latch);
+    }
+    free(page_numbers);
+    free(pages);
+    return sequence;
+}
+
+// collects and pins the dirty frames of every shard. the write-backs of evictions under way are waited for,
+// so that the pages they write are part of the flush.
+static DirtyFrame *pin_dirty_frames(Pager *pager, int *dirty_count)
+{
+    DirtyFrame *dirty = malloc(sizeof(DirtyFrame) * (size_t)(pager->shard_count * pager->shard_capacity));
+    if (dirty == nullptr)
+    {
+        return nullptr;
+    }
+
+    *dirty_count = 0;
+    for (int shard = 0; shard < pager->shard_count; shard++)
+    {
+        BufferPool *pool = &pager->shards[shard];
+        pthread_mutex_lock(&pool->lock);
+        while (pool->write_backs > 0)
+        {
+            pthread_cond_wait(&pool->unpinned, &pool->lock);
+        }
+        for (int i = 0; i < pool->count; i++)
+        {
+            if (pool->entries[i].dirty)
+            {
+                atomic_fetch_add(&pool->entries[i].pin_count, 1);
+                pool->flush_pins++;
+                dirty[(*dirty_count)++] = (DirtyFrame){&pool->entries[i], &pool->latches[i], pool};
+            }
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return dirty;
+}
+
+// releases the frames pinned by `pin_dirty_frames`, misses waiting for a frame try again.
+static void unpin_dirty_frames(const DirtyFrame *dirty, int dirty_count)
+{
+    for (int i = 0; i < dirty_count; i++)
+    {
+        BufferPool *pool = dirty[i].pool;
+        pthread_mutex_lock(&pool->lock);
+        atomic_fetch_sub(&dirty[i].entry->pin_count, 1);
+        if (--pool->flush_pins == 0)
+        {
+            pthread_cond_broadcast(&pool->unpinned);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+// flushes the dirty pages, the caller holds the lock of the pager. in WAL mode the pages are appended to the log
+// as one transaction and `commit` receives the sequence number that `sync_commit` waits for, 0 when nothing was
+// logged: the log is synced once the lock of the pager is released, so that committers share the fsync.
+static int flush_pool(Pager *pager, int64_t *commit)
+{
+    *commit = 0;
+    // the transaction of pages logged by evictions needs a commit frame, the header page carries it.
+    bool wal_pending = atomic_exchange(&pager->wal_pending, false);
+    if (pager->header_dirty || wal_pending)
+    {
+        Page *page = pin_page(pager, HEADER_PAGE);
+        if (page == nullptr)
+        {
+            atomic_store(&pager->wal_pending, wal_pending);
+            return -1;
+        }
+        memcpy(page->data, &pager->header, sizeof(DatabaseHeader));
+        unpin_page(pager, HEADER_PAGE, true);
+        pager->header_dirty = false;
+    }
+
+    int dirty_count;
+    DirtyFrame *dirty = pin_dirty_frames(pager, &dirty_count);
+    if (dirty == nullptr)
+    {
+        return -1;
+    }
+    qsort(dirty, dirty_count, sizeof(DirtyFrame), compare_frames_by_page);
+
+    int result = 0;
+    if (dirty_count > 0 && pager->wal != nullptr)
+    {
+        *commit = log_dirty_frames(pager, dirty, dirty_count);
+        result = *commit == -1 ? -1 : 0;
+    }
+    else if (dirty_count > 0)
+    {
+        result = write_dirty_frames(pager, dirty, dirty_count);
+    }
+    unpin_dirty_frames(dirty, dirty_count);
+    free(dirty);
+    return result;
+}
+
+// waits until the transaction that `flush_pool` logged is durable, then checkpoints the log once it grew past
+// `checkpoint_frames`. the caller doesn't hold the lock of the pager.
+static int sync_commit(Pager *pager, int64_t commit)
+{
+    if (commit <= 0)
+    {
+        return 0;
+    }
+    if (wal_sync(pager->wal, commit) != 0)
+    {
+        return -1;
+    }
+    int result = 0;
+    if (wal_frame_count(pager->wal) >= pager->checkpoint_frames)
+    {
+        pthread_mutex_lock(&pager->lock);
+        // another committer may have checkpointed the log in the meantime.
+        if (wal_frame_count(pager->wal) >= pager->checkpoint_frames)
+        {
+            result = checkpoint_log(pager);
+        }
+        pthread_mutex_unlock(&pager->lock);
+    }
+    return result;
+}
+
+int flush_dirty_pages(Pager *pager)
+{
+    if (pager == nullptr)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&pager->lock);
+    int64_t commit;
+    int result = flush_pool(pager, &commit);
+    pthread_mutex_unlock(&pager->lock);
+    return result == 0 ? sync_commit(pager, commit) : -1;
+}
+
+// writes a page copied back from the log into the datafile, where it is counted like any other write and
+// extends the part of the datafile the mapping serves.
+static int store_logged_page(void *context, int page_number, const uint8_t *page)
+{
+    return write_page(context, page_number, (const Page *)page);
+}
+
+// copies the log back into the datafile and resets it.
+static int checkpoint_log(Pager *pager)
+{
+    if (wal_checkpoint_with(pager->wal, pager->fd, store_logged_page, pager) != 0)
+    {
+        return -1;
+    }
+    // the slots that pages of the checkpoint moved out of can be reused once the new ones are synced.
+    if (pager->codec != nullptr && sync_datafile(pager) != 0)
+    {
+        return -1;
+    }
+    // the datafile now holds the header written by the last commit, the pages a vacuum dropped can go.
+    return shrink_datafile(pager);
+}
+
+int checkpoint_database(Pager *pager)
+{
+    if (pager == nullptr)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&pager->lock);
+    int64_t commit;
+    int result = flush_pool(pager, &commit);
+    if (result == 0)
+    {
+        if (pager->wal != nullptr)
+        {
+            // the checkpoint syncs the datafile with the pages just logged, the log doesn't need its own fsync.
+            result = checkpoint_log(pager);
+        }
+        else if (!pager->in_memory)
+        {
+            result = sync_datafile(pager);
+        }
+    }
+    pthread_mutex_unlock(&pager->lock);
+    return result == 0 ? 0 : -1;
+}
+
+const Page *view_page(Pager *pager, int page_number)
+{
+    if (pager == nullptr)
+    {
+        return nullptr;
+    }
+
+    // a resident frame or the log may hold changes that the datafile doesn't have yet.
+    if (pager->use_mmap && cache_search(pager, page_number) == -1 &&
+        (pager->wal == nullptr || !wal_contains(pager->wal, page_number)))
+    {
+        pthread_mutex_lock(&pager->map_lock);
+        const Page *mapped = mapped_page(pager, page_number);
+        if (mapped != nullptr)
+        {
+            pager->file_map.views++;
+        }
+        pthread_mutex_unlock(&pager->map_lock);
+        if (mapped != nullptr)
+        {
+            return mapped;
+        }
+    }
+    return pin_page(pager, page_number);
+}
+
+int release_view(Pager *pager, const Page *view)
+{
+    const uint8_t *address = view->data;
+    if (pager->use_mmap)
+    {
+        pthread_mutex_lock(&pager->map_lock);
+        bool mapped = address >= pager->file_map.base && address < pager->file_map.base + pager->file_map.size;
+        int result = mapped && pager->file_map.views > 0 ? 0 : -1;
+        if (mapped && result == 0)
+        {
+            pager->file_map.views--;
+        }
+        pthread_mutex_unlock(&pager->map_lock);
+        if (mapped)
+        {
+            return result;
+        }
+    }
+
+    for (int shard = 0; shard < pager->shard_count; shard++)
+    {
+        const BufferPool *pool = &pager->shards[shard];
+        size_t offset = (size_t)(address - pool->frames);
+        if (address >= pool->frames && offset < (size_t)pool->capacity * (size_t)pager->page_size)
+        {
+            return unpin_page(pager, pool->entries[offset / (size_t)pager->page_size].page_number, false);
+        }
+    }
+    return -1;
+}
+
+int advise_access(Pager *pager, int first_page, int page_count, MmapAdvice advice)
+{
+    if (!pager->use_mmap || first_page < 0 || page_count < 0)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&pager->map_lock);
+    int result;
+    if (page_count == 0)
+    {
+        pager->file_map.advice = advice;
+        result = madvise(pager->file_map.base, pager->file_map.size, madvise_flag(advice));
+    }
+    else
+    {
+        size_t start = (size_t)first_page * pager->page_size;
+        size_t end = start + (size_t)page_count * pager->page_size;
+        if (end > pager->file_map.size)
+        {
+            end = pager->file_map.size;
+        }
+
+        // madvise wants an address aligned on the system page size.
+        size_t system_page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t aligned = start - start % system_page;
+        result = start < end ? madvise(pager->file_map.base + aligned, end - aligned, madvise_flag(advice)) : -1;
+    }
+    pthread_mutex_unlock(&pager->map_lock);
+    return result;
+}
+
+int submit_page_io(Pager *pager, PageRequest *requests, int count)
+{
+    if (pager->aio == nullptr)
+    {
+        return -1;
+    }
+    return async_io_submit(pager->aio, requests, count);
+}
+
+int reap_page_io(Pager *pager, int min_complete)
+{
+    if (pager->aio == nullptr)
+    {
+        return -1;
+    }
+    int reaped = async_io_reap(pager->aio, min_complete);
+
+    // completed writes may have grown the datafile, the mapping only serves pages that exist on disk.
+    struct stat st;
+    if (reaped > 0 && pager->use_mmap && fstat(pager->fd, &st) == 0)
+    {
+        note_file_extent(pager, (int)((st.st_size + pager->page_size - 1) / pager->page_size) - 1);
+    }
+    return reaped;
+}
+
+IoStats io_stats(Pager *pager)
+{
+    IoStats stats = {0};
+    stats.cache = cache_stats(pager);
+    if (!pager->collect_io_stats)
+    {
+        return stats;
+    }
+    stats.page_reads = atomic_load_explicit(&pager->io.page_reads, memory_order_relaxed);
+    stats.page_writes = atomic_load_explicit(&pager->io.page_writes, memory_order_relaxed);
+    stats.bytes_read = atomic_load_explicit(&pager->io.bytes_read, memory_order_relaxed);
+    stats.bytes_written = atomic_load_explicit(&pager->io.bytes_written, memory_order_relaxed);
+    stats.syncs = atomic_load_explicit(&pager->io.syncs, memory_order_relaxed);
+    if (pager->codec != nullptr)
+    {
+        PageCodecStats codec = page_codec_stats(pager->codec);
+        stats.bytes_read += codec.bytes_read;
+        stats.bytes_written += codec.bytes_written;
+    }
+    if (pager->wal != nullptr)
+    {
+        WalStats wal = wal_stats(pager->wal);
+        stats.syncs += wal.syncs + wal.reset_syncs + wal.datafile_syncs;
+    }
+    stats.read_latency = latency_snapshot(&pager->io.read_latency);
+    stats.write_latency = latency_snapshot(&pager->io.write_latency);
+    return stats;
+}
+
+int dump_io_stats(Pager *pager, FILE *output)
+{
+    if (!pager->collect_io_stats)
+    {
+        return fprintf(output, "io statistics aren't collected\n") < 0 ? -1 : 0;
+    }
+    IoStats stats = io_stats(pager);
+    if (fprintf(output, "pages read %llu (%llu bytes), written %llu (%llu bytes), syncs %llu\n",
+                (unsigned long long)stats.page_reads, (unsigned long long)stats.bytes_read,
+                (unsigned long long)stats.page_writes, (unsigned long long)stats.bytes_written,
+                (unsigned long long)stats.syncs) < 0 ||
+        fprintf(output, "cache hits %llu, misses %llu, evictions %llu, readahead pages %llu\n",
+                (unsigned long long)stats.cache.hits, (unsigned long long)stats.cache.misses,
+                (unsigned long long)stats.cache.evictions, (unsigned long long)stats.cache.readahead_pages) < 0)
+    {
+        return -1;
+    }
+    if (latency_dump(&stats.read_latency, "read latency", output) != 0 ||
+        latency_dump(&stats.write_latency, "write latency", output) != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+PageCodecStats compression_stats(Pager *pager)
+{
+    return pager->codec != nullptr ? page_codec_stats(pager->codec) : (PageCodecStats){0};
+}
+
+int huge_page_frames(Pager *pager)
+{
+    if (pager == nullptr)
+    {
+        return -1;
+    }
+    int frames = pager->shard_count * pager->shard_capacity;
+    if (pager->arena_hugetlb)
+    {
+        return frames;
+    }
+    if (pager->arena_size < HUGE_PAGE_SIZE)
+    {
+        return 0;
+    }
+
+    // transparent huge pages come and go with the kernel, the mappings of the process tell where they are now.
+    FILE *smaps = fopen("/proc/self/smaps", "r");
+    if (smaps == nullptr)
+    {
+        return -1;
+    }
+    uintptr_t arena_start = (uintptr_t)pager->frame_arena;
+    bool in_arena = false;
+    long long huge_kb = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), smaps) != nullptr)
+    {
+        unsigned long start, end;
+        long long kb;
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
+        {
+            in_arena = start >= arena_start && start < arena_start + pager->arena_size;
+        }
+        else if (in_arena && sscanf(line, "AnonHugePages: %lld kB", &kb) == 1)
+        {
+            huge_kb += kb;
+        }
+    }
+    fclose(smaps);
+
+    long long huge_frames = huge_kb * 1024 / pager->page_size;
+    return huge_frames < frames ? (int)huge_frames : frames;
+}
+
+CacheStats cache_stats(Pager *pager)
+{
+    CacheStats total = {0};
+    for (int shard = 0; shard < pager->shard_count; shard++)
+    {
+        BufferPool *pool = &pager->shards[shard];
+        pthread_mutex_lock(&pool->lock);
+        total.hits += pool->stats.hits;
+        total.misses += pool->stats.misses;
+        total.evictions += pool->stats.evictions;
+        total.readahead_pages += pool->stats.readahead_pages;
+        total.readahead_hits += pool->stats.readahead_hits;
+        total.readahead_misses += pool->stats.readahead_misses;
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return total;
+}
@@ -0,0 +1,540 @@
+#include "wal.h"
+#include "file_io.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define WAL_VERSION 1
+#define WAL_INDEX_MIN_CAPACITY 64
+#define WAL_BUFFER_ALIGNMENT 4096 // a checkpoint may write into a datafile opened with O_DIRECT
+
+// WalHeader starts the log. the salt changes every time the log is reset,
+// so that frames left over from an older generation never pass as valid.
+typedef struct WalHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t salt;
+    uint32_t checkpoint_seq;
+    uint32_t checksum; // of the fields above
+    uint32_t reserved;
+} WalHeader;
+
+// FrameHeader precedes every page image. the checksum covers the first fields of the frame header
+// and the page image, and is chained from the checksum of the previous frame.
+typedef struct FrameHeader
+{
+    uint32_t page_number;
+    uint32_t commit; // 1 on the last frame of a transaction
+    uint32_t salt;
+    uint32_t checksum;
+} FrameHeader;
+
+// WalIndexEntry maps a page to the newest frame that holds it, in an open-addressing hash table.
+typedef struct WalIndexEntry
+{
+    int page_number; // -1 for an empty slot
+    int frame;
+    int committed;   // the newest committed frame when `frame` isn't committed yet, -1 if there is none
+} WalIndexEntry;
+
+struct Wal
+{
+    pthread_mutex_t lock;
+    pthread_cond_t sync_done;
+    int fd;
+    int page_size;
+    uint32_t salt;
+    uint32_t checkpoint_seq;
+    uint32_t checksum;   // checksum of the last frame, the seed of the next one
+    int frame_count;
+    int committed;       // frames up to and including the last commit frame
+    int64_t base;        // sequence number of the first frame of the log
+    int64_t synced;      // frames up to this sequence number are on stable storage
+    bool syncing;        // a committer is running fsync for the others
+    WalIndexEntry *index;
+    int index_capacity;
+    int index_count;
+    uint8_t *page_buffer;
+    WalStats stats;
+};
+
+_Static_assert(sizeof(WalHeader) == WAL_HEADER_SIZE, "the log header has a fixed size");
+_Static_assert(sizeof(FrameHeader) == WAL_FRAME_HEADER_SIZE, "the frame header has a fixed size");
+
+// FNV-1a, seeded with the checksum it continues.
+static uint32_t checksum_update(uint32_t checksum, const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < size; i++)
+    {
+        checksum = (checksum ^ bytes[i]) * 16777619u;
+    }
+    return checksum;
+}
+
+static off_t frame_offset(const Wal *wal, int frame)
+{
+    return WAL_HEADER_SIZE + (off_t)frame * (WAL_FRAME_HEADER_SIZE + wal->page_size);
+}
+
+static int index_slot(const Wal *wal, int page_number)
+{
+    int mask = wal->index_capacity - 1;
+    int slot = (int)(((uint32_t)page_number * 2654435761u) & (uint32_t)mask);
+    while (wal->index[slot].page_number != -1 && wal->index[slot].page_number != page_number)
+    {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static int index_find(const Wal *wal, int page_number)
+{
+    return wal->index[index_slot(wal, page_number)].frame;
+}
+
+static int index_resize(Wal *wal, int capacity)
+{
+    WalIndexEntry *old = wal->index;
+    int old_capacity = wal->index_capacity;
+    wal->index = malloc(sizeof(WalIndexEntry) * (size_t)capacity);
+    if (wal->index == nullptr)
+    {
+        wal->index = old;
+        return -1;
+    }
+    wal->index_capacity = capacity;
+    wal->index_count = 0;
+    for (int i = 0; i < capacity; i++)
+    {
+        wal->index[i] = (WalIndexEntry){-1, -1, -1};
+    }
+    for (int i = 0; i < old_capacity; i++)
+    {
+        if (old[i].page_number != -1)
+        {
+            wal->index[index_slot(wal, old[i].page_number)] = old[i];
+            wal->index_count++;
+        }
+    }
+    free(old);
+    return 0;
+}
+
+static int index_put(Wal *wal, int page_number, int frame)
+{
+    if ((wal->index_count + 1) * 2 > wal->index_capacity && index_resize(wal, wal->index_capacity * 2) != 0)
+    {
+        return -1;
+    }
+    WalIndexEntry *entry = &wal->index[index_slot(wal, page_number)];
+    if (entry->page_number == -1)
+    {
+        wal->index_count++;
+        *entry = (WalIndexEntry){page_number, frame, -1};
+        return 0;
+    }
+    if (entry->frame < wal->committed)
+    {
+        entry->committed = entry->frame;
+    }
+    entry->frame = frame;
+    return 0;
+}
+
+// returns the newest committed frame of the page of `entry`, -1 if only frames without a commit hold it.
+static int committed_frame(const Wal *wal, const WalIndexEntry *entry)
+{
+    return entry->frame < wal->committed ? entry->frame : entry->committed;
+}
+
+// starts a new generation of the log: a header with a fresh salt, then the frames from `first` on, which aren't
+// committed. the header reaches the disk before the old frames are overwritten or cut, so a crash in between
+// leaves no valid committed frame.
+static int wal_reset(Wal *wal, int first)
+{
+    wal->salt += 0x9E3779B9u;
+    wal->checkpoint_seq++;
+    WalHeader header = {.version = WAL_VERSION, .page_size = (uint32_t)wal->page_size, .salt = wal->salt,
+                        .checkpoint_seq = wal->checkpoint_seq};
+    memcpy(header.magic, WAL_MAGIC, sizeof(header.magic));
+    header.checksum = checksum_update(0, &header, offsetof(WalHeader, checksum));
+
+    if (pwrite_full(wal->fd, &header, sizeof(header), 0) != 0 || fdatasync(wal->fd) != 0)
+    {
+        return -1;
+    }
+    wal->stats.reset_syncs++;
+    int kept = wal->frame_count - first;
+    wal->checksum = wal->salt;
+    wal->frame_count = 0;
+    wal->committed = 0;
+    free(wal->index);
+    wal->index = nullptr;
+    wal->index_capacity = 0;
+    if (index_resize(wal, WAL_INDEX_MIN_CAPACITY) != 0)
+    {
+        return -1;
+    }
+
+    // the kept frames move to the start of the log in order, each one is read before a frame lands on it.
+    for (int i = 0; i < kept; i++)
+    {
+        FrameHeader frame_header;
+        off_t from = frame_offset(wal, first + i);
+        if (pread_full(wal->fd, &frame_header, sizeof(frame_header), from) != (ssize_t)sizeof(frame_header) ||
+            pread_full(wal->fd, wal->page_buffer, (size_t)wal->page_size, from + WAL_FRAME_HEADER_SIZE) !=
+                wal->page_size)
+        {
+            return -1;
+        }
+        frame_header.salt = wal->salt;
+        uint32_t checksum = checksum_update(wal->checksum, &frame_header, offsetof(FrameHeader, checksum));
+        checksum = checksum_update(checksum, wal->page_buffer, (size_t)wal->page_size);
+        frame_header.checksum = checksum;
+        off_t to = frame_offset(wal, i);
+        if (pwrite_full(wal->fd, &frame_header, sizeof(frame_header), to) != 0 ||
+            pwrite_full(wal->fd, wal->page_buffer, (size_t)wal->page_size, to + WAL_FRAME_HEADER_SIZE) != 0 ||
+            index_put(wal, (int)frame_header.page_number, i) != 0)
+        {
+            return -1;
+        }
+        wal->checksum = checksum;
+        wal->frame_count++;
+    }
+    return ftruncate(wal->fd, frame_offset(wal, wal->frame_count));
+}
+
+// reads back the frames of a previous run up to the last commit whose checksums are intact,
+// and cuts whatever follows them.
+static int wal_recover(Wal *wal)
+{
+    WalHeader header;
+    ssize_t n = pread_full(wal->fd, &header, sizeof(header), 0);
+    if (n < 0)
+    {
+        return -1;
+    }
+    if (n < (ssize_t)sizeof(header) || memcmp(header.magic, WAL_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != WAL_VERSION || header.page_size != (uint32_t)wal->page_size ||
+        header.checksum != checksum_update(0, &header, offsetof(WalHeader, checksum)))
+    {
+        wal->salt = (uint32_t)time(nullptr) ^ ((uint32_t)getpid() << 16);
+        return wal_reset(wal, 0);
+    }
+
+    wal->salt = header.salt;
+    wal->checkpoint_seq = header.checkpoint_seq;
+    if (index_resize(wal, WAL_INDEX_MIN_CAPACITY) != 0)
+    {
+        return -1;
+    }
+
+    // the frames are validated first, only those up to the last commit are indexed afterwards.
+    uint32_t checksum = wal->salt;
+    uint32_t committed_checksum = wal->salt;
+    int frame = 0;
+    int committed = 0;
+    while (true)
+    {
+        FrameHeader frame_header;
+        off_t offset = frame_offset(wal, frame);
+        if (pread_full(wal->fd, &frame_header, sizeof(frame_header), offset) != (ssize_t)sizeof(frame_header) ||
+            pread_full(wal->fd, wal->page_buffer, (size_t)wal->page_size, offset + WAL_FRAME_HEADER_SIZE) !=
+                wal->page_size)
+        {
+            break;
+        }
+        uint32_t expected = checksum_update(checksum, &frame_header, offsetof(FrameHeader, checksum));
+        expected = checksum_update(expected, wal->page_buffer, (size_t)wal->page_size);
+        if (frame_header.salt != wal->salt || frame_header.checksum != expected ||
+            frame_header.page_number > INT_MAX)
+        {
+            break;
+        }
+
+        checksum = expected;
+        frame++;
+        if (frame_header.commit)
+        {
+            committed = frame;
+            committed_checksum = checksum;
+        }
+    }
+
+    for (int i = 0; i < committed; i++)
+    {
+        FrameHeader frame_header;
+        if (pread_full(wal->fd, &frame_header, sizeof(frame_header), frame_offset(wal, i)) !=
+                (ssize_t)sizeof(frame_header) ||
+            index_put(wal, (int)frame_header.page_number, i) != 0)
+        {
+            return -1;
+        }
+    }
+    if (ftruncate(wal->fd, frame_offset(wal, committed)) != 0)
+    {
+        return -1;
+    }
+
+    wal->frame_count = committed;
+    wal->committed = committed;
+    wal->checksum = committed_checksum;
+    wal->synced = committed;
+    return 0;
+}
+
+Wal *wal_open(const char *path, int page_size)
+{
+    Wal *wal = calloc(1, sizeof(Wal));
+    if (wal == nullptr)
+    {
+        return nullptr;
+    }
+    wal->page_size = page_size;
+    wal->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (posix_memalign((void **)&wal->page_buffer, WAL_BUFFER_ALIGNMENT, (size_t)page_size) != 0)
+    {
+        wal->page_buffer = nullptr;
+    }
+    pthread_mutex_init(&wal->lock, nullptr);
+    pthread_cond_init(&wal->sync_done, nullptr);
+    if (wal->fd == -1 || wal->page_buffer == nullptr || wal_recover(wal) != 0)
+    {
+        wal_close(wal);
+        return nullptr;
+    }
+    return wal;
+}
+
+void wal_close(Wal *wal)
+{
+    if (wal == nullptr)
+    {
+        return;
+    }
+    if (wal->fd != -1)
+    {
+        close(wal->fd);
+    }
+    pthread_cond_destroy(&wal->sync_done);
+    pthread_mutex_destroy(&wal->lock);
+    free(wal->index);
+    free(wal->page_buffer);
+    free(wal);
+}
+
+int64_t wal_append(Wal *wal, const int *page_numbers, const uint8_t *const *pages, int count, bool commit)
+{
+    if (count <= 0)
+    {
+        return -1;
+    }
+    FrameHeader *headers = malloc(sizeof(FrameHeader) * (size_t)count);
+    struct iovec *iov = malloc(sizeof(struct iovec) * 2 * (size_t)count);
+    if (headers == nullptr || iov == nullptr)
+    {
+        free(headers);
+        free(iov);
+        return -1;
+    }
+
+    pthread_mutex_lock(&wal->lock);
+    uint32_t checksum = wal->checksum;
+    for (int i = 0; i < count; i++)
+    {
+        headers[i] = (FrameHeader){(uint32_t)page_numbers[i], commit && i == count - 1, wal->salt, 0};
+        checksum = checksum_update(checksum, &headers[i], offsetof(FrameHeader, checksum));
+        checksum = checksum_update(checksum, pages[i], (size_t)wal->page_size);
+        headers[i].checksum = checksum;
+        iov[2 * i] = (struct iovec){&headers[i], sizeof(FrameHeader)};
+        iov[2 * i + 1] = (struct iovec){(void *)pages[i], (size_t)wal->page_size};
+    }
+
+    // the frames of a transaction go out as one sequential write, split only by the iovec limit.
+    int result = 0;
+    for (int done = 0; done < 2 * count && result == 0; done += IOV_MAX)
+    {
+        int chunk = 2 * count - done < IOV_MAX ? 2 * count - done : IOV_MAX;
+        off_t offset = frame_offset(wal, wal->frame_count + done / 2);
+        result = pwritev_full(wal->fd, iov + done, chunk, offset);
+    }
+    for (int i = 0; i < count && result == 0; i++)
+    {
+        result = index_put(wal, page_numbers[i], wal->frame_count + i);
+    }
+
+    int64_t sequence = -1;
+    if (result == 0)
+    {
+        wal->checksum = checksum;
+        wal->frame_count += count;
+        wal->stats.frames += (uint64_t)count;
+        if (commit)
+        {
+            wal->committed = wal->frame_count;
+            wal->stats.commits++;
+        }
+        sequence = wal->base + wal->frame_count;
+    }
+    pthread_mutex_unlock(&wal->lock);
+    free(headers);
+    free(iov);
+    return sequence;
+}
+
+int wal_sync(Wal *wal, int64_t sequence)
+{
+    int result = 0;
+    pthread_mutex_lock(&wal->lock);
+    while (wal->synced < sequence && result == 0)
+    {
+        if (wal->syncing)
+        {
+            pthread_cond_wait(&wal->sync_done, &wal->lock);
+            continue;
+        }
+
+        // become the leader: every frame appended so far rides on this fsync.
+        wal->syncing = true;
+        int64_t target = wal->base + wal->frame_count;
+        pthread_mutex_unlock(&wal->lock);
+        result = fdatasync(wal->fd);
+        pthread_mutex_lock(&wal->lock);
+        wal->syncing = false;
+        if (result == 0)
+        {
+            wal->synced = target > wal->synced ? target : wal->synced;
+            wal->stats.syncs++;
+        }
+        pthread_cond_broadcast(&wal->sync_done);
+    }
+    pthread_mutex_unlock(&wal->lock);
+    return result == 0 ? 0 : -1;
+}
+
+int wal_read_page(Wal *wal, int page_number, uint8_t *page)
+{
+    pthread_mutex_lock(&wal->lock);
+    int frame = index_find(wal, page_number);
+    int result = 0;
+    if (frame != -1)
+    {
+        ssize_t n = pread_full(wal->fd, page, (size_t)wal->page_size, frame_offset(wal, frame) + WAL_FRAME_HEADER_SIZE);
+        result = n == wal->page_size ? 1 : -1;
+    }
+    pthread_mutex_unlock(&wal->lock);
+    return result;
+}
+
+bool wal_contains(Wal *wal, int page_number)
+{
+    pthread_mutex_lock(&wal->lock);
+    bool found = index_find(wal, page_number) != -1;
+    pthread_mutex_unlock(&wal->lock);
+    return found;
+}
+
+int wal_frame_count(Wal *wal)
+{
+    pthread_mutex_lock(&wal->lock);
+    int frames = wal->frame_count;
+    pthread_mutex_unlock(&wal->lock);
+    return frames;
+}
+
+static int compare_entries_by_page(const void *a, const void *b)
+{
+    int left = ((const WalIndexEntry *)a)->page_number;
+    int right = ((const WalIndexEntry *)b)->page_number;
+    return (left > right) - (left < right);
+}
+
+int wal_checkpoint(Wal *wal, int db_fd)
+{
+    return wal_checkpoint_with(wal, db_fd, nullptr, nullptr);
+}
+
+int wal_checkpoint_with(Wal *wal, int db_fd, WalPageWriter writer, void *context)
+{
+    pthread_mutex_lock(&wal->lock);
+    while (wal->syncing)
+    {
+        pthread_cond_wait(&wal->sync_done, &wal->lock);
+    }
+    if (wal->committed == 0)
+    {
+        pthread_mutex_unlock(&wal->lock);
+        return 0;
+    }
+
+    WalIndexEntry *entries = malloc(sizeof(WalIndexEntry) * (size_t)wal->index_count);
+    int result = entries == nullptr ? -1 : 0;
+    int count = 0;
+    for (int i = 0; i < wal->index_capacity && result == 0; i++)
+    {
+        // frames that aren't committed stay in the log, the datafile receives the last committed image.
+        int frame = wal->index[i].page_number != -1 ? committed_frame(wal, &wal->index[i]) : -1;
+        if (frame != -1)
+        {
+            entries[count++] = (WalIndexEntry){wal->index[i].page_number, frame, frame};
+        }
+    }
+    if (result == 0)
+    {
+        qsort(entries, (size_t)count, sizeof(WalIndexEntry), compare_entries_by_page);
+    }
+
+    for (int i = 0; i < count && result == 0; i++)
+    {
+        off_t offset = frame_offset(wal, entries[i].frame) + WAL_FRAME_HEADER_SIZE;
+        if (pread_full(wal->fd, wal->page_buffer, (size_t)wal->page_size, offset) != wal->page_size)
+        {
+            result = -1;
+            break;
+        }
+        if (writer != nullptr)
+        {
+            result = writer(context, entries[i].page_number, wal->page_buffer);
+        }
+        else
+        {
+            result = pwrite_full(db_fd, wal->page_buffer, (size_t)wal->page_size,
+                                 (off_t)entries[i].page_number * wal->page_size);
+        }
+    }
+    free(entries);
+
+    // the datafile has everything once it is synced, only then may the frames go.
+    if (result == 0 && fdatasync(db_fd) == 0)
+    {
+        wal->stats.datafile_syncs++;
+        wal->base += wal->committed;
+        wal->synced = wal->base;
+        result = wal_reset(wal, wal->committed);
+        wal->stats.checkpoints++;
+    }
+    else
+    {
+        result = -1;
+    }
+    pthread_mutex_unlock(&wal->lock);
+    return result;
+}
+
+WalStats wal_stats(Wal *wal)
+{
+    pthread_mutex_lock(&wal->lock);
+    WalStats stats = wal->stats;
+    pthread_mutex_unlock(&wal->lock);
+    return stats;
+}
@@ -0,0 +1,163 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "async_io.h"
+
+#define TEST_FILE       "async_io_test.db"
+#define TEST_PAGE_SIZE  4096
+#define TEST_PAGES      64
+
+static uint8_t pages[TEST_PAGES][TEST_PAGE_SIZE];
+
+static int open_test_file()
+{
+    int fd = open(TEST_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    assert_true(fd >= 0);
+    return fd;
+}
+
+// writes `TEST_PAGES` pages through the queue, then reads them back in reverse order and compares them.
+static void round_trip(AsyncBackend backend)
+{
+    int fd = open_test_file();
+    AsyncIO *aio = async_io_open(fd, TEST_PAGE_SIZE, 8, backend);
+    assert_non_null(aio);
+
+    PageRequest requests[TEST_PAGES];
+    for (int i = 0; i < TEST_PAGES; i++)
+    {
+        snprintf((char *)pages[i], TEST_PAGE_SIZE, "page number %d", i);
+        requests[i] = (PageRequest){.page_number = i, .buffer = pages[i], .write = true, .result = -1};
+    }
+
+    int submitted = 0, completed = 0;
+    while (completed < TEST_PAGES)
+    {
+        int n = async_io_submit(aio, requests + submitted, TEST_PAGES - submitted);
+        assert_true(n >= 0);
+        submitted += n;
+        completed += async_io_reap(aio, 1);
+    }
+    assert_int_equal(async_io_in_flight(aio), 0);
+
+    for (int i = 0; i < TEST_PAGES; i++)
+    {
+        assert_int_equal(requests[i].result, 0);
+        memset(pages[i], 0, TEST_PAGE_SIZE);
+        requests[i] = (PageRequest){.page_number = TEST_PAGES - 1 - i, .buffer = pages[i], .write = false, .result = -1};
+    }
+
+    submitted = 0;
+    completed = 0;
+    while (completed < TEST_PAGES)
+    {
+        submitted += async_io_submit(aio, requests + submitted, TEST_PAGES - submitted);
+        completed += async_io_reap(aio, 1);
+    }
+
+    for (int i = 0; i < TEST_PAGES; i++)
+    {
+        char expected[32];
+        snprintf(expected, sizeof(expected), "page number %d", TEST_PAGES - 1 - i);
+        assert_int_equal(requests[i].result, 0);
+        assert_string_equal((char *)pages[i], expected);
+    }
+
+    async_io_close(aio);
+    close(fd);
+}
+
+static void test_sync_backend_round_trip(void **state)
+{
+    (void)state;
+    round_trip(ASYNC_BACKEND_SYNC);
+}
+
+static void test_auto_backend_round_trip(void **state)
+{
+    (void)state;
+    round_trip(ASYNC_BACKEND_AUTO);
+}
+
+static void test_backend_selection(void **state)
+{
+    (void)state;
+    int fd = open_test_file();
+
+    AsyncIO *aio = async_io_open(fd, TEST_PAGE_SIZE, 4, ASYNC_BACKEND_SYNC);
+    assert_int_equal(async_io_backend(aio), ASYNC_BACKEND_SYNC);
+    async_io_close(aio);
+
+    // the automatic selection never fails, it settles on whichever backend works here.
+    aio = async_io_open(fd, TEST_PAGE_SIZE, 4, ASYNC_BACKEND_AUTO);
+    assert_non_null(aio);
+    assert_int_not_equal(async_io_backend(aio), ASYNC_BACKEND_AUTO);
+    async_io_close(aio);
+
+    close(fd);
+}
+
+static void test_queue_depth_limits_submission(void **state)
+{
+    (void)state;
+    int fd = open_test_file();
+    AsyncIO *aio = async_io_open(fd, TEST_PAGE_SIZE, 4, ASYNC_BACKEND_AUTO);
+
+    PageRequest requests[10];
+    for (int i = 0; i < 10; i++)
+    {
+        requests[i] = (PageRequest){.page_number = i, .buffer = pages[i], .write = true, .result = -1};
+    }
+
+    assert_int_equal(async_io_submit(aio, requests, 10), 4);
+    assert_int_equal(async_io_in_flight(aio), 4);
+    assert_int_equal(async_io_submit(aio, requests + 4, 6), 0);
+    assert_int_equal(async_io_reap(aio, 4), 4);
+    assert_int_equal(async_io_in_flight(aio), 0);
+    assert_int_equal(async_io_submit(aio, requests + 4, 6), 4);
+
+    async_io_close(aio);
+    close(fd);
+}
+
+static void test_read_past_end_of_file(void **state)
+{
+    (void)state;
+    int fd = open_test_file();
+    AsyncIO *aio = async_io_open(fd, TEST_PAGE_SIZE, 4, ASYNC_BACKEND_AUTO);
+
+    memset(pages[0], 0xAB, TEST_PAGE_SIZE);
+    PageRequest request = {.page_number = 1000, .buffer = pages[0], .write = false, .result = -1};
+    assert_int_equal(async_io_submit(aio, &request, 1), 1);
+    assert_int_equal(async_io_reap(aio, 1), 1);
+
+    assert_int_equal(request.result, 0);
+    for (int i = 0; i < TEST_PAGE_SIZE; i++)
+    {
+        assert_int_equal(pages[0][i], 0);
+    }
+
+    async_io_close(aio);
+    close(fd);
+    unlink(TEST_FILE);
+}
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_sync_backend_round_trip),
+        cmocka_unit_test(test_auto_backend_round_trip),
+        cmocka_unit_test(test_backend_selection),
+        cmocka_unit_test(test_queue_depth_limits_submission),
+        cmocka_unit_test(test_read_past_end_of_file),
+    };
+
+    return cmocka_run_group_tests(tests, nullptr, nullptr);
+}
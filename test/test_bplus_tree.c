@@ -0,0 +1,320 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bplus_tree.h"
+
+#define TEST_PATH   "test_bplus_tree.db"
+#define KEYS        20000
+#define CACHE_FRAMES 64 // a single shard of the buffer pool
+
+static int root_page;
+
+// keys are inserted in a scattered order, `i * 7919` modulo `KEYS` visits every key once.
+static int64_t key_at(int i)
+{
+    return (int64_t)(i * 7919 % KEYS) * 3 - KEYS;
+}
+
+static int value_of(int64_t key, char *value)
+{
+    return sprintf(value, "value of %lld%.*s", (long long)key, (int)(key & 15), "................");
+}
+
+static void assert_value(BPlusTree *tree, int64_t key)
+{
+    char expected[64];
+    char value[64];
+    int length = value_of(key, expected);
+    assert_int_equal(bplus_get(tree, key, value, sizeof(value)), length);
+    assert_memory_equal(value, expected, length);
+}
+
+static void test_put_and_get(void **state)
+{
+    (void)state;
+    remove(TEST_PATH);
+    DatabaseOptions options = {.cache_size = 64};
+    Pager *pager = open_database(TEST_PATH, &options);
+    assert_non_null(pager);
+    root_page = bplus_create(pager);
+    assert_int_not_equal(root_page, -1);
+    BPlusTree *tree = bplus_open(pager, root_page);
+    assert_non_null(tree);
+    assert_int_equal(bplus_height(tree), 1);
+
+    char value[64];
+    for (int i = 0; i < KEYS; i++)
+    {
+        int64_t key = key_at(i);
+        assert_int_equal(bplus_put(tree, key, value, value_of(key, value)), 0);
+    }
+    assert_true(bplus_height(tree) >= 2);
+    for (int i = 0; i < KEYS; i++)
+    {
+        assert_value(tree, key_at(i));
+    }
+    assert_int_equal(bplus_get(tree, 2, value, sizeof(value)), -1); // every key is a multiple of 3 plus 1
+    assert_int_equal(errno, ENOENT);
+    assert_int_equal(bplus_get(tree, INT64_MAX, value, sizeof(value)), -1);
+
+    // the nodes went through the buffer pool, which is far smaller than the tree
+    CacheStats stats = cache_stats(pager);
+    assert_true(stats.hits > 0);
+    assert_true(stats.evictions > 0);
+
+    bplus_close(tree);
+    assert_int_equal(close_database(pager), 0);
+}
+
+static void test_reopen(void **state)
+{
+    (void)state;
+    Pager *pager = open_database(TEST_PATH, nullptr);
+    assert_non_null(pager);
+    BPlusTree *tree = bplus_open(pager, root_page);
+    assert_non_null(tree);
+    for (int i = 0; i < KEYS; i++)
+    {
+        assert_value(tree, key_at(i));
+    }
+    bplus_close(tree);
+
+    // the bitmap page isn't the root of a tree
+    assert_null(bplus_open(pager, 1));
+    assert_int_equal(close_database(pager), 0);
+}
+
+static void test_replace_and_delete(void **state)
+{
+    (void)state;
+    Pager *pager = open_database(TEST_PATH, nullptr);
+    assert_non_null(pager);
+    BPlusTree *tree = bplus_open(pager, root_page);
+    assert_non_null(tree);
+
+    // values grow and shrink in place, their leaves are compacted or split as needed
+    char value[200];
+    for (int i = 0; i < KEYS; i += 2)
+    {
+        int length = 1 + key_at(i) % 100 + 100;
+        memset(value, 'a' + i % 26, length);
+        assert_int_equal(bplus_put(tree, key_at(i), value, length), 0);
+    }
+    for (int i = 1; i < KEYS; i += 2)
+    {
+        assert_int_equal(bplus_delete(tree, key_at(i)), 0);
+    }
+    assert_int_equal(bplus_delete(tree, key_at(1)), -1);
+    assert_int_equal(errno, ENOENT);
+
+    for (int i = 0; i < KEYS; i++)
+    {
+        if (i % 2 == 1)
+        {
+            assert_int_equal(bplus_get(tree, key_at(i), value, sizeof(value)), -1);
+            continue;
+        }
+        char expected[200];
+        int length = 1 + key_at(i) % 100 + 100;
+        memset(expected, 'a' + i % 26, length);
+        assert_int_equal(bplus_get(tree, key_at(i), value, sizeof(value)), length);
+        assert_memory_equal(value, expected, length);
+    }
+
+    // deleted keys come back
+    for (int i = 1; i < KEYS; i += 2)
+    {
+        int64_t key = key_at(i);
+        assert_int_equal(bplus_put(tree, key, value, value_of(key, value)), 0);
+        assert_value(tree, key);
+    }
+    bplus_close(tree);
+    assert_int_equal(close_database(pager), 0);
+}
+
+static void test_value_sizes(void **state)
+{
+    (void)state;
+    Pager *pager = open_database(TEST_PATH, nullptr);
+    assert_non_null(pager);
+    int root = bplus_create(pager);
+    BPlusTree *tree = bplus_open(pager, root);
+    assert_non_null(tree);
+
+    int max = bplus_max_value(tree);
+    assert_true(max >= DEFAULT_PAGE_SIZE / 5);
+    uint8_t *value = malloc(max + 1);
+    uint8_t *read = malloc(max + 1);
+    memset(value, 0x5A, max + 1);
+    assert_int_equal(bplus_put(tree, 1, value, max + 1), -1);
+    assert_int_equal(errno, EINVAL);
+
+    // every leaf holds a few of the largest values
+    for (int i = 0; i < 64; i++)
+    {
+        value[0] = (uint8_t)i;
+        assert_int_equal(bplus_put(tree, i, value, max), 0);
+    }
+    assert_int_equal(bplus_put(tree, 64, value, 0), 0);
+    for (int i = 0; i < 64; i++)
+    {
+        value[0] = (uint8_t)i;
+        assert_int_equal(bplus_get(tree, i, read, max), max);
+        assert_memory_equal(read, value, max);
+    }
+    assert_int_equal(bplus_get(tree, 64, read, max), 0);
+
+    // a thousand leaves don't fit under one internal node: the root splits a second time
+    for (int i = 0; i < 4000; i++)
+    {
+        int64_t key = 100 + i * 997 % 4000;
+        memcpy(value, &key, sizeof(key));
+        assert_int_equal(bplus_put(tree, key, value, max), 0);
+    }
+    assert_int_equal(bplus_height(tree), 3);
+    for (int64_t key = 100; key < 4100; key++)
+    {
+        assert_int_equal(bplus_get(tree, key, read, max), max);
+        assert_memory_equal(read, &key, sizeof(key));
+    }
+
+    // a short buffer receives the start of the value
+    memset(read, 0, max);
+    assert_int_equal(bplus_get(tree, 3, read, 4), max);
+    assert_int_equal(read[0], 3);
+    assert_int_equal(read[4], 0);
+
+    free(value);
+    free(read);
+    bplus_close(tree);
+    assert_int_equal(close_database(pager), 0);
+    remove(TEST_PATH);
+}
+
+static int used_pages(Pager *pager)
+{
+    DatabaseHeader header = database_header(pager);
+    return (int)(header.page_count - header.free_count);
+}
+
+// fills `value` with the value of `key` under test in `test_failed_split`.
+static void pressure_value(int64_t key, uint8_t *value, int length)
+{
+    memset(value, (int)key, length);
+}
+
+static void assert_pressure_values(BPlusTree *tree, const int *lengths, int count, uint8_t *value, uint8_t *read)
+{
+    for (int64_t key = 0; key < count; key++)
+    {
+        pressure_value(key, value, lengths[key]);
+        assert_int_equal(bplus_get(tree, key, read, bplus_max_value(tree)), lengths[key]);
+        assert_memory_equal(read, value, lengths[key]);
+    }
+}
+
+// replaces `key` while every frame of the pool but `free_frames` is pinned, one more frame each time until the
+// put succeeds. every put that fails leaves the values and the pages in use as they were.
+static int put_under_pressure(Pager *pager, BPlusTree *tree, int pinned, int64_t key, int *lengths, int count)
+{
+    int max = bplus_max_value(tree);
+    uint8_t *value = malloc(max);
+    uint8_t *read = malloc(max);
+    int used = used_pages(pager);
+    int free_frames = 0;
+    for (;; free_frames++)
+    {
+        assert_true(free_frames <= CACHE_FRAMES);
+        for (int i = 0; i < CACHE_FRAMES - free_frames; i++)
+        {
+            assert_non_null(pin_page(pager, pinned + i));
+        }
+        pressure_value(key, value, max);
+        int result = bplus_put(tree, key, value, max);
+        for (int i = 0; i < CACHE_FRAMES - free_frames; i++)
+        {
+            assert_int_equal(unpin_page(pager, pinned + i, false), 0);
+        }
+        if (result == 0)
+        {
+            break;
+        }
+        assert_int_equal(used_pages(pager), used);
+        assert_pressure_values(tree, lengths, count, value, read);
+    }
+    lengths[key] = max;
+    assert_pressure_values(tree, lengths, count, value, read);
+    free(value);
+    free(read);
+    return free_frames;
+}
+
+static void test_failed_split(void **state)
+{
+    (void)state;
+    remove(TEST_PATH);
+    DatabaseOptions options = {.cache_size = CACHE_FRAMES, .cache_shards = 1};
+    Pager *pager = open_database(TEST_PATH, &options);
+    assert_non_null(pager);
+    int root = bplus_create(pager);
+    BPlusTree *tree = bplus_open(pager, root);
+    assert_non_null(tree);
+    int pinned = allocate_pages(pager, CACHE_FRAMES);
+    assert_int_not_equal(pinned, -1);
+
+    // three of the largest values and two short ones fill a leaf: replacing a short one by a large one splits it
+    int max = bplus_max_value(tree);
+    int lengths[10];
+    uint8_t *value = malloc(max);
+    for (int64_t key = 0; key < 10; key++)
+    {
+        lengths[key] = key % 5 < 3 ? max : 400;
+    }
+    for (int64_t key = 0; key < 5; key++)
+    {
+        pressure_value(key, value, lengths[key]);
+        assert_int_equal(bplus_put(tree, key, value, lengths[key]), 0);
+    }
+    assert_int_equal(bplus_height(tree), 1);
+
+    // the root leaf splits and grows into an internal node, which takes two new pages
+    int used = used_pages(pager);
+    assert_true(put_under_pressure(pager, tree, pinned, 3, lengths, 5) > 2);
+    assert_int_equal(used_pages(pager), used + 2);
+    assert_int_equal(bplus_height(tree), 2);
+
+    // a leaf below the root splits, the root takes the new separator
+    for (int64_t key = 5; key < 10; key++)
+    {
+        pressure_value(key, value, lengths[key]);
+        assert_int_equal(bplus_put(tree, key, value, lengths[key]), 0);
+    }
+    used = used_pages(pager);
+    assert_true(put_under_pressure(pager, tree, pinned, 8, lengths, 10) > 2);
+    assert_int_equal(used_pages(pager), used + 1);
+    assert_int_equal(bplus_height(tree), 2);
+
+    free(value);
+    bplus_close(tree);
+    assert_int_equal(close_database(pager), 0);
+    remove(TEST_PATH);
+}
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_put_and_get),
+        cmocka_unit_test(test_reopen),
+        cmocka_unit_test(test_replace_and_delete),
+        cmocka_unit_test(test_value_sizes),
+        cmocka_unit_test(test_failed_split),
+    };
+
+    return cmocka_run_group_tests(tests, nullptr, nullptr);
+}
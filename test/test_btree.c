@@ -13,11 +13,11 @@ static void test_btree_insert_nonfull_leaf(void **state)
 {
     (void)state;
     BTreeNode *node = new_node(1, 1);
-    node->pairs[0] = (Pair){.key_type = INT, .key = (Key){.integer = 10}};
-    btree_insert_nonfull(node, node->pairs[0]);
+    node->keys[0] = (Key){.integer = 10};
+    btree_insert_nonfull(node, (Pair){.key_type = INT, .key = (Key){.integer = 10}});
 
     assert_int_equal(node->num_pairs, 2);
-    assert_int_equal(node->pairs[1].key.integer, 10);
+    assert_int_equal(node->keys[1].integer, 10);
 
     free_node(node);
 }
@@ -26,23 +26,24 @@ static void test_btree_insert_nonfull_nonleaf(void **state)
 {
     (void)state;
     BTreeNode *root = new_node(1, 0);
-    root->pairs[0] = (Pair){.key_type = INT, .key = (Key){.integer = 20}};
+    root->keys[0] = (Key){.integer = 20};
     root->children[0] = new_node(1, 1);
-    root->children[0]->pairs[0] = (Pair){.key_type = INT, .key = (Key){.integer = 10}};
+    root->children[0]->keys[0] = (Key){.integer = 10};
     root->children[1] = new_node(2, 1);
-    root->children[1]->pairs[0] = root->pairs[0];
-    root->children[1]->pairs[1] = (Pair){.key_type = INT, .key = (Key){.integer = 30}};
+    root->children[1]->keys[0] = root->keys[0];
+    root->children[1]->keys[1] = (Key){.integer = 30};
 
     btree_insert_nonfull(root, (Pair){.key_type = INT, .value_type = STR, .key = (Key){.integer = 25}, .value = (Value){.column = "25"}});
 
     assert_int_equal(root->num_pairs, 1);
-    assert_int_equal(root->pairs[0].key.integer, 20);
+    assert_int_equal(root->keys[0].integer, 20);
     assert_int_equal(root->children[0]->num_pairs, 1);
-    assert_int_equal(root->children[0]->pairs[0].key.integer, 10);
+    assert_int_equal(root->children[0]->keys[0].integer, 10);
     assert_int_equal(root->children[1]->num_pairs, 3);
-    assert_int_equal(root->children[1]->pairs[0].key.integer, 20);
-    assert_int_equal(root->children[1]->pairs[1].key.integer, 25);
-    assert_int_equal(root->children[1]->pairs[2].key.integer, 30);
+    assert_int_equal(root->children[1]->keys[0].integer, 20);
+    assert_int_equal(root->children[1]->keys[1].integer, 25);
+    assert_int_equal(root->children[1]->keys[2].integer, 30);
+    assert_string_equal(root->children[1]->values[1].column, "25");
 
     free_node(root);
 }
@@ -52,30 +53,63 @@ static void test_btree_split_child(void **state)
     (void)state;
 
     BTreeNode *parent = new_node(1, 0);
-    parent->pairs[0] = (Pair){.key_type = INT, .key = {.integer = 10}};
+    parent->keys[0] = (Key){.integer = 10 * MAX_PAIRS};
 
     // Child that will be split
-    parent->children[0] = new_node(3, 1);
-    parent->children[0]->pairs[0] = (Pair){.key_type = INT, .key = {.integer = 5}};
-    parent->children[0]->pairs[1] = (Pair){.key_type = INT, .key = {.integer = 8}};
-    parent->children[0]->pairs[2] = (Pair){.key_type = INT, .key = {.integer = 9}};
-
+    BTreeNode *child = new_node(MAX_PAIRS, 1);
+    for (int i = 0; i < MAX_PAIRS; i++)
+    {
+        child->keys[i] = (Key){.integer = 10 * i};
+    }
+    parent->children[0] = child;
+    parent->children[1] = new_node(0, 1);
 
     btree_split_child(parent, 0);
 
-    // Parent should now have an extra key
+    // Parent should now have an extra key, the first key of the new leaf
+    int mid = MAX_PAIRS / 2;
     assert_int_equal(parent->num_pairs, 2);
-    assert_int_equal(parent->pairs[0].key.integer, 8);
-    assert_int_equal(parent->pairs[1].key.integer, 10);
+    assert_int_equal(parent->keys[0].integer, 10 * mid);
+    assert_int_equal(parent->keys[1].integer, 10 * MAX_PAIRS);
 
-    // Left child should have only one key
-    assert_int_equal(parent->children[0]->num_pairs, 1);
-    assert_int_equal(parent->children[0]->pairs[0].key.integer, 5);
+    // Left child keeps the lower half
+    assert_int_equal(parent->children[0]->num_pairs, mid);
+    assert_int_equal(parent->children[0]->keys[mid - 1].integer, 10 * (mid - 1));
 
-    // Right child should have one key
-    assert_int_equal(parent->children[1]->num_pairs, 2);
-    assert_int_equal(parent->children[1]->pairs[0].key.integer, 8);
-    assert_int_equal(parent->children[1]->pairs[1].key.integer, 9);
+    // Right child takes the upper half, the leaves stay chained
+    assert_int_equal(parent->children[1]->num_pairs, MAX_PAIRS - mid);
+    assert_int_equal(parent->children[1]->keys[0].integer, 10 * mid);
+    assert_ptr_equal(parent->children[0]->next, parent->children[1]);
+
+    free_node(parent);
+}
+
+static void test_btree_split_internal_child(void **state)
+{
+    (void)state;
+    BTreeNode *parent = new_node(0, 0);
+    BTreeNode *child = new_node(MAX_PAIRS, 0);
+    for (int i = 0; i < MAX_PAIRS; i++)
+    {
+        child->keys[i] = (Key){.integer = i};
+    }
+    for (int i = 0; i <= MAX_PAIRS; i++)
+    {
+        child->children[i] = new_node(0, 1);
+    }
+    BTreeNode *middle_child = child->children[MAX_PAIRS / 2 + 1];
+    parent->children[0] = child;
+
+    btree_split_child(parent, 0);
+
+    // the middle key moves up instead of being copied
+    int mid = MAX_PAIRS / 2;
+    assert_int_equal(parent->num_pairs, 1);
+    assert_int_equal(parent->keys[0].integer, mid);
+    assert_int_equal(parent->children[0]->num_pairs, mid);
+    assert_int_equal(parent->children[1]->num_pairs, MAX_PAIRS - mid - 1);
+    assert_int_equal(parent->children[1]->keys[0].integer, mid + 1);
+    assert_ptr_equal(parent->children[1]->children[0], middle_child);
 
     free_node(parent);
 }
@@ -89,8 +123,8 @@ static void test_insert_into_empty_tree(void **state)
     btree_insert(&root, (Pair){.key_type = INT, .key = (Key){.integer = 20}, (Value){}});
 
     assert_int_equal(root->num_pairs, 2);
-    assert_int_equal(root->pairs[0].key.integer, 10);
-    assert_int_equal(root->pairs[1].key.integer, 20);
+    assert_int_equal(root->keys[0].integer, 10);
+    assert_int_equal(root->keys[1].integer, 20);
 
     // Free memory
     free_node(root);
@@ -101,25 +135,26 @@ static void test_insert_causing_split(void **state)
     (void)state;
     BTreeNode *root = new_node(0, 1); // Start with an empty tree
 
-    // Insert keys that will cause a split
-    btree_insert(&root, (Pair){.key_type = INT, .key = (Key){.integer = 10}, .value = (Value){}});
-    btree_insert(&root, (Pair){.key_type = INT, .key = (Key){.integer = 20}, .value = (Value){}});
-    btree_insert(&root, (Pair){.key_type = INT, .key = (Key){.integer = 5}, .value = (Value){}});
-    btree_insert(&root, (Pair){.key_type = INT, .key = (Key){.integer = 30}, .value = (Value){}});
+    // Fill the root, the next key splits it
+    for (int i = 0; i <= MAX_PAIRS; i++)
+    {
+        btree_insert(&root, (Pair){.key_type = INT, .key = (Key){.integer = 10 * i}, .value = (Value){}});
+    }
 
     // After splitting, the tree should be balanced correctly
+    int mid = MAX_PAIRS / 2;
+    assert_false(root->is_leaf);
     assert_int_equal(root->num_pairs, 1);
-    assert_int_equal(root->pairs[0].key.integer, 10); // The middle key moves up
+    assert_int_equal(root->keys[0].integer, 10 * mid); // The middle key moves up
 
-    // Left child should contain [5]
-    assert_int_equal(root->children[0]->num_pairs, 1);
-    assert_int_equal(root->children[0]->pairs[0].key.integer, 5);
+    // Left child should contain the keys below it
+    assert_int_equal(root->children[0]->num_pairs, mid);
+    assert_int_equal(root->children[0]->keys[0].integer, 0);
 
-    // Right child should contain [10, 20, 30]
-    assert_int_equal(root->children[1]->num_pairs, 3);
-    assert_int_equal(root->children[1]->pairs[0].key.integer, 10);
-    assert_int_equal(root->children[1]->pairs[1].key.integer, 20);
-    assert_int_equal(root->children[1]->pairs[2].key.integer, 30);
+    // Right child should contain the middle key and the ones above
+    assert_int_equal(root->children[1]->num_pairs, MAX_PAIRS - mid + 1);
+    assert_int_equal(root->children[1]->keys[0].integer, 10 * mid);
+    assert_int_equal(root->children[1]->keys[MAX_PAIRS - mid].integer, 10 * MAX_PAIRS);
 
     free_node(root);
 }
@@ -150,6 +185,189 @@ static void test_btree_search(void **state)
     free_node(root);
 }
 
+static void test_btree_height(void **state)
+{
+    (void)state;
+    BTreeNode *root = new_node(0, 1);
+    int count = 200000;
+    for (int i = 0; i < count; i++)
+    {
+        int key = (int)((long long)i * 7919 % count);
+        btree_insert(&root, (Pair){.key_type = INT, .value_type = INT, .key = {.integer = key}, .value = {}});
+    }
+
+    // nodes of a page hold a hundred keys or more, a few levels cover the whole tree
+    int height = 1;
+    for (BTreeNode *node = root; !node->is_leaf; node = node->children[0])
+    {
+        height++;
+    }
+    assert_true(height <= 3);
+
+    for (int key = -1; key <= count; key++)
+    {
+        Pair pair = {.key_type = INT, .key = {.integer = key}};
+        assert_int_equal(btree_search(root, &pair), key >= 0 && key < count);
+    }
+
+    free_node(root);
+}
+
+static void test_btree_cursor(void **state)
+{
+    (void)state;
+    BTreeNode *root = new_node(0, 1);
+    BTreeCursor cursor = btree_seek(root, INT, (Key){.integer = 0});
+    assert_false(cursor_valid(&cursor));
+    cursor = btree_first(root);
+    assert_false(cursor_next(&cursor));
+
+    // even keys only, spread over many leaves
+    int count = 20000;
+    for (int i = 0; i < count; i++)
+    {
+        int key = (int)((long long)i * 7919 % count) * 2;
+        btree_insert(&root, (Pair){.key_type = INT, .value_type = POINTER, .key = {.integer = key}, .value = {}});
+    }
+
+    // a range scan starts at the first key not below its bound and follows the leaves
+    cursor = btree_seek(root, INT, (Key){.integer = 1001});
+    for (int key = 1002; key < 3000; key += 2)
+    {
+        assert_true(cursor_valid(&cursor));
+        assert_int_equal(cursor_key(&cursor).integer, key);
+        assert_int_equal(cursor_value_type(&cursor), POINTER);
+        cursor_next(&cursor);
+    }
+    cursor = btree_seek(root, INT, (Key){.integer = 1000});
+    assert_int_equal(cursor_key(&cursor).integer, 1000);
+    cursor = btree_seek(root, INT, (Key){.integer = count * 2});
+    assert_false(cursor_valid(&cursor));
+
+    // both ends of the tree are reached in order
+    int seen = 0;
+    for (cursor = btree_first(root); cursor_valid(&cursor); cursor_next(&cursor))
+    {
+        assert_int_equal(cursor_key(&cursor).integer, seen * 2);
+        seen++;
+    }
+    assert_int_equal(seen, count);
+    for (cursor = btree_last(root); cursor_valid(&cursor); cursor_prev(&cursor))
+    {
+        seen--;
+        assert_int_equal(cursor_key(&cursor).integer, seen * 2);
+    }
+    assert_int_equal(seen, 0);
+    assert_false(cursor_prev(&cursor));
+
+    // equal keys spanning several leaves are all found from the first one
+    for (int i = 0; i < 3 * MAX_PAIRS; i++)
+    {
+        btree_insert(&root, (Pair){.key_type = INT, .value_type = STR, .key = {.integer = 501}, .value = {.column = "dup"}});
+    }
+    cursor = btree_seek(root, INT, (Key){.integer = 501});
+    for (int i = 0; i < 3 * MAX_PAIRS; i++)
+    {
+        assert_int_equal(cursor_key(&cursor).integer, 501);
+        assert_string_equal(cursor_value(&cursor).column, "dup");
+        cursor_next(&cursor);
+    }
+    assert_int_equal(cursor_key(&cursor).integer, 502);
+    assert_true(cursor_prev(&cursor));
+    assert_true(cursor_prev(&cursor));
+    assert_int_equal(cursor_key(&cursor).integer, 501);
+
+    free_node(root);
+}
+
+static int height_of(BTreeNode *root)
+{
+    int height = 1;
+    for (BTreeNode *node = root; !node->is_leaf; node = node->children[0])
+    {
+        height++;
+    }
+    return height;
+}
+
+static void test_btree_bulk_load(void **state)
+{
+    (void)state;
+    int count = 100000;
+    Pair *pairs = malloc(sizeof(Pair) * count);
+    for (int i = 0; i < count; i++)
+    {
+        pairs[i] = (Pair){.key_type = INT, .value_type = INT, .key = {.integer = i * 2}, .value = {}};
+    }
+
+    assert_null(btree_bulk_load(pairs, count, 0));
+    assert_null(btree_bulk_load(pairs, count, 1.5));
+    pairs[10].key.integer = 0;
+    assert_null(btree_bulk_load(pairs, count, 1));
+    pairs[10].key.integer = 20;
+
+    BTreeNode *root = btree_bulk_load(pairs, 0, 1);
+    assert_true(root->is_leaf);
+    assert_int_equal(root->num_pairs, 0);
+    free_node(root);
+
+    double fill_factors[] = {1, 0.5, 0.01};
+    for (int f = 0; f < (int)(sizeof(fill_factors) / sizeof(fill_factors[0])); f++)
+    {
+        root = btree_bulk_load(pairs, count, fill_factors[f]);
+        assert_non_null(root);
+
+        // leaves hold their share of the fill factor, in key order
+        int leaves = 0;
+        int seen = 0;
+        int per_leaf = (int)(MAX_PAIRS * fill_factors[f]);
+        per_leaf = per_leaf < 1 ? 1 : per_leaf;
+        for (BTreeCursor cursor = btree_first(root); cursor_valid(&cursor); cursor_next(&cursor))
+        {
+            if (cursor.index == 0)
+            {
+                leaves++;
+                assert_true(cursor.leaf->num_pairs <= per_leaf);
+                assert_true(cursor.leaf->num_pairs >= per_leaf - 1);
+            }
+            assert_int_equal(cursor_key(&cursor).integer, seen * 2);
+            seen++;
+        }
+        assert_int_equal(seen, count);
+        assert_int_equal(leaves, (count + per_leaf - 1) / per_leaf);
+        for (int key = -1; key <= count * 2; key++)
+        {
+            Pair pair = {.key_type = INT, .key = {.integer = key}};
+            assert_int_equal(btree_search(root, &pair), key >= 0 && key < count * 2 && key % 2 == 0);
+        }
+
+        // insertions into the loaded tree split its nodes as usual
+        for (int key = 1; key < count * 2; key += 20)
+        {
+            btree_insert(&root, (Pair){.key_type = INT, .value_type = INT, .key = {.integer = key}, .value = {}});
+        }
+        for (int key = 1; key < count * 2; key += 20)
+        {
+            Pair pair = {.key_type = INT, .key = {.integer = key}};
+            assert_true(btree_search(root, &pair));
+        }
+        BTreeCursor cursor = btree_seek(root, INT, (Key){.integer = 0});
+        while (cursor_next(&cursor))
+        {
+            BTreeCursor previous = cursor;
+            cursor_prev(&previous);
+            assert_true(cursor_key(&previous).integer < cursor_key(&cursor).integer);
+        }
+        free_node(root);
+    }
+
+    // full nodes keep the tree as low as the insertions do
+    root = btree_bulk_load(pairs, count, 1);
+    assert_int_equal(height_of(root), 3);
+    free_node(root);
+    free(pairs);
+}
+
 int main(void)
 {
     const struct CMUnitTest tests[] =
@@ -157,9 +375,13 @@ int main(void)
             cmocka_unit_test(test_btree_insert_nonfull_leaf),
             cmocka_unit_test(test_btree_insert_nonfull_nonleaf),
             cmocka_unit_test(test_btree_split_child),
+            cmocka_unit_test(test_btree_split_internal_child),
             cmocka_unit_test(test_insert_into_empty_tree),
             cmocka_unit_test(test_insert_causing_split),
             cmocka_unit_test(test_btree_search),
+            cmocka_unit_test(test_btree_height),
+            cmocka_unit_test(test_btree_cursor),
+            cmocka_unit_test(test_btree_bulk_load),
         };
     return cmocka_run_group_tests(tests, nullptr, nullptr);
 }
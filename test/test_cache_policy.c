@@ -0,0 +1,170 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cache_policy.h"
+
+#define POOL_FRAMES 16
+#define HOT_PAGES   4
+#define SCAN_LENGTH 20
+
+// SimulatedPool maps the frames of a policy to page numbers, the way the buffer pool does.
+typedef struct SimulatedPool
+{
+    CachePolicy *policy;
+    int pages[POOL_FRAMES];
+    bool pinned[POOL_FRAMES];
+    int used;
+} SimulatedPool;
+
+static bool is_unpinned(int frame, void *context)
+{
+    return !((SimulatedPool *)context)->pinned[frame];
+}
+
+static SimulatedPool simulated_pool(CachePolicyKind kind)
+{
+    SimulatedPool pool = {.policy = cache_policy_create(kind, POOL_FRAMES)};
+    assert_non_null(pool.policy);
+    assert_int_equal(cache_policy_kind(pool.policy), kind);
+    return pool;
+}
+
+// requests `page_number` and returns true on a hit.
+static bool access_page(SimulatedPool *pool, int page_number)
+{
+    for (int frame = 0; frame < pool->used; frame++)
+    {
+        if (pool->pages[frame] == page_number)
+        {
+            cache_policy_touch(pool->policy, frame);
+            return true;
+        }
+    }
+
+    int frame = pool->used;
+    if (frame < POOL_FRAMES)
+    {
+        pool->used++;
+    }
+    else
+    {
+        frame = cache_policy_victim(pool->policy, page_number, is_unpinned, pool);
+        assert_int_not_equal(frame, -1);
+        cache_policy_evict(pool->policy, frame);
+    }
+    pool->pages[frame] = page_number;
+    cache_policy_insert(pool->policy, frame, page_number);
+    return false;
+}
+
+// a few hot pages are requested between long scans that never come back.
+// returns how many requests of the hot pages hit once the hot pages had been seen a few times.
+static int hot_hits_during_scans(CachePolicyKind kind, int rounds)
+{
+    SimulatedPool pool = simulated_pool(kind);
+    int next_scanned = 1000;
+
+    // the hot pages are seen a few times, with just enough other pages in between to push them out of a FIFO.
+    for (int pass = 0; pass < 3; pass++)
+    {
+        for (int i = 0; i < HOT_PAGES; i++)
+        {
+            access_page(&pool, i);
+        }
+        for (int i = 0; i < POOL_FRAMES / 2; i++)
+        {
+            access_page(&pool, next_scanned++);
+        }
+    }
+
+    int hits = 0;
+    for (int round = 0; round < rounds; round++)
+    {
+        for (int i = 0; i < SCAN_LENGTH; i++)
+        {
+            access_page(&pool, next_scanned++);
+        }
+        for (int i = 0; i < HOT_PAGES; i++)
+        {
+            hits += access_page(&pool, i);
+        }
+    }
+    cache_policy_destroy(pool.policy);
+    return hits;
+}
+
+static void test_lru_evicts_least_recently_used(void **state)
+{
+    (void)state;
+    SimulatedPool pool = simulated_pool(CACHE_POLICY_LRU);
+    for (int page_number = 0; page_number < POOL_FRAMES; page_number++)
+    {
+        assert_false(access_page(&pool, page_number));
+    }
+    assert_true(access_page(&pool, 0));
+
+    assert_int_equal(cache_policy_victim(pool.policy, 99, is_unpinned, &pool), 1);
+    pool.pinned[1] = true;
+    assert_int_equal(cache_policy_victim(pool.policy, 99, is_unpinned, &pool), 2);
+
+    for (int frame = 0; frame < POOL_FRAMES; frame++)
+    {
+        pool.pinned[frame] = true;
+    }
+    assert_int_equal(cache_policy_victim(pool.policy, 99, is_unpinned, &pool), -1);
+    cache_policy_destroy(pool.policy);
+}
+
+static void test_lru_loses_hot_pages_to_scans(void **state)
+{
+    (void)state;
+    assert_int_equal(hot_hits_during_scans(CACHE_POLICY_LRU, 50), 0);
+}
+
+static void test_2q_keeps_hot_pages_during_scans(void **state)
+{
+    (void)state;
+    assert_int_equal(hot_hits_during_scans(CACHE_POLICY_2Q, 50), 50 * HOT_PAGES);
+}
+
+static void test_arc_keeps_hot_pages_during_scans(void **state)
+{
+    (void)state;
+    assert_int_equal(hot_hits_during_scans(CACHE_POLICY_ARC, 50), 50 * HOT_PAGES);
+}
+
+static void test_2q_promotes_pages_found_in_history(void **state)
+{
+    (void)state;
+    SimulatedPool pool = simulated_pool(CACHE_POLICY_2Q);
+    for (int page_number = 0; page_number < POOL_FRAMES + 2; page_number++)
+    {
+        access_page(&pool, page_number);
+    }
+
+    // page 0 was evicted first from the FIFO of new pages, its second request moves it to the main LRU
+    assert_false(access_page(&pool, 0));
+    for (int page_number = 100; page_number < 100 + 4 * POOL_FRAMES; page_number++)
+    {
+        access_page(&pool, page_number);
+    }
+    assert_true(access_page(&pool, 0));
+    cache_policy_destroy(pool.policy);
+}
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_lru_evicts_least_recently_used),
+        cmocka_unit_test(test_lru_loses_hot_pages_to_scans),
+        cmocka_unit_test(test_2q_keeps_hot_pages_during_scans),
+        cmocka_unit_test(test_arc_keeps_hot_pages_during_scans),
+        cmocka_unit_test(test_2q_promotes_pages_found_in_history),
+    };
+
+    return cmocka_run_group_tests(tests, nullptr, nullptr);
+}
@@ -0,0 +1,130 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "io_stats.h"
+
+#define THREADS         4
+#define THREAD_CALLS    10000
+
+static void test_buckets(void **state)
+{
+    (void)state;
+    LatencyRecorder recorder = {0};
+    latency_record(&recorder, 0);
+    latency_record(&recorder, 1);
+    latency_record(&recorder, 1000);  // 2^9 <= 1000 < 2^10
+    latency_record(&recorder, 1023);
+    latency_record(&recorder, 1024);
+    latency_record(&recorder, UINT64_MAX);
+
+    LatencyHistogram histogram = latency_snapshot(&recorder);
+    assert_int_equal(histogram.count, 6);
+    assert_int_equal(histogram.buckets[0], 2);
+    assert_int_equal(histogram.buckets[9], 2);
+    assert_int_equal(histogram.buckets[10], 1);
+    assert_int_equal(histogram.buckets[LATENCY_BUCKETS - 1], 1);
+    assert_true(histogram.max_ns == UINT64_MAX);
+}
+
+static void test_percentiles(void **state)
+{
+    (void)state;
+    LatencyHistogram empty = {0};
+    assert_int_equal(latency_percentile(&empty, 0.5), 0);
+
+    // 98 fast calls and 2 slow ones: the median is fast, the 99th percentile slow
+    LatencyRecorder recorder = {0};
+    for (int i = 0; i < 98; i++)
+    {
+        latency_record(&recorder, 3000);
+    }
+    latency_record(&recorder, 5000000);
+    latency_record(&recorder, 6000000);
+    LatencyHistogram histogram = latency_snapshot(&recorder);
+    assert_int_equal(latency_percentile(&histogram, 0.5), 4095);
+    assert_int_equal(latency_percentile(&histogram, 0.98), 4095);
+    assert_int_equal(latency_percentile(&histogram, 0.99), 6000000);
+    assert_int_equal(latency_percentile(&histogram, 1.0), 6000000);
+    assert_int_equal(histogram.total_ns, 98 * 3000 + 11000000);
+}
+
+static void test_dump(void **state)
+{
+    (void)state;
+    LatencyRecorder recorder = {0};
+    latency_record(&recorder, 1500);
+    latency_record(&recorder, 2500000);
+    LatencyHistogram histogram = latency_snapshot(&recorder);
+
+    char *text = nullptr;
+    size_t size = 0;
+    FILE *output = open_memstream(&text, &size);
+    assert_non_null(output);
+    assert_int_equal(latency_dump(&histogram, "read latency", output), 0);
+    fclose(output);
+
+    assert_non_null(strstr(text, "read latency: 2 calls"));
+    assert_non_null(strstr(text, "max 2.5 ms"));
+    assert_non_null(strstr(text, "1.0 us - 2.0 us"));
+    assert_non_null(strstr(text, "2.1 ms - 4.2 ms"));
+    int lines = 0;
+    for (const char *c = text; *c != '\0'; c++)
+    {
+        lines += *c == '\n';
+    }
+    assert_int_equal(lines, 3); // the summary and the two buckets in use
+    free(text);
+}
+
+static void *record_calls(void *argument)
+{
+    LatencyRecorder *recorder = argument;
+    for (int i = 0; i < THREAD_CALLS; i++)
+    {
+        latency_record(recorder, (uint64_t)i);
+    }
+    return nullptr;
+}
+
+static void test_concurrent_records(void **state)
+{
+    (void)state;
+    LatencyRecorder recorder = {0};
+    pthread_t threads[THREADS];
+    for (int i = 0; i < THREADS; i++)
+    {
+        assert_int_equal(pthread_create(&threads[i], nullptr, record_calls, &recorder), 0);
+    }
+    for (int i = 0; i < THREADS; i++)
+    {
+        pthread_join(threads[i], nullptr);
+    }
+
+    LatencyHistogram histogram = latency_snapshot(&recorder);
+    uint64_t total = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        total += histogram.buckets[i];
+    }
+    assert_int_equal(histogram.count, THREADS * THREAD_CALLS);
+    assert_int_equal(total, THREADS * THREAD_CALLS);
+    assert_int_equal(histogram.max_ns, THREAD_CALLS - 1);
+}
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_buckets),
+        cmocka_unit_test(test_percentiles),
+        cmocka_unit_test(test_dump),
+        cmocka_unit_test(test_concurrent_records),
+    };
+
+    return cmocka_run_group_tests(tests, nullptr, nullptr);
+}
@@ -0,0 +1,100 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+
+#include "key_search.h"
+
+#define MAX_KEYS 400
+
+// fills `keys` with `count` ascending keys, with runs of equal keys and negative ones.
+static void fill_keys(int64_t *keys, int count, unsigned seed)
+{
+    int64_t key = -1000 - rand_r(&seed) % 1000;
+    for (int i = 0; i < count; i++)
+    {
+        key += rand_r(&seed) % 4;
+        keys[i] = key;
+    }
+}
+
+// returns the rank by looking at every key.
+static int linear_rank(const int64_t *keys, int count, int64_t key, bool inclusive)
+{
+    int rank = 0;
+    while (rank < count && (keys[rank] < key || (inclusive && keys[rank] == key)))
+    {
+        rank++;
+    }
+    return rank;
+}
+
+static void test_scalar_is_always_supported(void **state)
+{
+    (void)state;
+    assert_true(key_search_supported(KEY_SEARCH_SCALAR));
+    assert_true(key_search_supported(key_search_kind()));
+    if (key_search_supported(KEY_SEARCH_AVX2))
+    {
+        assert_int_equal(key_search_kind(), KEY_SEARCH_AVX2);
+    }
+}
+
+static void test_every_kind_agrees(void **state)
+{
+    (void)state;
+    int64_t keys[MAX_KEYS];
+    for (int kind = KEY_SEARCH_SCALAR; kind <= KEY_SEARCH_AVX2; kind++)
+    {
+        if (!key_search_supported(kind))
+        {
+            continue;
+        }
+        for (int count = 0; count <= MAX_KEYS; count += count < 70 ? 1 : 37)
+        {
+            fill_keys(keys, count, (unsigned)count);
+            int64_t first = count > 0 ? keys[0] : 0;
+            int64_t last = count > 0 ? keys[count - 1] : 0;
+            for (int64_t key = first - 2; key <= last + 2; key++)
+            {
+                for (int inclusive = 0; inclusive <= 1; inclusive++)
+                {
+                    assert_int_equal(int64_rank_using(kind, keys, count, key, inclusive),
+                                     linear_rank(keys, count, key, inclusive));
+                }
+            }
+        }
+    }
+}
+
+static void test_extreme_keys(void **state)
+{
+    (void)state;
+    int64_t keys[] = {INT64_MIN, INT64_MIN, -1, 0, 1, INT64_MAX - 1, INT64_MAX, INT64_MAX};
+    int count = sizeof(keys) / sizeof(keys[0]);
+    for (int kind = KEY_SEARCH_SCALAR; kind <= KEY_SEARCH_AVX2; kind++)
+    {
+        if (!key_search_supported(kind))
+        {
+            continue;
+        }
+        assert_int_equal(int64_rank_using(kind, keys, count, INT64_MIN, false), 0);
+        assert_int_equal(int64_rank_using(kind, keys, count, INT64_MIN, true), 2);
+        assert_int_equal(int64_rank_using(kind, keys, count, 0, false), 3);
+        assert_int_equal(int64_rank_using(kind, keys, count, 0, true), 4);
+        assert_int_equal(int64_rank_using(kind, keys, count, INT64_MAX, false), 6);
+        assert_int_equal(int64_rank_using(kind, keys, count, INT64_MAX, true), 8);
+    }
+}
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_scalar_is_always_supported),
+        cmocka_unit_test(test_every_kind_agrees),
+        cmocka_unit_test(test_extreme_keys),
+    };
+
+    return cmocka_run_group_tests(tests, nullptr, nullptr);
+}
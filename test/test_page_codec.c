@@ -0,0 +1,230 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "page_codec.h"
+
+#define TEST_DATAFILE   "page_codec_test.db"
+#define TEST_PAGE_SIZE  4096
+#define DATA_OFFSET     TEST_PAGE_SIZE
+
+static const char *words[] = {"select", "insert", "update", "delete", "table", "index", "where", "order", "group"};
+
+// fills `page` with words picked by `seed`, like the rows of a text-heavy table.
+static void fill_text(uint8_t *page, unsigned seed)
+{
+    int used = 0;
+    while (used < TEST_PAGE_SIZE)
+    {
+        const char *word = words[rand_r(&seed) % (sizeof(words) / sizeof(words[0]))];
+        int length = (int)strlen(word);
+        for (int i = 0; i <= length && used < TEST_PAGE_SIZE; i++)
+        {
+            page[used++] = i < length ? (uint8_t)word[i] : ' ';
+        }
+    }
+}
+
+static void fill_random(uint8_t *page, unsigned seed)
+{
+    for (int i = 0; i < TEST_PAGE_SIZE; i++)
+    {
+        page[i] = (uint8_t)rand_r(&seed);
+    }
+}
+
+static int fresh_datafile()
+{
+    int fd = open(TEST_DATAFILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    assert_true(fd >= 0);
+    return fd;
+}
+
+static void test_lz_round_trip(void **state)
+{
+    (void)state;
+    uint8_t page[TEST_PAGE_SIZE];
+    uint8_t compressed[TEST_PAGE_SIZE];
+    uint8_t restored[TEST_PAGE_SIZE];
+
+    fill_text(page, 1);
+    int length = lz_compress(page, TEST_PAGE_SIZE, compressed, sizeof(compressed));
+    assert_true(length > 0 && length < TEST_PAGE_SIZE / 2);
+    assert_int_equal(lz_decompress(compressed, length, restored, sizeof(restored)), TEST_PAGE_SIZE);
+    assert_memory_equal(page, restored, TEST_PAGE_SIZE);
+
+    // a run of one byte is a single long match overlapping itself
+    memset(page, 0, TEST_PAGE_SIZE);
+    length = lz_compress(page, TEST_PAGE_SIZE, compressed, sizeof(compressed));
+    assert_true(length > 0 && length < 64);
+    assert_int_equal(lz_decompress(compressed, length, restored, sizeof(restored)), TEST_PAGE_SIZE);
+    assert_memory_equal(page, restored, TEST_PAGE_SIZE);
+
+    // random bytes don't fit in the size of the page once encoded
+    fill_random(page, 2);
+    assert_int_equal(lz_compress(page, TEST_PAGE_SIZE, compressed, sizeof(compressed)), -1);
+}
+
+static void test_lz_rejects_corrupt_input(void **state)
+{
+    (void)state;
+    uint8_t page[TEST_PAGE_SIZE];
+    uint8_t compressed[TEST_PAGE_SIZE];
+    uint8_t restored[TEST_PAGE_SIZE];
+    fill_text(page, 3);
+    int length = lz_compress(page, TEST_PAGE_SIZE, compressed, sizeof(compressed));
+
+    // a match reaching before the start of the output
+    const uint8_t bad_offset[] = {0x10, 'a', 0x05, 0x00};
+    assert_int_equal(lz_decompress(bad_offset, sizeof(bad_offset), restored, sizeof(restored)), -1);
+    // literals past the end of the input
+    const uint8_t truncated[] = {0x50, 'a', 'b'};
+    assert_int_equal(lz_decompress(truncated, sizeof(truncated), restored, sizeof(restored)), -1);
+    // more output than the destination holds
+    assert_int_equal(lz_decompress(compressed, length, restored, TEST_PAGE_SIZE / 2), -1);
+}
+
+static void test_read_and_write(void **state)
+{
+    (void)state;
+    int fd = fresh_datafile();
+    PageCodec *codec = page_codec_open(fd, TEST_PAGE_SIZE, DATA_OFFSET);
+    assert_non_null(codec);
+
+    uint8_t page[TEST_PAGE_SIZE];
+    uint8_t read[TEST_PAGE_SIZE];
+    for (int i = 1; i <= 32; i++)
+    {
+        fill_text(page, (unsigned)i);
+        assert_int_equal(page_codec_write(codec, i, page), 0);
+    }
+    for (int i = 1; i <= 32; i++)
+    {
+        fill_text(page, (unsigned)i);
+        assert_int_equal(page_codec_read(codec, i, read), 0);
+        assert_memory_equal(page, read, TEST_PAGE_SIZE);
+    }
+    assert_int_equal(page_codec_read(codec, 100, read), 0);
+    assert_int_equal(read[0], 0);
+
+    PageCodecStats stats = page_codec_stats(codec);
+    assert_int_equal(stats.pages, 32);
+    assert_int_equal(stats.compressed_writes, 32);
+    assert_true(stats.slot_bytes * 2 < 32 * TEST_PAGE_SIZE);
+    assert_true(lseek(fd, 0, SEEK_END) < DATA_OFFSET + 16 * TEST_PAGE_SIZE);
+
+    // a page that grows out of its slot moves, the slot it leaves goes to the next page of that size once the
+    // file is synced: until then a crash could find the page in that slot only
+    fill_random(page, 5);
+    assert_int_equal(page_codec_write(codec, 7, page), 0);
+    assert_int_equal(page_codec_read(codec, 7, read), 0);
+    assert_memory_equal(page, read, TEST_PAGE_SIZE);
+    stats = page_codec_stats(codec);
+    assert_int_equal(stats.relocations, 1);
+    assert_int_equal(stats.raw_writes, 1);
+    assert_true(stats.free_bytes > 0);
+    fill_text(page, 7);
+    off_t end = lseek(fd, 0, SEEK_END);
+    assert_int_equal(page_codec_write(codec, 33, page), 0);
+    assert_true(lseek(fd, 0, SEEK_END) > end);
+    assert_int_equal(page_codec_stats(codec).free_bytes, stats.free_bytes);
+    assert_int_equal(page_codec_sync(codec), 0);
+    end = lseek(fd, 0, SEEK_END);
+    assert_int_equal(page_codec_write(codec, 34, page), 0);
+    assert_int_equal(lseek(fd, 0, SEEK_END), end);
+    assert_int_equal(page_codec_stats(codec).free_bytes, 0);
+    fill_random(page, 5);
+    assert_int_equal(page_codec_read(codec, 7, read), 0);
+    assert_memory_equal(page, read, TEST_PAGE_SIZE);
+
+    page_codec_close(codec);
+    close(fd);
+}
+
+static void test_map_rebuilt_on_open(void **state)
+{
+    (void)state;
+    int fd = fresh_datafile();
+    PageCodec *codec = page_codec_open(fd, TEST_PAGE_SIZE, DATA_OFFSET);
+    uint8_t page[TEST_PAGE_SIZE];
+    uint8_t read[TEST_PAGE_SIZE];
+    for (int i = 1; i <= 8; i++)
+    {
+        fill_text(page, (unsigned)i);
+        assert_int_equal(page_codec_write(codec, i, page), 0);
+    }
+    fill_random(page, 9);
+    assert_int_equal(page_codec_write(codec, 3, page), 0);
+    page_codec_close(codec);
+
+    codec = page_codec_open(fd, TEST_PAGE_SIZE, DATA_OFFSET);
+    assert_non_null(codec);
+    assert_int_equal(page_codec_stats(codec).pages, 8);
+    assert_true(page_codec_stats(codec).free_bytes > 0);
+    assert_int_equal(page_codec_read(codec, 3, read), 0);
+    assert_memory_equal(page, read, TEST_PAGE_SIZE);
+    fill_text(page, 8);
+    assert_int_equal(page_codec_read(codec, 8, read), 0);
+    assert_memory_equal(page, read, TEST_PAGE_SIZE);
+    page_codec_close(codec);
+    close(fd);
+}
+
+static void test_torn_slot(void **state)
+{
+    (void)state;
+    int fd = fresh_datafile();
+    PageCodec *codec = page_codec_open(fd, TEST_PAGE_SIZE, DATA_OFFSET);
+    uint8_t old_page[TEST_PAGE_SIZE];
+    uint8_t page[TEST_PAGE_SIZE];
+    uint8_t read[TEST_PAGE_SIZE];
+    fill_text(old_page, 1);
+    assert_int_equal(page_codec_write(codec, 1, old_page), 0);
+    off_t slot_of_2 = (lseek(fd, 0, SEEK_END) + SLOT_UNIT - 1) / SLOT_UNIT * SLOT_UNIT;
+    fill_text(page, 3);
+    assert_int_equal(page_codec_write(codec, 2, page), 0);
+    off_t moved_slot = (lseek(fd, 0, SEEK_END) + SLOT_UNIT - 1) / SLOT_UNIT * SLOT_UNIT;
+    uint8_t moved[TEST_PAGE_SIZE];
+    fill_random(moved, 2);
+    assert_int_equal(page_codec_write(codec, 1, moved), 0);
+    page_codec_close(codec);
+
+    // a crash in the middle of the move leaves the newer slot of page 1 damaged: the older one is used instead
+    assert_int_equal(pwrite(fd, "torn", 4, moved_slot + SLOT_HEADER_SIZE + 100), 4);
+    codec = page_codec_open(fd, TEST_PAGE_SIZE, DATA_OFFSET);
+    assert_non_null(codec);
+    assert_int_equal(page_codec_read(codec, 1, read), 0);
+    assert_memory_equal(old_page, read, TEST_PAGE_SIZE);
+    assert_int_equal(page_codec_read(codec, 2, read), 0);
+    assert_memory_equal(page, read, TEST_PAGE_SIZE);
+
+    // a damaged slot without an older one fails the read
+    assert_int_equal(pwrite(fd, "torn", 4, slot_of_2 + SLOT_HEADER_SIZE + 8), 4);
+    assert_int_equal(page_codec_read(codec, 2, read), -1);
+    assert_int_equal(errno, EIO);
+
+    page_codec_close(codec);
+    close(fd);
+    unlink(TEST_DATAFILE);
+}
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_lz_round_trip),
+        cmocka_unit_test(test_lz_rejects_corrupt_input),
+        cmocka_unit_test(test_read_and_write),
+        cmocka_unit_test(test_map_rebuilt_on_open),
+        cmocka_unit_test(test_torn_slot),
+    };
+
+    return cmocka_run_group_tests(tests, nullptr, nullptr);
+}
@@ -4,13 +4,32 @@
 #include <cmocka.h>
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "storage_engine.h"
 
+#define TEST_PATH       "test_storage_engine.db"
+#define WORKERS         8
+#define WORKER_PAGES    64
+#define SHARED_PAGES    64
+
+static Pager *pager;
+
 static void test_open_database(void **state)
 {
     (void)state;
-    assert_int_equal(open_database(), 0);
+    remove(TEST_PATH);
+    DatabaseOptions options = {.cache_size = 4};
+    pager = open_database(TEST_PATH, &options);
+    assert_non_null(pager);
+    assert_null(open_database(TEST_PATH, &options));
 }
 
 static void test_write_page(void **state)
@@ -19,7 +38,7 @@ static void test_write_page(void **state)
     Page page;
     strcpy((char *)page.data, "Hello, this is a simple string.");
 
-    assert_int_equal(write_page(999, &page), 0);
+    assert_int_equal(write_page(pager, 999, &page), 0);
 }
 
 static void test_read_page(void **state)
@@ -28,36 +47,65 @@ static void test_read_page(void **state)
     Page page;
     const char str[] = "Hello, this is a simple string.";
 
-    assert_int_equal(read_page(999, &page), 0);
+    assert_int_equal(read_page(pager, 999, &page), 0);
     assert_string_equal((char *)page.data, str);
 }
 
+static void test_read_page_past_end_of_file(void **state)
+{
+    (void)state;
+    Page page;
+    memset(page.data, 0xAB, DEFAULT_PAGE_SIZE);
+
+    assert_int_equal(read_page(pager, 100000, &page), 0);
+    for (int i = 0; i < DEFAULT_PAGE_SIZE; i++)
+    {
+        assert_int_equal(page.data[i], 0);
+    }
+    assert_int_equal(read_page(pager, -1, &page), -1);
+}
+
 static void test_allocate_page(void **state)
 {
     (void)state;
     Page page, page_read;
     strcpy((char *)page.data, "My name is Monsef");
-    int page_number = allocate_page(&page);
-    assert_int_equal(page_number, 999);
-    assert_int_equal(read_page(page_number, &page_read), 0);
+    int page_number = allocate_page(pager, &page);
+    // page 0 is the header and page 1 the first bitmap
+    assert_int_equal(page_number, 2);
+    assert_int_equal(read_page_with_cache(pager, page_number, &page_read), 0);
     assert_string_equal((char *)page_read.data, (char *)page.data);
+
+    // the new page waits in the buffer pool until it is flushed
+    assert_int_equal(read_page(pager, page_number, &page_read), 0);
+    assert_int_equal(page_read.data[0], 0);
+    assert_int_equal(flush_dirty_pages(pager), 0);
+    assert_int_equal(read_page(pager, page_number, &page_read), 0);
+    assert_string_equal((char *)page_read.data, (char *)page.data);
+
+    assert_int_equal(allocate_page(pager, &page), 3);
+    assert_int_equal(database_header(pager).page_count, 4);
 }
 
 static void test_free_page(void **state)
 {
     (void)state;
 
-    assert_int_equal(free_page(999), 0);
-    assert_int_equal(free_page(999), -1);
+    assert_int_equal(free_page(pager, 2), 0);
+    assert_int_equal(free_page(pager, 2), -1);
+    assert_int_equal(free_page(pager, HEADER_PAGE), -1);
+    assert_int_equal(free_page(pager, 1), -1);
+    assert_int_equal(free_page(pager, 999), -1);
+    assert_int_equal(database_header(pager).free_count, 1);
 }
 
 static void test_read_page_with_cache(void **state)
 {
     (void) state;
     Page page;
-    assert_int_equal(read_page_with_cache(999, &page), 0);
+    assert_int_equal(read_page_with_cache(pager, 999, &page), 0);
     assert_non_null(page.data);
-    assert_string_equal((char *)page.data, "My name is Monsef");
+    assert_string_equal((char *)page.data, "Hello, this is a simple string.");
 }
 
 static void test_write_page_with_cache(void **state)
@@ -66,15 +114,1350 @@ static void test_write_page_with_cache(void **state)
     Page page;
     strcpy((char *)page.data, "Hello everyone");
 
-    assert_int_equal(write_page_with_cache(999, &page), 0);
+    assert_int_equal(write_page_with_cache(pager, 999, &page), 0);
+}
+
+static void test_cache_hit_after_write(void **state)
+{
+    (void) state;
+    Page page;
+    CacheStats before = cache_stats(pager);
+
+    assert_int_equal(read_page_with_cache(pager, 999, &page), 0);
+    assert_string_equal((char *)page.data, "Hello everyone");
+
+    CacheStats after = cache_stats(pager);
+    assert_int_equal(after.hits, before.hits + 1);
+    assert_int_equal(after.misses, before.misses);
+}
+
+static void test_cache_eviction(void **state)
+{
+    (void) state;
+    Page page;
+
+    // the pool holds 4 frames, reading 4 new pages replaces everything that was cached.
+    for (int i = 4; i < 8; i++)
+    {
+        assert_int_equal(read_page_with_cache(pager, i, &page), 0);
+    }
+    assert_int_equal(cache_search(pager, 999), -1);
+
+    CacheStats before = cache_stats(pager);
+    assert_int_equal(read_page_with_cache(pager, 8, &page), 0);
+
+    CacheStats after = cache_stats(pager);
+    assert_int_equal(after.misses, before.misses + 1);
+    assert_int_equal(after.evictions, before.evictions + 1);
+    assert_int_equal(cache_search(pager, 4), -1);
+    assert_int_not_equal(cache_search(pager, 5), -1);
+    assert_int_not_equal(cache_search(pager, 8), -1);
+
+    // recently used pages are served from the pool
+    assert_int_equal(read_page_with_cache(pager, 5, &page), 0);
+    assert_int_equal(cache_stats(pager).hits, after.hits + 1);
+}
+
+static void test_pin_page(void **state)
+{
+    (void) state;
+    Page page;
+
+    Page *pinned = pin_page(pager, 4);
+    assert_non_null(pinned);
+    assert_ptr_equal(pin_page(pager, 4), pinned);
+    assert_int_equal(unpin_page(pager, 4, false), 0);
+
+    strcpy((char *)pinned->data, "Written in place");
+    assert_int_equal(unpin_page(pager, 4, true), 0);
+    assert_int_equal(unpin_page(pager, 4, false), -1);
+
+    assert_int_equal(flush_dirty_pages(pager), 0);
+    assert_int_equal(read_page(pager, 4, &page), 0);
+    assert_string_equal((char *)page.data, "Written in place");
 }
 
+static void test_pinned_pages_are_not_evicted(void **state)
+{
+    (void) state;
+    Page *pinned[4];
+
+    for (int i = 0; i < 4; i++)
+    {
+        pinned[i] = pin_page(pager, 10 + i);
+        assert_non_null(pinned[i]);
+    }
+
+    // every frame is pinned, there is nothing to evict
+    assert_null(pin_page(pager, 20));
+
+    assert_int_equal(unpin_page(pager, 11, false), 0);
+    Page *page = pin_page(pager, 20);
+    assert_non_null(page);
+    assert_ptr_equal(page, pinned[1]);
+    assert_ptr_equal(pin_page(pager, 10), pinned[0]);
+
+    assert_int_equal(unpin_page(pager, 10, false), 0);
+    assert_int_equal(unpin_page(pager, 10, false), 0);
+    assert_int_equal(unpin_page(pager, 12, false), 0);
+    assert_int_equal(unpin_page(pager, 13, false), 0);
+    assert_int_equal(unpin_page(pager, 20, false), 0);
+}
+static void test_write_back_on_flush(void **state)
+{
+    (void) state;
+    Page page, page_read;
+
+    for (int i = 30; i < 33; i++)
+    {
+        snprintf((char *)page.data, sizeof(page.data), "page %d, first version", i);
+        assert_int_equal(write_page(pager, i, &page), 0);
+        snprintf((char *)page.data, sizeof(page.data), "page %d, second version", i);
+        assert_int_equal(write_page_with_cache(pager, i, &page), 0);
+    }
+
+    // the datafile isn't touched until the dirty frames are flushed
+    assert_int_equal(read_page(pager, 31, &page_read), 0);
+    assert_string_equal((char *)page_read.data, "page 31, first version");
+    assert_int_equal(read_page_with_cache(pager, 31, &page_read), 0);
+    assert_string_equal((char *)page_read.data, "page 31, second version");
+
+    assert_int_equal(flush_dirty_pages(pager), 0);
+    for (int i = 30; i < 33; i++)
+    {
+        char expected[64];
+        snprintf(expected, sizeof(expected), "page %d, second version", i);
+        assert_int_equal(read_page(pager, i, &page_read), 0);
+        assert_string_equal((char *)page_read.data, expected);
+    }
+}
+
+static void test_dirty_page_written_on_eviction(void **state)
+{
+    (void) state;
+    Page page;
+    strcpy((char *)page.data, "evicted while dirty");
+
+    assert_int_equal(write_page_with_cache(pager, 40, &page), 0);
+    for (int i = 41; i < 46; i++)
+    {
+        assert_int_equal(read_page_with_cache(pager, i, &page), 0);
+    }
+
+    assert_int_equal(cache_search(pager, 40), -1);
+    assert_int_equal(read_page(pager, 40, &page), 0);
+    assert_string_equal((char *)page.data, "evicted while dirty");
+}
+static void test_submit_page_io(void **state)
+{
+    (void) state;
+    Page pages[2], page;
+    strcpy((char *)pages[0].data, "written asynchronously 50");
+    strcpy((char *)pages[1].data, "written asynchronously 51");
+
+    PageRequest requests[] = {
+        {.page_number = 50, .buffer = pages[0].data, .write = true},
+        {.page_number = 51, .buffer = pages[1].data, .write = true},
+    };
+    assert_int_equal(submit_page_io(pager, requests, 2), 2);
+    assert_int_equal(reap_page_io(pager, 2), 2);
+    assert_int_equal(requests[0].result, 0);
+    assert_int_equal(requests[1].result, 0);
+
+    assert_int_equal(read_page(pager, 51, &page), 0);
+    assert_string_equal((char *)page.data, "written asynchronously 51");
+}
 
 static void test_close_database(void **state)
 {
     (void)state;
-    assert_int_equal(close_database(), 0);
-    assert_int_equal(close_database(), -1);
+    assert_int_equal(close_database(pager), 0);
+    assert_int_equal(close_database(nullptr), -1);
+}
+
+static void test_free_space_persists(void **state)
+{
+    (void)state;
+    Page page;
+    strcpy((char *)page.data, "reused page");
+
+    pager = open_database(TEST_PATH, nullptr);
+    assert_non_null(pager);
+    DatabaseHeader header = database_header(pager);
+    assert_memory_equal(header.magic, DATABASE_MAGIC, sizeof(header.magic));
+    assert_int_equal(header.page_count, 4);
+    assert_int_equal(header.free_count, 1);
+
+    // the page freed before closing is handed out again before the datafile grows
+    assert_int_equal(allocate_page(pager, &page), 2);
+    assert_int_equal(allocate_page(pager, &page), 4);
+    assert_int_equal(free_page(pager, 3), 0);
+    assert_int_equal(close_database(pager), 0);
+
+    pager = open_database(TEST_PATH, nullptr);
+    assert_non_null(pager);
+    assert_int_equal(database_header(pager).page_count, 5);
+    assert_int_equal(free_page(pager, 3), -1);
+    assert_int_equal(allocate_page(pager, &page), 3);
+    assert_int_equal(close_database(pager), 0);
+}
+
+static void test_allocate_pages(void **state)
+{
+    (void)state;
+    pager = open_database(TEST_PATH, nullptr);
+    assert_non_null(pager);
+    assert_int_equal(database_header(pager).page_count, 5);
+
+    assert_int_equal(allocate_pages(pager, 8), 5);
+    assert_int_equal(database_header(pager).page_count, 13);
+
+    // two holes: page 6 alone and pages 8 to 10
+    assert_int_equal(free_page(pager, 6), 0);
+    assert_int_equal(free_page(pager, 8), 0);
+    assert_int_equal(free_page(pager, 9), 0);
+    assert_int_equal(free_page(pager, 10), 0);
+
+    // the lowest hole that is long enough is reused, shorter ones are left for smaller requests
+    assert_int_equal(allocate_pages(pager, 3), 8);
+    assert_int_equal(allocate_pages(pager, 2), 13);
+    assert_int_equal(database_header(pager).page_count, 15);
+    assert_int_equal(allocate_page(pager, &(Page){0}), 6);
+    assert_int_equal(database_header(pager).free_count, 0);
+
+    assert_int_equal(allocate_pages(pager, 0), -1);
+    assert_int_equal(allocate_pages(pager, DEFAULT_PAGE_SIZE * 8), -1);
+    assert_int_equal(close_database(pager), 0);
+}
+
+static void test_allocate_pages_without_bitmap(void **state)
+{
+    (void)state;
+    const char *bitmap_path = "test_storage_engine_bitmap.db";
+    remove(bitmap_path);
+    DatabaseOptions options = {.cache_size = 64, .cache_shards = 1};
+    Pager *database = open_database(bitmap_path, &options);
+    assert_non_null(database);
+    int first = allocate_pages(database, options.cache_size);
+    assert_int_not_equal(first, -1);
+    DatabaseHeader before = database_header(database);
+
+    // every frame is pinned: the bitmap page can't be loaded once the datafile grew
+    for (int i = 0; i < options.cache_size; i++)
+    {
+        assert_non_null(pin_page(database, first + i));
+    }
+    assert_int_equal(allocate_pages(database, 4), -1);
+    for (int i = 0; i < options.cache_size; i++)
+    {
+        assert_int_equal(unpin_page(database, first + i, false), 0);
+    }
+
+    // the pages appended to the datafile are free ones, the next allocation takes them
+    DatabaseHeader after = database_header(database);
+    assert_int_equal(after.page_count - after.free_count, before.page_count - before.free_count);
+    assert_int_equal(allocate_pages(database, 4), (int)before.page_count);
+    assert_int_equal(database_header(database).page_count, after.page_count);
+    assert_int_equal(close_database(database), 0);
+    remove(bitmap_path);
+}
+
+static void test_readahead(void **state)
+{
+    (void)state;
+    Page page;
+    DatabaseOptions options = {.cache_size = 64};
+    pager = open_database(TEST_PATH, &options);
+    assert_non_null(pager);
+    int first = allocate_pages(pager, 48);
+    assert_int_not_equal(first, -1);
+    for (int i = 0; i < 48; i++)
+    {
+        snprintf((char *)page.data, sizeof(page.data), "scanned page %d", i);
+        assert_int_equal(write_page_with_cache(pager, first + i, &page), 0);
+    }
+    assert_int_equal(close_database(pager), 0);
+
+    // a scan only waits for the two reads that reveal it, the rest is prefetched
+    pager = open_database(TEST_PATH, &options);
+    assert_non_null(pager);
+    for (int i = 0; i < 48; i++)
+    {
+        char expected[32];
+        snprintf(expected, sizeof(expected), "scanned page %d", i);
+        assert_int_equal(read_page_with_cache(pager, first + i, &page), 0);
+        assert_string_equal((char *)page.data, expected);
+    }
+    CacheStats stats = cache_stats(pager);
+    assert_int_equal(stats.misses, 2);
+    assert_int_equal(stats.readahead_pages, 46);
+    assert_int_equal(stats.readahead_hits, 46);
+    assert_int_equal(stats.readahead_misses, 0);
+    assert_int_equal(close_database(pager), 0);
+
+    // pages prefetched for a scan that stops are evicted unread
+    options.cache_size = 16;
+    pager = open_database(TEST_PATH, &options);
+    assert_non_null(pager);
+    assert_int_equal(read_page_with_cache(pager, first, &page), 0);
+    assert_int_equal(read_page_with_cache(pager, first + 1, &page), 0);
+    assert_int_equal(cache_stats(pager).readahead_pages, READAHEAD_MIN_PAGES);
+    for (int i = 47; i > 15; i -= 2)
+    {
+        assert_int_equal(read_page_with_cache(pager, first + i, &page), 0);
+    }
+    stats = cache_stats(pager);
+    assert_int_equal(stats.readahead_pages, READAHEAD_MIN_PAGES);
+    assert_int_equal(stats.readahead_hits, 0);
+    assert_int_equal(stats.readahead_misses, READAHEAD_MIN_PAGES);
+    assert_int_equal(close_database(pager), 0);
+}
+
+static void test_scan_resistant_policy(void **state)
+{
+    (void)state;
+    Page page;
+    DatabaseOptions options = {.cache_size = 16, .readahead_pages = -1, .cache_policy = CACHE_POLICY_2Q};
+    pager = open_database(TEST_PATH, &options);
+    assert_non_null(pager);
+
+    // hot pages requested again after leaving the FIFO of new pages move to the main LRU
+    int cold = 3000;
+    for (int pass = 0; pass < 3; pass++)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            assert_int_equal(read_page_with_cache(pager, 2000 + i, &page), 0);
+        }
+        for (int i = 0; i < 8; i++)
+        {
+            assert_int_equal(read_page_with_cache(pager, cold++, &page), 0);
+        }
+    }
+
+    // a scan larger than the pool goes through the FIFO without evicting them
+    for (int i = 0; i < 40; i++)
+    {
+        assert_int_equal(read_page_with_cache(pager, cold++, &page), 0);
+    }
+    uint64_t hits = cache_stats(pager).hits;
+    for (int i = 0; i < 4; i++)
+    {
+        assert_int_not_equal(cache_search(pager, 2000 + i), -1);
+        assert_int_equal(read_page_with_cache(pager, 2000 + i, &page), 0);
+    }
+    assert_int_equal(cache_stats(pager).hits - hits, 4);
+    assert_int_equal(close_database(pager), 0);
+}
+
+static void test_wal_mode(void **state)
+{
+    (void)state;
+    Page page;
+    DatabaseOptions options = {.cache_size = 4, .use_wal = true};
+    pager = open_database(TEST_PATH, &options);
+    assert_non_null(pager);
+    assert_int_equal(access(TEST_PATH WAL_SUFFIX, F_OK), 0);
+
+    // dirty pages evicted before the commit go to the log, not to the datafile
+    for (int i = 0; i < 6; i++)
+    {
+        snprintf((char *)page.data, sizeof(page.data), "logged page %d", i);
+        assert_int_equal(write_page_with_cache(pager, 4100 + i, &page), 0);
+    }
+    assert_int_equal(cache_search(pager, 4100), -1);
+    assert_int_equal(read_page(pager, 4100, &page), 0);
+    assert_int_equal(page.data[0], 0);
+    assert_int_equal(read_page_with_cache(pager, 4100, &page), 0);
+    assert_string_equal((char *)page.data, "logged page 0");
+
+    assert_int_equal(flush_dirty_pages(pager), 0);
+    assert_int_equal(read_page(pager, 4105, &page), 0);
+    assert_int_equal(page.data[0], 0);
+
+    assert_int_equal(checkpoint_database(pager), 0);
+    for (int i = 0; i < 6; i++)
+    {
+        char expected[32];
+        snprintf(expected, sizeof(expected), "logged page %d", i);
+        assert_int_equal(read_page(pager, 4100 + i, &page), 0);
+        assert_string_equal((char *)page.data, expected);
+    }
+
+    assert_int_equal(close_database(pager), 0);
+    assert_int_not_equal(access(TEST_PATH WAL_SUFFIX, F_OK), 0);
+}
+
+static void test_wal_recovery_after_crash(void **state)
+{
+    (void)state;
+    pid_t pid = fork();
+    assert_true(pid >= 0);
+    if (pid == 0)
+    {
+        Page page;
+        DatabaseOptions options = {.use_wal = true};
+        pager = open_database(TEST_PATH, &options);
+        if (pager == nullptr)
+        {
+            _exit(1);
+        }
+        strcpy((char *)page.data, "committed before the crash");
+        write_page_with_cache(pager, 4200, &page);
+        if (flush_dirty_pages(pager) != 0)
+        {
+            _exit(1);
+        }
+        strcpy((char *)page.data, "never committed");
+        write_page_with_cache(pager, 4201, &page);
+        _exit(0); // crash without closing the database
+    }
+
+    int status;
+    assert_int_equal(waitpid(pid, &status, 0), pid);
+    assert_true(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert_int_equal(access(TEST_PATH WAL_SUFFIX, F_OK), 0);
+
+    // opening the database without the log replays the committed pages into the datafile
+    Page page;
+    pager = open_database(TEST_PATH, nullptr);
+    assert_non_null(pager);
+    assert_int_not_equal(access(TEST_PATH WAL_SUFFIX, F_OK), 0);
+    assert_int_equal(read_page(pager, 4200, &page), 0);
+    assert_string_equal((char *)page.data, "committed before the crash");
+    assert_int_equal(read_page(pager, 4201, &page), 0);
+    assert_int_equal(page.data[0], 0);
+    assert_int_equal(close_database(pager), 0);
+}
+
+static void test_mmap_mode(void **state)
+{
+    (void)state;
+    DatabaseOptions options = {.cache_size = 4, .use_mmap = true, .mmap_advice = MMAP_ADVICE_RANDOM};
+    pager = open_database(TEST_PATH, &options);
+    assert_non_null(pager);
+
+    // clean pages are served from the mapping without going through the buffer pool
+    const Page *view = view_page(pager, 999);
+    assert_non_null(view);
+    assert_string_equal((char *)view->data, "Hello everyone");
+    assert_int_equal(cache_search(pager, 999), -1);
+
+    Page page;
+    assert_int_equal(read_page(pager, 999, &page), 0);
+    assert_string_equal((char *)page.data, "Hello everyone");
+
+    // growing the datafile past the mapped area while a view is held keeps the old view valid
+    strcpy((char *)page.data, "far away page");
+    assert_int_equal(write_page(pager, 8000, &page), 0);
+    const Page *far = view_page(pager, 8000);
+    assert_non_null(far);
+    assert_string_equal((char *)far->data, "far away page");
+    assert_string_equal((char *)view->data, "Hello everyone");
+    assert_int_equal(release_view(pager, far), 0);
+    assert_int_equal(release_view(pager, view), 0);
+
+    // a page with unflushed changes is viewed through its frame
+    strcpy((char *)page.data, "changed in the pool");
+    assert_int_equal(write_page_with_cache(pager, 999, &page), 0);
+    view = view_page(pager, 999);
+    assert_string_equal((char *)view->data, "changed in the pool");
+    assert_int_equal(release_view(pager, view), 0);
+
+    assert_int_equal(advise_access(pager, 0, 0, MMAP_ADVICE_SEQUENTIAL), 0);
+    assert_int_equal(advise_access(pager, 990, 20, MMAP_ADVICE_RANDOM), 0);
+    assert_int_equal(close_database(pager), 0);
+
+    pager = open_database(TEST_PATH, nullptr);
+    assert_non_null(pager);
+    assert_int_equal(advise_access(pager, 0, 0, MMAP_ADVICE_NORMAL), -1);
+    assert_int_equal(close_database(pager), 0);
+}
+
+static void test_two_databases(void **state)
+{
+    (void)state;
+    const char *other_path = "test_storage_engine_other.db";
+    remove(other_path);
+    Page page;
+    pager = open_database(TEST_PATH, nullptr);
+    assert_non_null(pager);
+    Pager *other = open_database(other_path, &(DatabaseOptions){.cache_size = 8});
+    assert_non_null(other);
+
+    // each pager has its own header, free space and buffer pool
+    uint32_t page_count = database_header(pager).page_count;
+    strcpy((char *)page.data, "in the other database");
+    assert_int_equal(allocate_page(other, &page), 2);
+    assert_int_equal(database_header(pager).page_count, page_count);
+    assert_int_equal(cache_search(pager, 2), -1);
+    assert_int_equal(close_database(other), 0);
+
+    other = open_database(other_path, nullptr);
+    assert_non_null(other);
+    assert_int_equal(read_page_with_cache(other, 2, &page), 0);
+    assert_string_equal((char *)page.data, "in the other database");
+    assert_int_equal(close_database(other), 0);
+    assert_int_equal(close_database(pager), 0);
+    remove(other_path);
+}
+
+// each worker rewrites its own pages while reading them and the shared pages back, in a pool too small for all of them.
+static void *worker(void *argument)
+{
+    int id = (int)(intptr_t)argument;
+    int first = 6000 + SHARED_PAGES + id * WORKER_PAGES;
+    Page page;
+    char expected[32];
+    for (int round = 0; round < 4; round++)
+    {
+        for (int i = 0; i < WORKER_PAGES; i++)
+        {
+            snprintf((char *)page.data, sizeof(page.data), "worker %d round %d", id, round);
+            if (write_page_with_cache(pager, first + i, &page) != 0)
+            {
+                return (void *)1;
+            }
+        }
+        for (int i = 0; i < WORKER_PAGES; i++)
+        {
+            snprintf(expected, sizeof(expected), "worker %d round %d", id, round);
+            if (read_page_with_cache(pager, first + i, &page) != 0 || strcmp((char *)page.data, expected) != 0)
+            {
+                return (void *)1;
+            }
+            snprintf(expected, sizeof(expected), "shared page %d", i);
+            if (read_page_with_cache(pager, 6000 + i, &page) != 0 || strcmp((char *)page.data, expected) != 0)
+            {
+                return (void *)1;
+            }
+        }
+    }
+    return nullptr;
+}
+
+static void test_concurrent_access(void **state)
+{
+    (void)state;
+    Page page;
+    DatabaseOptions options = {.cache_size = 256, .cache_shards = 4};
+    pager = open_database(TEST_PATH, &options);
+    assert_non_null(pager);
+    for (int i = 0; i < SHARED_PAGES; i++)
+    {
+        snprintf((char *)page.data, sizeof(page.data), "shared page %d", i);
+        assert_int_equal(write_page_with_cache(pager, 6000 + i, &page), 0);
+    }
+
+    pthread_t threads[WORKERS];
+    for (int i = 0; i < WORKERS; i++)
+    {
+        assert_int_equal(pthread_create(&threads[i], nullptr, worker, (void *)(intptr_t)i), 0);
+    }
+    for (int i = 0; i < WORKERS; i++)
+    {
+        void *result;
+        pthread_join(threads[i], &result);
+        assert_null(result);
+    }
+
+    CacheStats stats = cache_stats(pager);
+    assert_true(stats.evictions > 0);
+    assert_int_equal(flush_dirty_pages(pager), 0);
+    for (int id = 0; id < WORKERS; id++)
+    {
+        char expected[32];
+        snprintf(expected, sizeof(expected), "worker %d round 3", id);
+        assert_int_equal(read_page(pager, 6000 + SHARED_PAGES + id * WORKER_PAGES + WORKER_PAGES - 1, &page), 0);
+        assert_string_equal((char *)page.data, expected);
+    }
+    assert_int_equal(close_database(pager), 0);
+}
+
+static atomic_bool writers_done;
+static atomic_int pages_written;
+static int last_rounds[2];
+
+// rewrites more pages than the pool holds, so that evictions keep appending frames to the log.
+// returns non-null if a write fails.
+static void *evicting_writer(void *argument)
+{
+    int id = (int)(intptr_t)argument;
+    int first = 7000 + id * WORKER_PAGES;
+    Page page;
+    int round;
+    for (round = 0; !atomic_load(&writers_done); round++)
+    {
+        snprintf((char *)page.data, sizeof(page.data), "round %d", round);
+        if (write_page_with_cache(pager, first + round % WORKER_PAGES, &page) != 0)
+        {
+            return (void *)1;
+        }
+        atomic_fetch_add(&pages_written, 1);
+    }
+    last_rounds[id] = round - 1;
+    return nullptr;
+}
+
+static void test_commit_while_evictions_log_pages(void **state)
+{
+    (void)state;
+    DatabaseOptions options = {.cache_size = 64, .cache_shards = 1, .use_wal = true, .checkpoint_frames = 1};
+    pager = open_database(TEST_PATH, &options);
+    assert_non_null(pager);
+
+    // writes wait for the frames a flush pins instead of failing, and the automatic checkpoint after a commit
+    // keeps the frames that evictions logged since
+    atomic_store(&writers_done, false);
+    atomic_store(&pages_written, 0);
+    pthread_t threads[2];
+    for (int i = 0; i < 2; i++)
+    {
+        assert_int_equal(pthread_create(&threads[i], nullptr, evicting_writer, (void *)(intptr_t)i), 0);
+    }
+    while (atomic_load(&pages_written) < options.cache_size)
+    {
+        sched_yield();
+    }
+    for (int i = 0; i < 200; i++)
+    {
+        assert_int_equal(flush_dirty_pages(pager), 0);
+    }
+    atomic_store(&writers_done, true);
+    for (int i = 0; i < 2; i++)
+    {
+        void *result;
+        pthread_join(threads[i], &result);
+        assert_null(result);
+    }
+    assert_int_equal(checkpoint_database(pager), 0);
+    assert_int_equal(close_database(pager), 0);
+
+    pager = open_database(TEST_PATH, nullptr);
+    assert_non_null(pager);
+    for (int id = 0; id < 2; id++)
+    {
+        Page page;
+        char expected[32];
+        snprintf(expected, sizeof(expected), "round %d", last_rounds[id]);
+        assert_int_equal(read_page(pager, 7000 + id * WORKER_PAGES + last_rounds[id] % WORKER_PAGES, &page), 0);
+        assert_string_equal((char *)page.data, expected);
+    }
+    assert_int_equal(close_database(pager), 0);
+}
+
+static void test_page_size(void **state)
+{
+    (void)state;
+    const char *large_path = "test_storage_engine_large.db";
+    remove(large_path);
+    assert_null(open_database(large_path, &(DatabaseOptions){.page_size = 5000}));
+    assert_null(open_database(large_path, &(DatabaseOptions){.page_size = 2 * MAX_PAGE_SIZE}));
+
+    // the page size is picked when the datafile is created
+    Page page;
+    DatabaseOptions options = {.page_size = 16384, .cache_size = 8};
+    Pager *large = open_database(large_path, &options);
+    assert_non_null(large);
+    assert_int_equal(database_header(large).page_size, 16384);
+    assert_int_equal(database_header(large).version, DATABASE_VERSION);
+    int first = allocate_pages(large, 20);
+    for (int i = 0; i < 20; i++)
+    {
+        memset(page.data, 'a' + i, 16384);
+        assert_int_equal(write_page_with_cache(large, first + i, &page), 0);
+    }
+    assert_int_equal(allocate_pages(large, 16384 * 8), -1);
+    assert_int_equal(close_database(large), 0);
+
+    // and the header tells it when the datafile is opened again
+    struct stat st;
+    assert_int_equal(stat(large_path, &st), 0);
+    assert_int_equal(st.st_size % 16384, 0);
+    large = open_database(large_path, &(DatabaseOptions){.page_size = 4096});
+    assert_non_null(large);
+    assert_int_equal(database_header(large).page_size, 16384);
+    for (int i = 0; i < 20; i++)
+    {
+        memset(page.data, 0, sizeof(page.data));
+        assert_int_equal(read_page_with_cache(large, first + i, &page), 0);
+        assert_int_equal(page.data[0], 'a' + i);
+        assert_int_equal(page.data[16383], 'a' + i);
+        assert_int_equal(page.data[16384], 0);
+    }
+    assert_int_equal(close_database(large), 0);
+    remove(large_path);
+}
+
+// returns how many pages of the file at `path` are in the page cache of the kernel.
+static int resident_pages(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    assert_non_null(file);
+    struct stat st;
+    assert_int_equal(fstat(fileno(file), &st), 0);
+    size_t system_page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t pages = ((size_t)st.st_size + system_page - 1) / system_page;
+    void *map = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fileno(file), 0);
+    assert_true(map != MAP_FAILED);
+    unsigned char *resident = malloc(pages);
+    assert_int_equal(mincore(map, (size_t)st.st_size, resident), 0);
+    int count = 0;
+    for (size_t i = 0; i < pages; i++)
+    {
+        count += resident[i] & 1;
+    }
+    free(resident);
+    munmap(map, (size_t)st.st_size);
+    fclose(file);
+    return count;
+}
+
+static void test_direct_io(void **state)
+{
+    (void)state;
+    const char *direct_path = "test_storage_engine_direct.db";
+    remove(direct_path);
+    DatabaseOptions options = {.use_direct_io = true, .cache_size = 64};
+    Pager *direct = open_database(direct_path, &options);
+    assert_non_null(direct);
+    bool bypasses_cache = uses_direct_io(direct);
+
+    // more pages than frames: evictions write the aligned frames out directly
+    Page page;
+    int first = allocate_pages(direct, 200);
+    for (int i = 0; i < 200; i++)
+    {
+        memset(page.data, 'a' + i % 26, DEFAULT_PAGE_SIZE);
+        assert_int_equal(write_page_with_cache(direct, first + i, &page), 0);
+    }
+
+    // pages that aren't aligned go through a copy
+    uint8_t *raw = malloc(sizeof(Page) + 1);
+    Page *unaligned = (Page *)(raw + 1);
+    memset(unaligned->data, 'z', DEFAULT_PAGE_SIZE);
+    int extra = allocate_pages(direct, 1);
+    assert_int_equal(write_page(direct, extra, unaligned), 0);
+    memset(unaligned->data, 0, DEFAULT_PAGE_SIZE);
+    assert_int_equal(read_page(direct, first + 3, unaligned), 0);
+    assert_int_equal(unaligned->data[0], 'a' + 3);
+    assert_int_equal(close_database(direct), 0);
+    if (bypasses_cache)
+    {
+        assert_int_equal(resident_pages(direct_path), 0);
+    }
+
+    // a checkpoint copies the log into the datafile through an aligned buffer
+    options.use_wal = true;
+    direct = open_database(direct_path, &options);
+    assert_non_null(direct);
+    assert_int_equal(uses_direct_io(direct), bypasses_cache);
+    memset(page.data, 'w', DEFAULT_PAGE_SIZE);
+    assert_int_equal(write_page_with_cache(direct, first, &page), 0);
+    assert_int_equal(close_database(direct), 0);
+
+    direct = open_database(direct_path, nullptr);
+    assert_non_null(direct);
+    assert_false(uses_direct_io(direct));
+    assert_int_equal(read_page(direct, first, &page), 0);
+    assert_int_equal(page.data[DEFAULT_PAGE_SIZE - 1], 'w');
+    assert_int_equal(read_page(direct, first + 199, &page), 0);
+    assert_int_equal(page.data[0], 'a' + 199 % 26);
+    assert_int_equal(read_page(direct, extra, unaligned), 0);
+    assert_int_equal(unaligned->data[DEFAULT_PAGE_SIZE - 1], 'z');
+    assert_int_equal(close_database(direct), 0);
+    free(raw);
+    remove(direct_path);
+}
+
+static void test_huge_page_frames(void **state)
+{
+    (void)state;
+    const char *huge_path = "test_storage_engine_huge.db";
+    remove(huge_path);
+
+    // a pool smaller than a huge page keeps regular pages
+    Pager *small = open_database(huge_path, nullptr);
+    assert_non_null(small);
+    assert_int_equal(huge_page_frames(small), 0);
+    assert_int_equal(close_database(small), 0);
+
+    // a larger one may get huge pages once its frames are used, as many as the kernel could spare
+    DatabaseOptions options = {.cache_size = 2048};
+    Pager *large = open_database(huge_path, &options);
+    assert_non_null(large);
+    Page page;
+    int first = allocate_pages(large, 2000);
+    for (int i = 0; i < 2000; i++)
+    {
+        memset(page.data, 'a' + i % 26, DEFAULT_PAGE_SIZE);
+        assert_int_equal(write_page_with_cache(large, first + i, &page), 0);
+    }
+    int huge = huge_page_frames(large);
+    assert_true(huge >= 0 && huge <= 2048);
+    assert_int_equal(read_page_with_cache(large, first + 1999, &page), 0);
+    assert_int_equal(page.data[DEFAULT_PAGE_SIZE - 1], 'a' + 1999 % 26);
+    assert_int_equal(close_database(large), 0);
+    remove(huge_path);
+}
+
+static void test_memory_database(void **state)
+{
+    (void)state;
+    Pager *memory = open_database(MEMORY_DATABASE, &(DatabaseOptions){.cache_size = 16, .use_wal = true});
+    assert_non_null(memory);
+    Pager *other = open_database(MEMORY_DATABASE, nullptr);
+    assert_non_null(other);
+    assert_int_equal(access(MEMORY_DATABASE, F_OK), -1);
+    assert_int_equal(access(MEMORY_DATABASE WAL_SUFFIX, F_OK), -1);
+
+    // evictions and flushes write into the arena, which grows past its first reservation
+    Page page;
+    int first = allocate_pages(memory, 400);
+    for (int i = 0; i < 400; i++)
+    {
+        memset(page.data, 'a' + i % 26, DEFAULT_PAGE_SIZE);
+        assert_int_equal(write_page_with_cache(memory, first + i, &page), 0);
+    }
+    assert_int_equal(checkpoint_database(memory), 0);
+    for (int i = 0; i < 400; i++)
+    {
+        assert_int_equal(read_page_with_cache(memory, first + i, &page), 0);
+        assert_int_equal(page.data[DEFAULT_PAGE_SIZE - 1], 'a' + i % 26);
+    }
+    assert_int_equal(read_page(memory, first + 10000, &page), 0);
+    assert_int_equal(page.data[0], 0);
+    assert_int_equal(free_page(memory, first + 5), 0);
+    assert_int_equal(allocate_page(memory, &page), first + 5);
+
+    // databases in memory don't share anything
+    assert_int_equal(database_header(other).page_count, 2);
+    assert_int_equal(read_page(other, first, &page), 0);
+    assert_int_equal(page.data[0], 0);
+    PageRequest request = {first, page.data, false, 0};
+    assert_int_equal(submit_page_io(memory, &request, 1), -1);
+
+    assert_int_equal(close_database(other), 0);
+    assert_int_equal(close_database(memory), 0);
+    assert_int_equal(access(MEMORY_DATABASE, F_OK), -1);
+}
+
+// fills `page` with the words of a text-heavy table, picked by `seed`.
+static void fill_text(Page *page, unsigned seed)
+{
+    static const char *words[] = {"name", "city", "street", "country", "order", "customer", "paid", "shipped"};
+    int used = 0;
+    while (used < DEFAULT_PAGE_SIZE)
+    {
+        const char *word = words[rand_r(&seed) % (sizeof(words) / sizeof(words[0]))];
+        for (int i = 0; word[i] != '\0' && used < DEFAULT_PAGE_SIZE; i++)
+        {
+            page->data[used++] = (uint8_t)word[i];
+        }
+        if (used < DEFAULT_PAGE_SIZE)
+        {
+            page->data[used++] = ',';
+        }
+    }
+}
+
+static void test_compressed_database(void **state)
+{
+    (void)state;
+    const char *compressed_path = "test_storage_engine_compressed.db";
+    remove(compressed_path);
+    DatabaseOptions options = {.use_compression = true, .cache_size = 32, .use_wal = true, .checkpoint_frames = 100};
+    Pager *compressed = open_database(compressed_path, &options);
+    assert_non_null(compressed);
+    assert_int_equal(database_header(compressed).flags, DATABASE_COMPRESSED);
+
+    // pages reach their slots through evictions, flushes and checkpoints of the log
+    Page page;
+    int first = allocate_pages(compressed, 300);
+    for (int i = 0; i < 300; i++)
+    {
+        fill_text(&page, (unsigned)i);
+        assert_int_equal(write_page_with_cache(compressed, first + i, &page), 0);
+        if (i % 50 == 0)
+        {
+            assert_int_equal(flush_dirty_pages(compressed), 0);
+        }
+    }
+    PageRequest request = {first, page.data, false, 0};
+    assert_int_equal(submit_page_io(compressed, &request, 1), -1);
+    assert_int_equal(close_database(compressed), 0);
+
+    struct stat st;
+    assert_int_equal(stat(compressed_path, &st), 0);
+    assert_true(st.st_size * 2 < 300 * DEFAULT_PAGE_SIZE);
+
+    // the header tells that the datafile is compressed
+    compressed = open_database(compressed_path, nullptr);
+    assert_non_null(compressed);
+    Page expected;
+    for (int i = 0; i < 300; i++)
+    {
+        fill_text(&expected, (unsigned)i);
+        assert_int_equal(read_page_with_cache(compressed, first + i, &page), 0);
+        assert_memory_equal(page.data, expected.data, DEFAULT_PAGE_SIZE);
+    }
+    PageCodecStats stats = compression_stats(compressed);
+    assert_true(stats.pages >= 300);
+    assert_true(stats.slot_bytes * 2 < stats.pages * DEFAULT_PAGE_SIZE);
+    assert_int_equal(close_database(compressed), 0);
+    remove(compressed_path);
+}
+
+static void test_failed_load(void **state)
+{
+    (void)state;
+    const char *damaged_path = "test_storage_engine_damaged.db";
+    remove(damaged_path);
+    DatabaseOptions options = {.use_compression = true, .cache_size = 8};
+    Pager *damaged = open_database(damaged_path, &options);
+    assert_non_null(damaged);
+
+    // random bytes don't compress: the slot of the page makes most of the datafile
+    Page page;
+    unsigned seed = 1;
+    for (int i = 0; i < DEFAULT_PAGE_SIZE; i++)
+    {
+        page.data[i] = (uint8_t)rand_r(&seed);
+    }
+    int page_number = allocate_page(damaged, &page);
+    assert_true(page_number > 0);
+    assert_int_equal(close_database(damaged), 0);
+    struct stat st;
+    assert_int_equal(stat(damaged_path, &st), 0);
+    assert_true(st.st_size > DEFAULT_PAGE_SIZE * 2);
+    FILE *file = fopen(damaged_path, "r+");
+    assert_non_null(file);
+    assert_int_equal(fseek(file, st.st_size - DEFAULT_PAGE_SIZE / 2, SEEK_SET), 0);
+    assert_int_equal(fwrite("torn", 1, 4, file), 4);
+    fclose(file);
+
+    // the frame a failed read was loaded into is dropped: the next request reads the page again
+    damaged = open_database(damaged_path, nullptr);
+    assert_non_null(damaged);
+    assert_int_equal(read_page_with_cache(damaged, page_number, &page), -1);
+    assert_int_equal(cache_search(damaged, page_number), -1);
+    assert_null(pin_page(damaged, page_number));
+    assert_int_equal(cache_search(damaged, page_number), -1);
+
+    // the page can still be overwritten
+    fill_text(&page, 2);
+    assert_int_equal(write_page_with_cache(damaged, page_number, &page), 0);
+    Page read;
+    assert_int_equal(read_page_with_cache(damaged, page_number, &read), 0);
+    assert_memory_equal(read.data, page.data, DEFAULT_PAGE_SIZE);
+    assert_int_equal(close_database(damaged), 0);
+    remove(damaged_path);
+}
+
+#define VACUUM_PAGES 300
+
+static int page_locations[VACUUM_PAGES];
+
+static int record_move(void *context, int from, int to)
+{
+    int *moves = context;
+    for (int i = 0; i < VACUUM_PAGES; i++)
+    {
+        if (page_locations[i] == from)
+        {
+            page_locations[i] = to;
+            (*moves)++;
+            return 0;
+        }
+    }
+    return -1; // not a page of the test
+}
+
+static int count_move(void *context, int from, int to)
+{
+    (void)from;
+    (void)to;
+    (*(int *)context)++;
+    return 0;
+}
+
+static int refuse_move(void *context, int from, int to)
+{
+    (void)context;
+    (void)from;
+    (void)to;
+    return -1;
+}
+
+static void test_vacuum(void **state)
+{
+    (void)state;
+    const char *vacuum_path = "test_storage_engine_vacuum.db";
+    remove(vacuum_path);
+    DatabaseOptions options = {.cache_size = 64};
+    Pager *database = open_database(vacuum_path, &options);
+    assert_non_null(database);
+
+    // one page in ten stays in use, spread over the whole datafile
+    Page page;
+    int first = allocate_pages(database, VACUUM_PAGES);
+    for (int i = 0; i < VACUUM_PAGES; i++)
+    {
+        page_locations[i] = i % 10 == 0 ? first + i : -1;
+        snprintf((char *)page.data, sizeof(page.data), "vacuumed page %d", i);
+        assert_int_equal(write_page_with_cache(database, first + i, &page), 0);
+    }
+    assert_int_equal(flush_dirty_pages(database), 0);
+    for (int i = 0; i < VACUUM_PAGES; i++)
+    {
+        if (page_locations[i] == -1)
+        {
+            assert_int_equal(free_page(database, first + i), 0);
+        }
+    }
+
+    int moves = 0;
+    int steps = 0;
+    int done;
+    while ((done = vacuum_step(database, 10, record_move, &moves)) > 0)
+    {
+        assert_true(done <= 10);
+        steps++;
+    }
+    assert_int_equal(done, 0);
+    assert_true(steps >= VACUUM_PAGES / 10);
+    DatabaseHeader header = database_header(database);
+    assert_int_equal(header.page_count, first + VACUUM_PAGES / 10);
+    assert_int_equal(header.free_count, 0);
+    assert_true(moves > 0);
+    struct stat st;
+    assert_int_equal(stat(vacuum_path, &st), 0);
+    assert_int_equal(st.st_size, (off_t)header.page_count * DEFAULT_PAGE_SIZE);
+
+    // a pinned page stays where it is
+    int last = (int)header.page_count - 1;
+    assert_int_equal(free_page(database, first), 0);
+    assert_non_null(pin_page(database, last));
+    assert_int_equal(vacuum_step(database, 10, record_move, &moves), 0);
+    assert_int_equal(unpin_page(database, last, false), 0);
+    assert_int_equal(vacuum_step(database, 10, record_move, &moves), 2);
+    page_locations[0] = -1;
+
+    // a mover that refuses cancels the move
+    assert_int_equal(free_page(database, page_locations[10]), 0);
+    page_locations[10] = -1;
+    header = database_header(database);
+    assert_int_equal(vacuum_step(database, 10, refuse_move, nullptr), -1);
+    assert_int_equal(database_header(database).page_count, header.page_count);
+    assert_int_equal(database_header(database).free_count, 1);
+    assert_int_equal(vacuum_step(database, 10, record_move, &moves), 2);
+    assert_int_equal(close_database(database), 0);
+
+    database = open_database(vacuum_path, &options);
+    assert_non_null(database);
+    for (int i = 0; i < VACUUM_PAGES; i++)
+    {
+        if (page_locations[i] != -1)
+        {
+            char expected[32];
+            snprintf(expected, sizeof(expected), "vacuumed page %d", i);
+            assert_int_equal(read_page_with_cache(database, page_locations[i], &page), 0);
+            assert_string_equal((char *)page.data, expected);
+        }
+    }
+    assert_int_equal(close_database(database), 0);
+
+    // with a log the datafile keeps its size until the checkpoint
+    options.use_wal = true;
+    database = open_database(vacuum_path, &options);
+    assert_non_null(database);
+    assert_int_equal(free_page(database, page_locations[20]), 0);
+    page_locations[20] = -1;
+    assert_int_equal(stat(vacuum_path, &st), 0);
+    off_t size = st.st_size;
+    assert_int_equal(vacuum_step(database, 10, record_move, &moves), 2);
+    assert_int_equal(stat(vacuum_path, &st), 0);
+    assert_int_equal(st.st_size, size);
+    assert_int_equal(checkpoint_database(database), 0);
+    assert_int_equal(stat(vacuum_path, &st), 0);
+    assert_int_equal(st.st_size, size - DEFAULT_PAGE_SIZE);
+    assert_int_equal(close_database(database), 0);
+    remove(vacuum_path);
+}
+
+// returns true if one of the pages of the database holds `text`.
+static bool find_page_with(Pager *database, const char *text)
+{
+    Page page;
+    for (int i = 0; i < (int)database_header(database).page_count; i++)
+    {
+        if (read_page(database, i, &page) == 0 && strcmp((char *)page.data, text) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void test_vacuum_keeps_viewed_pages(void **state)
+{
+    (void)state;
+    const char *vacuum_path = "test_storage_engine_vacuum.db";
+    remove(vacuum_path);
+    DatabaseOptions options = {.cache_size = 16, .use_mmap = true};
+    Pager *database = open_database(vacuum_path, &options);
+    assert_non_null(database);
+    Page page;
+    int first = allocate_pages(database, 20);
+    for (int i = 0; i < 20; i++)
+    {
+        snprintf((char *)page.data, sizeof(page.data), "viewed page %d", i);
+        assert_int_equal(write_page_with_cache(database, first + i, &page), 0);
+    }
+    assert_int_equal(close_database(database), 0);
+
+    // the last page is viewed through the mapping while the pages before it are free
+    database = open_database(vacuum_path, &options);
+    assert_non_null(database);
+    for (int i = 0; i < 19; i++)
+    {
+        assert_int_equal(free_page(database, first + i), 0);
+    }
+    int last = first + 19;
+    const Page *view = view_page(database, last);
+    assert_non_null(view);
+    assert_int_equal(cache_search(database, last), -1);
+    DatabaseHeader header = database_header(database);
+    struct stat before;
+    assert_int_equal(stat(vacuum_path, &before), 0);
+    assert_int_equal(vacuum_step(database, 10, nullptr, nullptr), 0);
+    assert_int_equal(database_header(database).page_count, header.page_count);
+    struct stat after;
+    assert_int_equal(stat(vacuum_path, &after), 0);
+    assert_int_equal(after.st_size, before.st_size);
+    assert_string_equal((char *)view->data, "viewed page 19");
+
+    // once the view is released the page moves and the datafile shrinks
+    assert_int_equal(release_view(database, view), 0);
+    int moves = 0;
+    assert_true(vacuum_step(database, 40, count_move, &moves) > 0);
+    assert_int_equal(moves, 1);
+    assert_int_equal(database_header(database).page_count, first + 1);
+    assert_int_equal(stat(vacuum_path, &after), 0);
+    assert_int_equal(after.st_size, (off_t)(first + 1) * DEFAULT_PAGE_SIZE);
+    assert_int_equal(read_page_with_cache(database, first, &page), 0);
+    assert_string_equal((char *)page.data, "viewed page 19");
+    assert_int_equal(close_database(database), 0);
+    remove(vacuum_path);
+}
+
+static void test_vacuum_crash(void **state)
+{
+    (void)state;
+    const char *vacuum_path = "test_storage_engine_vacuum.db";
+    remove(vacuum_path);
+    pid_t pid = fork();
+    assert_true(pid >= 0);
+    if (pid == 0)
+    {
+        Pager *database = open_database(vacuum_path, nullptr);
+        int first = database != nullptr ? allocate_pages(database, 40) : -1;
+        Page page;
+        for (int i = 0; i < 40 && first != -1; i++)
+        {
+            snprintf((char *)page.data, sizeof(page.data), "live page %d", i);
+            write_page_with_cache(database, first + i, &page);
+        }
+        if (first == -1 || checkpoint_database(database) != 0)
+        {
+            _exit(1);
+        }
+        for (int i = 0; i < 20; i++)
+        {
+            free_page(database, first + i);
+        }
+        // the pages at the end move into the freed ones, then the datafile is truncated
+        int moves = 0;
+        if (vacuum_step(database, 40, count_move, &moves) <= 0 || moves == 0)
+        {
+            _exit(1);
+        }
+        _exit(0); // crash without flushing
+    }
+
+    int status;
+    assert_int_equal(waitpid(pid, &status, 0), pid);
+    assert_true(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    // the header matches the truncated datafile and every live page survived its move
+    Pager *database = open_database(vacuum_path, nullptr);
+    assert_non_null(database);
+    struct stat st;
+    assert_int_equal(stat(vacuum_path, &st), 0);
+    assert_int_equal(st.st_size, (off_t)database_header(database).page_count * DEFAULT_PAGE_SIZE);
+    for (int i = 20; i < 40; i++)
+    {
+        char expected[32];
+        snprintf(expected, sizeof(expected), "live page %d", i);
+        assert_true(find_page_with(database, expected));
+    }
+    assert_int_equal(close_database(database), 0);
+    remove(vacuum_path);
+}
+
+static void test_vacuum_trimmed_pages_read_as_zeros(void **state)
+{
+    (void)state;
+    const char *vacuum_path = "test_storage_engine_vacuum.db";
+    DatabaseOptions modes[] = {{.use_wal = true}, {.use_compression = true}, {.use_compression = true, .use_wal = true}};
+    for (int mode = 0; mode < 3; mode++)
+    {
+        remove(vacuum_path);
+        Pager *database = open_database(vacuum_path, &modes[mode]);
+        assert_non_null(database);
+        assert_int_equal(checkpoint_database(database), 0);
+
+        // the log or the slots still hold the images of the trimmed pages
+        Page page;
+        int first = allocate_pages(database, 8);
+        for (int i = 0; i < 8; i++)
+        {
+            snprintf((char *)page.data, sizeof(page.data), "trimmed page %d", i);
+            assert_int_equal(write_page_with_cache(database, first + i, &page), 0);
+        }
+        assert_int_equal(flush_dirty_pages(database), 0);
+        for (int i = 0; i < 8; i++)
+        {
+            assert_int_equal(free_page(database, first + i), 0);
+        }
+        assert_int_equal(vacuum_step(database, 8, nullptr, nullptr), 8);
+        assert_int_equal(flush_dirty_pages(database), 0);
+
+        // appended again, the pages are new
+        assert_int_equal(allocate_pages(database, 8), first);
+        for (int i = 0; i < 8; i++)
+        {
+            assert_int_equal(read_page_with_cache(database, first + i, &page), 0);
+            assert_int_equal(page.data[0], 0);
+        }
+        assert_int_equal(close_database(database), 0);
+        database = open_database(vacuum_path, &modes[mode]);
+        assert_non_null(database);
+        for (int i = 0; i < 8; i++)
+        {
+            assert_int_equal(read_page_with_cache(database, first + i, &page), 0);
+            assert_int_equal(page.data[0], 0);
+        }
+        assert_int_equal(close_database(database), 0);
+    }
+    remove(vacuum_path);
+}
+
+static void test_io_stats(void **state)
+{
+    (void)state;
+    const char *stats_path = "test_storage_engine_stats.db";
+    remove(stats_path);
+    DatabaseOptions options = {.cache_size = 16, .collect_io_stats = true};
+    Pager *database = open_database(stats_path, &options);
+    assert_non_null(database);
+    assert_int_equal(checkpoint_database(database), 0); // writes the new header and bitmap pages out
+    IoStats before = io_stats(database);
+
+    Page page = {0};
+    for (int i = 0; i < 8; i++)
+    {
+        assert_int_equal(write_page(database, 10 + i, &page), 0);
+        assert_int_equal(read_page(database, 10 + i, &page), 0);
+    }
+    IoStats stats = io_stats(database);
+    assert_int_equal(stats.page_reads - before.page_reads, 8);
+    assert_int_equal(stats.bytes_read - before.bytes_read, 8 * DEFAULT_PAGE_SIZE);
+    assert_int_equal(stats.read_latency.count - before.read_latency.count, 8);
+    assert_true(stats.read_latency.max_ns > 0);
+
+    // the dirty frames are flushed as a single run
+    for (int i = 0; i < 4; i++)
+    {
+        assert_int_equal(write_page_with_cache(database, 20 + i, &page), 0);
+    }
+    assert_int_equal(checkpoint_database(database), 0);
+
+    stats = io_stats(database);
+    assert_int_equal(stats.page_writes - before.page_writes, 12);
+    assert_int_equal(stats.write_latency.count - before.write_latency.count, 9);
+    assert_int_equal(stats.bytes_written - before.bytes_written, 12 * DEFAULT_PAGE_SIZE);
+    assert_int_equal(stats.syncs - before.syncs, 1);
+
+    char *text = nullptr;
+    size_t size = 0;
+    FILE *output = open_memstream(&text, &size);
+    assert_int_equal(dump_io_stats(database, output), 0);
+    fclose(output);
+    assert_non_null(strstr(text, "syncs"));
+    assert_non_null(strstr(text, "read latency:"));
+    assert_non_null(strstr(text, "write latency:"));
+    free(text);
+    assert_int_equal(close_database(database), 0);
+
+    // without the option only the buffer pool counts
+    database = open_database(stats_path, nullptr);
+    assert_non_null(database);
+    assert_int_equal(read_page_with_cache(database, 10, &page), 0);
+    stats = io_stats(database);
+    assert_int_equal(stats.page_reads, 0);
+    assert_int_equal(stats.read_latency.count, 0);
+    assert_int_equal(stats.cache.misses, 1);
+    assert_int_equal(close_database(database), 0);
+
+    // a checkpoint writes the logged pages into the datafile and syncs it, then resets the log with another sync
+    options.use_wal = true;
+    database = open_database(stats_path, &options);
+    assert_non_null(database);
+    assert_int_equal(checkpoint_database(database), 0);
+    before = io_stats(database);
+    for (int i = 0; i < 4; i++)
+    {
+        assert_int_equal(write_page_with_cache(database, 30 + i, &page), 0);
+    }
+    assert_int_equal(flush_dirty_pages(database), 0);
+    stats = io_stats(database);
+    assert_int_equal(stats.page_writes - before.page_writes, 0);
+    assert_int_equal(stats.syncs - before.syncs, 1);
+    assert_int_equal(checkpoint_database(database), 0);
+    stats = io_stats(database);
+    assert_int_equal(stats.page_writes - before.page_writes, 4);
+    assert_int_equal(stats.bytes_written - before.bytes_written, 4 * DEFAULT_PAGE_SIZE);
+    assert_int_equal(stats.syncs - before.syncs, 3);
+    assert_int_equal(close_database(database), 0);
+    remove(stats_path);
+
+    // the slots of a compressed datafile are smaller than the pages they hold
+    options = (DatabaseOptions){.cache_size = 16, .collect_io_stats = true, .use_compression = true};
+    database = open_database(stats_path, &options);
+    assert_non_null(database);
+    assert_int_equal(checkpoint_database(database), 0);
+    before = io_stats(database);
+    PageCodecStats codec_before = compression_stats(database);
+    for (int i = 0; i < 8; i++)
+    {
+        snprintf((char *)page.data, sizeof(page.data), "compressed page %d", i);
+        assert_int_equal(write_page(database, 10 + i, &page), 0);
+        assert_int_equal(read_page(database, 10 + i, &page), 0);
+    }
+    assert_int_equal(checkpoint_database(database), 0);
+    stats = io_stats(database);
+    PageCodecStats codec = compression_stats(database);
+    assert_int_equal(stats.page_writes - before.page_writes, 8);
+    assert_int_equal(stats.page_reads - before.page_reads, 8);
+    assert_int_equal(stats.bytes_written - before.bytes_written, codec.bytes_written - codec_before.bytes_written);
+    assert_int_equal(stats.bytes_read - before.bytes_read, codec.bytes_read - codec_before.bytes_read);
+    assert_true(stats.bytes_written - before.bytes_written > 0);
+    assert_true(stats.bytes_written - before.bytes_written < 8 * DEFAULT_PAGE_SIZE / 4);
+    assert_true(stats.bytes_read - before.bytes_read < 8 * DEFAULT_PAGE_SIZE / 4);
+    assert_int_equal(stats.syncs - before.syncs, 1);
+    assert_int_equal(close_database(database), 0);
+    remove(stats_path);
 }
 
 int main(void)
@@ -83,11 +1466,41 @@ int main(void)
         cmocka_unit_test(test_open_database),
         cmocka_unit_test(test_write_page),
         cmocka_unit_test(test_read_page),
+        cmocka_unit_test(test_read_page_past_end_of_file),
         cmocka_unit_test(test_allocate_page),
         cmocka_unit_test(test_free_page),
         cmocka_unit_test(test_read_page_with_cache),
         cmocka_unit_test(test_write_page_with_cache),
+        cmocka_unit_test(test_cache_hit_after_write),
+        cmocka_unit_test(test_cache_eviction),
+        cmocka_unit_test(test_pin_page),
+        cmocka_unit_test(test_pinned_pages_are_not_evicted),
+        cmocka_unit_test(test_write_back_on_flush),
+        cmocka_unit_test(test_dirty_page_written_on_eviction),
+        cmocka_unit_test(test_submit_page_io),
         cmocka_unit_test(test_close_database),
+        cmocka_unit_test(test_free_space_persists),
+        cmocka_unit_test(test_allocate_pages),
+        cmocka_unit_test(test_allocate_pages_without_bitmap),
+        cmocka_unit_test(test_readahead),
+        cmocka_unit_test(test_scan_resistant_policy),
+        cmocka_unit_test(test_wal_mode),
+        cmocka_unit_test(test_wal_recovery_after_crash),
+        cmocka_unit_test(test_mmap_mode),
+        cmocka_unit_test(test_two_databases),
+        cmocka_unit_test(test_concurrent_access),
+        cmocka_unit_test(test_commit_while_evictions_log_pages),
+        cmocka_unit_test(test_page_size),
+        cmocka_unit_test(test_direct_io),
+        cmocka_unit_test(test_huge_page_frames),
+        cmocka_unit_test(test_memory_database),
+        cmocka_unit_test(test_compressed_database),
+        cmocka_unit_test(test_failed_load),
+        cmocka_unit_test(test_vacuum),
+        cmocka_unit_test(test_vacuum_keeps_viewed_pages),
+        cmocka_unit_test(test_vacuum_crash),
+        cmocka_unit_test(test_vacuum_trimmed_pages_read_as_zeros),
+        cmocka_unit_test(test_io_stats),
     };
 
     return cmocka_run_group_tests(tests, nullptr, nullptr);
@@ -0,0 +1,235 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "wal.h"
+
+#define TEST_WAL        "wal_test.db-wal"
+#define TEST_DATAFILE   "wal_test.db"
+#define TEST_PAGE_SIZE  4096
+#define COMMITTERS      8
+#define COMMITS         50
+
+static uint8_t pages[4][TEST_PAGE_SIZE];
+
+static Wal *fresh_wal()
+{
+    unlink(TEST_WAL);
+    Wal *wal = wal_open(TEST_WAL, TEST_PAGE_SIZE);
+    assert_non_null(wal);
+    return wal;
+}
+
+// appends a transaction made of one page filled with `text`.
+static int64_t commit_text(Wal *wal, int page_number, const char *text)
+{
+    uint8_t page[TEST_PAGE_SIZE] = {0};
+    const uint8_t *images[] = {page};
+    strcpy((char *)page, text);
+    int64_t sequence = wal_append(wal, &page_number, images, 1, true);
+    assert_true(sequence > 0);
+    return sequence;
+}
+
+static void assert_logged(Wal *wal, int page_number, const char *text)
+{
+    uint8_t page[TEST_PAGE_SIZE];
+    assert_int_equal(wal_read_page(wal, page_number, page), 1);
+    assert_string_equal((char *)page, text);
+}
+
+static void test_append_and_read(void **state)
+{
+    (void)state;
+    Wal *wal = fresh_wal();
+
+    int page_numbers[] = {7, 3, 7};
+    const uint8_t *images[] = {pages[0], pages[1], pages[2]};
+    strcpy((char *)pages[0], "first image of 7");
+    strcpy((char *)pages[1], "page 3");
+    strcpy((char *)pages[2], "second image of 7");
+    int64_t sequence = wal_append(wal, page_numbers, images, 3, true);
+    assert_int_equal(sequence, 3);
+    assert_int_equal(wal_sync(wal, sequence), 0);
+
+    assert_int_equal(wal_frame_count(wal), 3);
+    assert_logged(wal, 7, "second image of 7");
+    assert_logged(wal, 3, "page 3");
+    assert_true(wal_contains(wal, 3));
+    assert_false(wal_contains(wal, 4));
+    assert_int_equal(wal_read_page(wal, 4, pages[3]), 0);
+
+    WalStats stats = wal_stats(wal);
+    assert_int_equal(stats.frames, 3);
+    assert_int_equal(stats.commits, 1);
+    assert_int_equal(stats.syncs, 1);
+    wal_close(wal);
+}
+
+static void test_recovery_drops_uncommitted_frames(void **state)
+{
+    (void)state;
+    Wal *wal = fresh_wal();
+    commit_text(wal, 1, "committed");
+
+    int page_number = 2;
+    const uint8_t *images[] = {pages[0]};
+    strcpy((char *)pages[0], "never committed");
+    assert_true(wal_append(wal, &page_number, images, 1, false) > 0);
+    assert_logged(wal, 2, "never committed");
+    wal_close(wal);
+
+    wal = wal_open(TEST_WAL, TEST_PAGE_SIZE);
+    assert_non_null(wal);
+    assert_int_equal(wal_frame_count(wal), 1);
+    assert_logged(wal, 1, "committed");
+    assert_false(wal_contains(wal, 2));
+
+    // appends go on after the recovered frames
+    commit_text(wal, 2, "committed later");
+    wal_close(wal);
+    wal = wal_open(TEST_WAL, TEST_PAGE_SIZE);
+    assert_int_equal(wal_frame_count(wal), 2);
+    assert_logged(wal, 2, "committed later");
+    wal_close(wal);
+}
+
+static void test_torn_frame_ends_the_log(void **state)
+{
+    (void)state;
+    Wal *wal = fresh_wal();
+    commit_text(wal, 1, "intact");
+    commit_text(wal, 2, "torn");
+    wal_close(wal);
+
+    // damage the image of the second frame as a crash in the middle of its write would
+    int fd = open(TEST_WAL, O_RDWR);
+    off_t offset = WAL_HEADER_SIZE + (WAL_FRAME_HEADER_SIZE + TEST_PAGE_SIZE) + WAL_FRAME_HEADER_SIZE + 100;
+    assert_int_equal(pwrite(fd, "x", 1, offset), 1);
+    close(fd);
+
+    wal = wal_open(TEST_WAL, TEST_PAGE_SIZE);
+    assert_non_null(wal);
+    assert_int_equal(wal_frame_count(wal), 1);
+    assert_logged(wal, 1, "intact");
+    assert_false(wal_contains(wal, 2));
+    wal_close(wal);
+}
+
+static void test_checkpoint(void **state)
+{
+    (void)state;
+    Wal *wal = fresh_wal();
+    int db_fd = open(TEST_DATAFILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    assert_true(db_fd >= 0);
+
+    commit_text(wal, 2, "old image of 2");
+    commit_text(wal, 5, "page 5");
+    commit_text(wal, 2, "new image of 2");
+
+    // frames without a commit after them stay in the log, the datafile gets the committed image of their page
+    int page_numbers[] = {9, 5};
+    strcpy((char *)pages[0], "page 9 before its commit");
+    strcpy((char *)pages[1], "page 5 committed later");
+    const uint8_t *images[] = {pages[0], pages[1]};
+    assert_true(wal_append(wal, page_numbers, images, 2, false) > 0);
+    assert_int_equal(wal_checkpoint(wal, db_fd), 0);
+    assert_int_equal(wal_frame_count(wal), 2);
+    assert_false(wal_contains(wal, 2));
+    assert_logged(wal, 9, "page 9 before its commit");
+    assert_logged(wal, 5, "page 5 committed later");
+    uint8_t page[TEST_PAGE_SIZE];
+    assert_int_equal(pread(db_fd, page, TEST_PAGE_SIZE, 5 * TEST_PAGE_SIZE), TEST_PAGE_SIZE);
+    assert_string_equal((char *)page, "page 5");
+    assert_int_equal(pread(db_fd, page, TEST_PAGE_SIZE, 9 * TEST_PAGE_SIZE), 0);
+
+    commit_text(wal, 9, "page 9");
+    assert_int_equal(wal_checkpoint(wal, db_fd), 0);
+    assert_int_equal(wal_frame_count(wal), 0);
+    assert_false(wal_contains(wal, 5));
+    assert_int_equal(wal_stats(wal).checkpoints, 2);
+
+    assert_int_equal(pread(db_fd, page, TEST_PAGE_SIZE, 2 * TEST_PAGE_SIZE), TEST_PAGE_SIZE);
+    assert_string_equal((char *)page, "new image of 2");
+    assert_int_equal(pread(db_fd, page, TEST_PAGE_SIZE, 5 * TEST_PAGE_SIZE), TEST_PAGE_SIZE);
+    assert_string_equal((char *)page, "page 5 committed later");
+    assert_int_equal(pread(db_fd, page, TEST_PAGE_SIZE, 9 * TEST_PAGE_SIZE), TEST_PAGE_SIZE);
+    assert_string_equal((char *)page, "page 9");
+
+    // the reset log starts a new generation
+    commit_text(wal, 3, "after the checkpoint");
+    wal_close(wal);
+    wal = wal_open(TEST_WAL, TEST_PAGE_SIZE);
+    assert_int_equal(wal_frame_count(wal), 1);
+    assert_logged(wal, 3, "after the checkpoint");
+    assert_false(wal_contains(wal, 2));
+
+    wal_close(wal);
+    close(db_fd);
+    unlink(TEST_DATAFILE);
+}
+
+static void *committer(void *argument)
+{
+    Wal *wal = argument;
+    uint8_t page[TEST_PAGE_SIZE] = {0};
+    const uint8_t *images[] = {page};
+    for (int i = 0; i < COMMITS; i++)
+    {
+        int page_number = i;
+        int64_t sequence = wal_append(wal, &page_number, images, 1, true);
+        if (sequence == -1 || wal_sync(wal, sequence) != 0)
+        {
+            return (void *)1;
+        }
+    }
+    return nullptr;
+}
+
+static void test_group_commit(void **state)
+{
+    (void)state;
+    Wal *wal = fresh_wal();
+
+    pthread_t threads[COMMITTERS];
+    for (int i = 0; i < COMMITTERS; i++)
+    {
+        assert_int_equal(pthread_create(&threads[i], nullptr, committer, wal), 0);
+    }
+    for (int i = 0; i < COMMITTERS; i++)
+    {
+        void *result;
+        pthread_join(threads[i], &result);
+        assert_null(result);
+    }
+
+    // every commit returned durable, some of them through an fsync run by another committer
+    WalStats stats = wal_stats(wal);
+    assert_int_equal(stats.commits, COMMITTERS * COMMITS);
+    assert_true(stats.syncs <= stats.commits);
+    assert_int_equal(wal_frame_count(wal), COMMITTERS * COMMITS);
+
+    wal_close(wal);
+    unlink(TEST_WAL);
+}
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_append_and_read),
+        cmocka_unit_test(test_recovery_drops_uncommitted_frames),
+        cmocka_unit_test(test_torn_frame_ends_the_log),
+        cmocka_unit_test(test_checkpoint),
+        cmocka_unit_test(test_group_commit),
+    };
+
+    return cmocka_run_group_tests(tests, nullptr, nullptr);
+}